@@ -1,3 +1,7 @@
+#ifdef USE_UBOS
+#extension GL_ARB_uniform_buffer_object : require
+#endif
+
 attribute vec3 a_vertex;
 attribute vec3 a_normal;
 attribute vec2 a_uv;
@@ -7,7 +11,32 @@ attribute mat4 u_model;
 
 uniform vec3 u_camera_pos;
 
+#ifdef USE_UBOS
+//per frame and camera, see UniformBuffer
+layout(std140) uniform FrameBlock {
+	mat4 u_viewprojection;
+	vec3 u_camera_position;
+	float u_time;
+	float u_exposure;
+	float u_output;
+};
+#else
 uniform mat4 u_viewprojection;
+#endif
+
+//to decode quantized meshes, identity otherwise
+uniform vec3 u_vertex_offset;
+uniform vec3 u_vertex_scale;
+uniform vec4 u_uv_transform; //offset in xy, scale in zw
+uniform float u_oct_normals;
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
 
 //this will store the color for the pixel shader
 varying vec3 v_position;
@@ -17,15 +46,20 @@ varying vec2 v_uv;
 
 void main()
 {	
+	//decode the attributes
+	vec3 vertex = u_vertex_offset + a_vertex * u_vertex_scale;
+	vec3 normal = u_oct_normals > 0.0 ? decodeOctahedral(a_normal.xy) : a_normal;
+	vec2 uv = u_uv_transform.xy + a_uv * u_uv_transform.zw;
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * vec4( normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
-	v_world_position = (u_model * vec4( a_vertex, 1.0) ).xyz;
+	v_position = vertex;
+	v_world_position = (u_model * vec4( vertex, 1.0) ).xyz;
 	
 	//store the texture coordinates
-	v_uv = a_uv;
+	v_uv = uv;
 
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
@@ -1,3 +1,7 @@
+#ifdef USE_UBOS
+#extension GL_ARB_uniform_buffer_object : require
+#endif
+
 varying vec3 v_position;
 varying vec3 v_world_position;
 varying vec3 v_normal;
@@ -19,8 +23,26 @@ uniform vec3 u_material_diffuse;
 uniform vec3 u_material_specular;
 uniform float u_material_shininess;
 
+#ifdef USE_UBOS
+//per frame and camera, see UniformBuffer
+layout(std140) uniform FrameBlock {
+	mat4 u_viewprojection;
+	vec3 u_camera_position;
+	float u_time;
+	float u_exposure;
+	float u_output;
+};
+#else
 uniform vec3 u_camera_position;
+#endif
+
+#ifdef USE_UBOS
+layout(std140) uniform MaterialBlock {
+	vec4 u_color;
+};
+#else
 uniform vec4 u_color;
+#endif
 
 void main()
 {
@@ -1,3 +1,7 @@
+#ifdef USE_UBOS
+#extension GL_ARB_uniform_buffer_object : require
+#endif
+
 attribute vec3 a_vertex;
 attribute vec3 a_normal;
 attribute vec2 a_uv;
@@ -9,10 +13,35 @@ attribute vec4 a_weights;
 uniform vec3 u_camera_pos;
 
 uniform mat4 u_model;
+#ifdef USE_UBOS
+//per frame and camera, see UniformBuffer
+layout(std140) uniform FrameBlock {
+	mat4 u_viewprojection;
+	vec3 u_camera_position;
+	float u_time;
+	float u_exposure;
+	float u_output;
+};
+#else
 uniform mat4 u_viewprojection;
+#endif
 
 uniform mat4 u_bones[128];
 
+//to decode quantized meshes, identity otherwise
+uniform vec3 u_vertex_offset;
+uniform vec3 u_vertex_scale;
+uniform vec4 u_uv_transform; //offset in xy, scale in zw
+uniform float u_oct_normals;
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
 //this will store the color for the pixel shader
 varying vec3 v_position;
 varying vec3 v_world_position;
@@ -22,14 +51,19 @@ varying vec4 v_color;
 
 void main()
 {	
+	//decode the attributes
+	vec3 vertex = u_vertex_offset + a_vertex * u_vertex_scale;
+	vec3 normal = u_oct_normals > 0.0 ? decodeOctahedral(a_normal.xy) : a_normal;
+	vec2 uv = u_uv_transform.xy + a_uv * u_uv_transform.zw;
+
 	//apply skinning
-	vec4 v = vec4(a_vertex,1.0);
+	vec4 v = vec4(vertex,1.0);
 	v_position =	(u_bones[(int)a_bones.x] * a_weights.x * v + 
 			u_bones[(int)a_bones.y] * a_weights.y * v + 
 			u_bones[(int)a_bones.z] * a_weights.z * v + 
 			u_bones[(int)a_bones.w] * a_weights.w * v).xyz;
 
-	vec4 N = vec4(a_normal,0.0);
+	vec4 N = vec4(normal,0.0);
 	v_normal =	(u_bones[(int)a_bones.x] * a_weights.x * N + 
 			u_bones[(int)a_bones.y] * a_weights.y * N + 
 			u_bones[(int)a_bones.z] * a_weights.z * N + 
@@ -46,7 +80,7 @@ void main()
 	v_color = a_weights;
 
 	//store the texture coordinates
-	v_uv = a_uv;
+	v_uv = uv;
 
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
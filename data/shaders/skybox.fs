@@ -1,8 +1,23 @@
+#ifdef USE_UBOS
+#extension GL_ARB_uniform_buffer_object : require
+#endif
+
 varying vec3 v_world_position;
 varying vec3 v_position;
 
 uniform samplerCube u_texture;
+#ifdef USE_UBOS
+//per frame and camera, see UniformBuffer
+layout(std140) uniform FrameBlock {
+	mat4 u_viewprojection;
+	vec3 u_camera_position;
+	float u_time;
+	float u_exposure;
+	float u_output;
+};
+#else
 uniform vec3 u_camera_position;
+#endif
 
 void main()
 {
@@ -1,11 +1,25 @@
+#ifdef USE_UBOS
+#extension GL_ARB_uniform_buffer_object : require
+#endif
+
 varying vec3 v_position;
 varying vec3 v_world_position;
 varying vec3 v_normal;
 varying vec2 v_uv;
 varying vec4 v_color;
 
-uniform vec4 u_color;
 uniform sampler2D u_texture;
+#ifdef USE_INSTANCING
+varying vec4 v_instance_color; //replaces u_color
+#define u_color v_instance_color
+#elif defined(USE_UBOS)
+//see Material::bindBlock
+layout(std140) uniform MaterialBlock {
+	vec4 u_color;
+};
+#else
+uniform vec4 u_color;
+#endif
 
 void main()
 {
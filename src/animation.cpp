@@ -2,10 +2,13 @@
 #include "framework.h"
 #include "utils.h"
 #include <cassert>
+#include <sys/stat.h>
 
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
+#include "resourceloader.h"
+#include "jobsystem.h"
 
 Skeleton::Skeleton()
 {
@@ -38,17 +41,28 @@ void Skeleton::computeFinalBoneMatrices( std::vector<Matrix44>& bone_matrices, M
 	updateGlobalMatrices();
 
 	bone_matrices.resize(mesh->bones_info.size());
-	#pragma omp for  
-	for (int i = 0; i < (int)mesh->bones_info.size(); ++i)
-	{
-		BoneInfo& bone_info = mesh->bones_info[i];
-		bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix( bone_info.name, false ); //use globals
-	}
+	//only the big skeletons are split, for the rest the jobs cost more than the matrices
+	JobSystem::parallelFor((int)mesh->bones_info.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			BoneInfo& bone_info = mesh->bones_info[i];
+			bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix(bone_info.name, false); //use globals
+		}
+	}, 64);
 }
 
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer)
 {
 	assert(a && b && result && "skeleton cannot be NULL");
+
+	//one of them is still loading (see Animation::Get), use the other one
+	if (a->num_bones != b->num_bones && (a->num_bones == 1 || b->num_bones == 1))
+	{
+		Skeleton* loaded = a->num_bones == 1 ? b : a;
+		if (result != loaded)
+			*result = *loaded;
+		return;
+	}
 	assert(a->num_bones == b->num_bones && "skeleton must contain the same number of bones");
 
 	w = clamp(w, 0.0f, 1.0f);//safety
@@ -77,18 +91,18 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 	}
 
 	//blend bones locally
-	#pragma omp for  
-	for (int i = 0; i < result->num_bones; ++i)
-	{
-		Skeleton::Bone& bone = result->bones[i];
-		Skeleton::Bone& boneA = a->bones[i];
-		Skeleton::Bone& boneB = b->bones[i];
-		if ( layer != 0xFF && !(bone.layer & layer) ) //not in the same layer
-			continue;
-		#pragma omp for  
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp( boneA.model.m[j], boneB.model.m[j], w);
-	}
+	JobSystem::parallelFor(result->num_bones, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			Skeleton::Bone& bone = result->bones[i];
+			Skeleton::Bone& boneA = a->bones[i];
+			Skeleton::Bone& boneB = b->bones[i];
+			if (layer != 0xFF && !(bone.layer & layer)) //not in the same layer
+				continue;
+			for (int j = 0; j < 16; ++j)
+				bone.model.m[j] = lerp(boneA.model.m[j], boneB.model.m[j], w);
+		}
+	}, 64);
 }
 
 void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, bool render_points)
@@ -196,21 +210,67 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 	Matrix44* k2 = keyframes + index2 * num_animated_bones;
 
 	//compute local bones
-	#pragma omp for  
-	for (int i = 0; i < num_animated_bones; ++i)
-	{
-		int bone_index = bones_map[i];
-		Skeleton::Bone& bone = skeleton.bones[bone_index];
-		if (layers != 0xFF && !(bone.layer & layers))
-			continue;
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
-	}
+	JobSystem::parallelFor(num_animated_bones, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			int bone_index = bones_map[i];
+			Skeleton::Bone& bone = skeleton.bones[bone_index];
+			if (layers != 0xFF && !(bone.layer & layers))
+				continue;
+			for (int j = 0; j < 16; ++j)
+				bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
+		}
+	}, 64);
 
 	skeleton.updateGlobalMatrices();
 }
 
 
+void Animation::createRestPose()
+{
+	if (keyframes)
+		delete[] keyframes;
+
+	//one bone without transform and one keyframe
+	duration = 1.0f;
+	samples_per_second = 1.0f;
+	num_animated_bones = 0;
+	num_keyframes = 1;
+	memset(bones_map, 0, sizeof(bones_map));
+	keyframes = new Matrix44[1];
+
+	skeleton.num_bones = 1;
+	skeleton.bones[0] = Skeleton::Bone(); //value initialized, the fields without constructor are zero
+	skeleton.bones[0].parent = -1;
+	skeleton.bones[0].model.setIdentity();
+	strcpy(skeleton.bones[0].name, "root");
+	skeleton.bones_by_name.clear();
+	skeleton.bones_by_name[skeleton.bones[0].name] = 0;
+}
+
+void Animation::moveFrom(Animation* anim)
+{
+	assert(anim && anim != this);
+	if (keyframes)
+		delete[] keyframes;
+
+	duration = anim->duration;
+	samples_per_second = anim->samples_per_second;
+	num_animated_bones = anim->num_animated_bones;
+	num_keyframes = anim->num_keyframes;
+	memcpy(bones_map, anim->bones_map, sizeof(bones_map));
+	keyframes = anim->keyframes;
+	anim->keyframes = NULL;
+
+	skeleton.num_bones = anim->skeleton.num_bones;
+	memcpy(skeleton.bones, anim->skeleton.bones, sizeof(skeleton.bones));
+
+	//the map keys point to the names of our bones
+	skeleton.bones_by_name.clear();
+	for (int i = 0; i < skeleton.num_bones; ++i)
+		skeleton.bones_by_name[skeleton.bones[i].name] = i;
+}
+
 void Animation::operator = (Animation* anim)
 {
 	memcpy(this, anim, sizeof(Animation));
@@ -473,15 +533,34 @@ bool Animation::loadSKANIM(const char* filename)
 }
 
 
-std::map<std::string, Animation*> Animation::sAnimationsLoaded;
+ResourceCache<Animation> Animation::sAnimationsLoaded("Animations", 256 * 1024 * 1024);
 Animation* Animation::Get(const char* filename)
 {
 	assert(filename);
 
 	//check if loaded
-	auto it = sAnimationsLoaded.find(filename);
-	if (it != sAnimationsLoaded.end())
-		return it->second;
+	Animation* cached = sAnimationsLoaded.find(filename);
+	if (cached)
+		return cached;
+
+	//background loading, a rest pose till the animation is ready. If it fails the rest pose stays
+	if (ResourceLoader::async)
+	{
+		Animation* anim = new Animation();
+		anim->createRestPose();
+		sAnimationsLoaded.add(filename, anim);
+
+		Animation* loaded = new Animation();
+		std::string name = filename;
+		ResourceLoader::enqueue(anim, filename,
+			[loaded, name]() { return loaded->load(name.c_str()); },
+			[anim, loaded](bool result) {
+				if (result)
+					anim->moveFrom(loaded);
+				delete loaded;
+			});
+		return anim;
+	}
 
 	//load it
 	Animation* anim = new Animation();
@@ -491,6 +570,6 @@ Animation* Animation::Get(const char* filename)
 		return NULL;
 	}
 
-	sAnimationsLoaded[filename] = anim;
+	sAnimationsLoaded.add(filename, anim);
 	return anim;
 }
\ No newline at end of file
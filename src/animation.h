@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mesh.h"
+#include <cstring>
 
 class Camera;
 
@@ -81,8 +82,14 @@ public:
 	bool loadABIN(const char* filename);
 	bool writeABIN(const char* filename);
 
-	static std::map<std::string, Animation*> sAnimationsLoaded;
-	static Animation* Get(const char* filename);
+	static ResourceCache<Animation> sAnimationsLoaded;
+	static Animation* Get(const char* filename); //with ResourceLoader::async it returns a rest pose that gets the animation once loaded
+
+	void createRestPose(); //a single bone without transform, used while loading
+	void moveFrom(Animation* anim); //takes the keyframes and skeleton of anim
+
+	size_t getCPUBytes() { return sizeof(Animation) + (keyframes ? sizeof(Matrix44) * num_keyframes * num_animated_bones : 0); }
+	size_t getVRAMBytes() { return 0; }
 
 	//copy operator to copy the keyframes
 	void operator = (Animation* anim);
@@ -5,8 +5,12 @@
 #include "volume.h"
 #include "fbo.h"
 #include "shader.h"
+#include "glstate.h"
+#include "jobsystem.h"
+#include "profiler.h"
 #include "input.h"
 #include "animation.h"
+#include "material.h"
 #include "extra/hdre.h"
 #include "extra/imgui/imgui.h"
 #include "extra/imgui/imgui_impl_sdl.h"
@@ -16,9 +20,13 @@
 
 bool render_wireframe = false;
 Camera* Application::camera = nullptr;
+bool Application::pipelined = false;
+bool Application::fixed_timestep = true;
+float Application::tick_rate = 60.0f;
+int Application::max_ticks_per_frame = 5;
 Application* Application::instance = NULL;
 
-Application::Application(int window_width, int window_height, SDL_Window* window)
+Application::Application(int window_width, int window_height, SDL_Window* window, bool default_scene)
 {
 	this->window_width = window_width;
 	this->window_height = window_height;
@@ -32,18 +40,27 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	time = 0.0f;
 	elapsed_time = 0.0f;
 	mouse_locked = false;
+	gui_wants_mouse = false;
 	scene_exposure = 1;
 	output = 0;
+	render_snapshot = 0;
+	snapshots[0].ready = snapshots[1].ready = false;
+	frame_ms = latency_ms = 0.0f;
+	accumulator = 0.0;
+	interpolation = 1.0f;
+	num_ticks = num_dropped_ticks = 0;
+	update_ms = render_ms = 0.0f;
 
 	// OpenGL flags
-	glEnable( GL_CULL_FACE ); //render both sides of every triangle
-	glEnable( GL_DEPTH_TEST ); //check the occlusions using the Z buffer
+	GLState::enable(GL_CULL_FACE); //render both sides of every triangle
+	GLState::enable(GL_DEPTH_TEST); //check the occlusions using the Z buffer
 
 	// Create camera
 	camera = new Camera();
 	camera->lookAt(Vector3(5.f, 5.f, 5.f), Vector3(0.f, 0.0f, 0.f), Vector3(0.f, 1.f, 0.f));
 	camera->setPerspective(45.f,window_width/(float)window_height,0.1f,10000.f); //set the projection, we want to be perspective
 
+	if (default_scene)
 	{
 		StandardMaterial* mat = new StandardMaterial();
 		SceneNode* node = new SceneNode("Visible node");
@@ -54,7 +71,16 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 		mat->shader = Shader::Get("data/shaders/basic.vs", "data/shaders/texture.fs");
 		node_list.push_back(node);
 	}
+
+	//the permutations of the scene compile meanwhile, in parallel if the driver can
+	for (size_t i = 0; i < node_list.size(); ++i)
+		if (node_list[i]->material)
+			node_list[i]->material->precompileShaders();
 	
+	previous_camera = *camera;
+	for (size_t i = 0; i < node_list.size(); ++i)
+		node_list[i]->previous_model = node_list[i]->model;
+
 	//hide the cursor
 	SDL_ShowCursor(!mouse_locked); //hide or show the mouse
 }
@@ -62,6 +88,42 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 //what to do when the image has to be draw
 void Application::render(void)
 {
+	sFrameSnapshot& snapshot = snapshots[render_snapshot];
+	prepareFrame(snapshot);
+	renderFrame(snapshot);
+}
+
+void Application::prepareFrame(sFrameSnapshot& snapshot)
+{
+	PROFILE_SCOPE("prepare");
+	//the frustum of the copy, enable is done when it is rendered
+	snapshot.camera = *camera;
+	if (interpolation < 1.0f)
+	{
+		snapshot.camera.eye = lerp(previous_camera.eye, camera->eye, interpolation);
+		snapshot.camera.center = lerp(previous_camera.center, camera->center, interpolation);
+		snapshot.camera.up = lerp(previous_camera.up, camera->up, interpolation);
+	}
+	snapshot.camera.updateViewMatrix();
+	snapshot.camera.updateProjectionMatrix();
+	snapshot.camera.extractFrustum();
+
+	batcher.cull(node_list, &snapshot.camera, snapshot.nodes);
+	if (interpolation < 1.0f)
+		for (size_t i = 0; i < snapshot.nodes.size(); ++i)
+			snapshot.nodes[i].model = lerp(snapshot.nodes[i].node->previous_model, snapshot.nodes[i].model, interpolation);
+	snapshot.render_debug = render_debug;
+	snapshot.render_wireframe = render_wireframe;
+	snapshot.ready = true;
+}
+
+void Application::renderFrame(sFrameSnapshot& snapshot)
+{
+	assert(snapshot.ready);
+	PROFILE_GPU_SCOPE("render");
+	Camera* camera = &snapshot.camera; //the one the frame was updated with
+	Uint64 start = SDL_GetPerformanceCounter();
+
 	//set the clear color (the background color)
 	glClearColor(.1,.1,.1, 1.0);
 
@@ -71,27 +133,74 @@ void Application::render(void)
 	//set the camera as default
 	camera->enable();
 
-<<<<<<< Updated upstream
-=======
-	//render skybox
-	glDisable(GL_DEPTH_TEST); //Disable depth test
-	sky->render(camera);
+	//set flags, the materials choose the face culling
+	GLState::enable(GL_DEPTH_TEST);
 
->>>>>>> Stashed changes
-	//set flags
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
+	//the nodes sharing mesh and material are grouped in instanced draws, then all of them are sorted to reduce the state changes
+	render_queue.clear();
+	batcher.collect(snapshot.nodes, camera, render_queue);
+	render_queue.submit(camera);
 
-	for (size_t i = 0; i < node_list.size(); i++) {
-		node_list[i]->render(camera);
+	//the debug geometry shows both sides
+	GLState::disable(GL_CULL_FACE);
 
-		if(render_wireframe)
-			node_list[i]->renderWireframe(camera);
+	if (snapshot.render_wireframe)
+	{
+		WireframeMaterial* wireframe = WireframeMaterial::getDefault();
+		for (size_t i = 0; i < snapshot.nodes.size(); i++)
+			wireframe->render(snapshot.nodes[i].mesh, snapshot.nodes[i].model, camera, snapshot.nodes[i].lod);
 	}
 
 	//Draw the floor grid
-	if(render_debug)
+	if(snapshot.render_debug)
 		drawGrid();
+
+	snapshot.ready = false;
+	render_ms = float((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+}
+
+void Application::simulate(double seconds_elapsed)
+{
+	PROFILE_SCOPE("simulate");
+	Uint64 start = SDL_GetPerformanceCounter();
+	mouse_delta = mouse_delta + Input::mouse_delta;
+
+	if (!fixed_timestep)
+	{
+		update(seconds_elapsed);
+		interpolation = 1.0f;
+	}
+	else
+	{
+		double step = 1.0 / tick_rate;
+		accumulator += seconds_elapsed;
+		int ticks = 0;
+		while (accumulator >= step)
+		{
+			if (ticks == max_ticks_per_frame)
+			{
+				num_dropped_ticks += long(accumulator / step);
+				accumulator = fmod(accumulator, step);
+				break;
+			}
+			PROFILE_SCOPE("tick");
+			storePreviousState();
+			update(step);
+			accumulator -= step;
+			ticks++;
+			num_ticks++;
+		}
+		interpolation = float(accumulator / step);
+	}
+
+	update_ms = float((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+}
+
+void Application::storePreviousState()
+{
+	previous_camera = *camera;
+	for (size_t i = 0; i < node_list.size(); ++i)
+		node_list[i]->previous_model = node_list[i]->model;
 }
 
 void Application::update(double seconds_elapsed)
@@ -106,11 +215,11 @@ void Application::update(double seconds_elapsed)
 	}*/
 
 	//mouse input to rotate the cam
-	if ((Input::mouse_state & SDL_BUTTON_LEFT && !ImGui::IsAnyWindowHovered() 
-		&& !ImGui::IsAnyItemHovered() && !ImGui::IsAnyItemActive())) //is left button pressed?
+	if ((Input::mouse_state & SDL_BUTTON_LEFT) && !gui_wants_mouse) //is left button pressed?
 	{
-		camera->orbit(-Input::mouse_delta.x * orbit_speed, Input::mouse_delta.y * orbit_speed);
+		camera->orbit(-mouse_delta.x * orbit_speed, mouse_delta.y * orbit_speed);
 	}
+	mouse_delta.set(0.0f, 0.0f);
 
 	//async input to move the camera around
 	if (Input::isKeyPressed(SDL_SCANCODE_LSHIFT)) speed *= 10; //move fast er with left shift
@@ -123,9 +232,16 @@ void Application::update(double seconds_elapsed)
 	if (Input::isKeyPressed(SDL_SCANCODE_SPACE)) camera->moveGlobal(Vector3(0.0f, -1.0f, 0.0f) * speed);
 	if (Input::isKeyPressed(SDL_SCANCODE_LCTRL)) camera->moveGlobal(Vector3(0.0f,  1.0f, 0.0f) * speed);
 
-	//to navigate with the mouse fixed in the middle
+	recorded_path.record(camera, time);
+
+	//to navigate with the mouse fixed in the middle (the window can only be used from the main thread)
 	if (mouse_locked)
-		Input::centerMouse();
+	{
+		if (JobSystem::getCurrentJob())
+			JobSystem::runOnMainThread([]() { Input::centerMouse(); });
+		else
+			Input::centerMouse();
+	}
 }
 
 //Keyboard event handler (sync input)
@@ -136,6 +252,20 @@ void Application::onKeyDown( SDL_KeyboardEvent event )
 		case SDLK_ESCAPE: must_exit = true; break; //ESC key, kill the app
 		case SDLK_F1: render_debug = !render_debug; break;
 		case SDLK_F2: render_wireframe = !render_wireframe; break;
+		case SDLK_F3: pipelined = !pipelined; break;
+		case SDLK_F4:
+			if (!recorded_path.recording)
+			{
+				recorded_path.startRecording(time);
+				std::cout << "Recording camera path" << std::endl;
+			}
+			else
+			{
+				recorded_path.recording = false;
+				if (recorded_path.save("data/bench/recorded.path"))
+					std::cout << "Camera path saved: data/bench/recorded.path (" << recorded_path.keys.size() << " keys)" << std::endl;
+			}
+			break;
 		case SDLK_F5: Shader::ReloadAll(); break; 
 	}
 }
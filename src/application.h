@@ -9,6 +9,20 @@
 #include "camera.h"
 #include "utils.h"
 #include "scenenode.h"
+#include "instancebatcher.h"
+#include "renderqueue.h"
+#include "bench.h"
+
+//everything the render of a frame reads, filled by the update of that frame. With pipelined frames there are two,
+//the update of the next frame fills one while the other is submitted, so none of them is written while it is read
+struct sFrameSnapshot {
+	bool ready; //filled by prepareFrame and not rendered yet
+	Camera camera; //a copy, the update moves the global one
+	std::vector<InstanceBatcher::sVisibleNode> nodes;
+	bool render_debug;
+	bool render_wireframe;
+	Uint64 input_ticks; //when the input used to update this frame was read, to measure the latency
+};
 
 enum EOutput {
 	COMPLETE,
@@ -24,6 +38,8 @@ public:
 	static Application* instance;
 
 	std::vector< SceneNode* > node_list;
+	InstanceBatcher batcher; //groups the nodes sharing mesh and material in instanced draws
+	RenderQueue render_queue; //sorts the draws of the frame
 
 	//window
 	SDL_Window* window;
@@ -43,12 +59,40 @@ public:
 	//some vars
 	static Camera* camera; //our GLOBAL camera
 	bool mouse_locked; //tells if the mouse is locked (not seen)
+	bool gui_wants_mouse; //sampled from ImGui in the main thread before the update, which can run in a job
+
+	//frame pipeline
+	static bool pipelined; //the update of the next frame runs in the jobs while this one is submitted (see mainLoop)
+	sFrameSnapshot snapshots[2];
+	int render_snapshot; //the one submitted next, the other one is filled by the update
+	float frame_ms; //smoothed, from swap to swap
+	float latency_ms; //smoothed, from reading the input to the swap that shows it
+
+	//simulation, with a fixed timestep the update runs tick_rate times per second whatever the frame rate
+	//and the render interpolates the camera and the nodes between the last two ticks
+	static bool fixed_timestep;
+	static float tick_rate; //ticks per second
+	static int max_ticks_per_frame; //if the frame takes longer the time left is dropped, so a slow update does not spiral
+	double accumulator; //seconds not simulated yet
+	float interpolation; //from the previous tick (0) to the last one (1)
+	long num_ticks;
+	long num_dropped_ticks;
+	float update_ms; //last frame, all its ticks
+	float render_ms; //last frame, CPU time submitting it
+	Camera previous_camera;
+	Vector2 mouse_delta; //accumulated till a tick uses it, so no movement is lost or applied twice
+
+	CameraPath recorded_path; //F4 starts and stops recording the camera, saved to be used in the benchmarks
 
-	Application( int window_width, int window_height, SDL_Window* window );
+	Application( int window_width, int window_height, SDL_Window* window, bool default_scene = true );
 
 	//main functions
-	void render( void );
+	void render( void ); //serial: prepares and renders the frame in the calling thread
 	void update( double dt );
+	void simulate( double seconds_elapsed ); //the ticks of the time elapsed, or one update with it if not fixed
+	void storePreviousState(); //before every tick, for the interpolation
+	void prepareFrame(sFrameSnapshot& snapshot); //culls from the camera of the update, no GL calls so it can run in the jobs
+	void renderFrame(sFrameSnapshot& snapshot); //GL thread, only reads the snapshot, the materials and the resources
 
 	//events
 	void onKeyDown( SDL_KeyboardEvent event );
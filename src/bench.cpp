@@ -0,0 +1,624 @@
+#include "bench.h"
+#include "includes.h"
+#include "utils.h"
+#include "camera.h"
+#include "application.h"
+#include "scenenode.h"
+#include "material.h"
+#include "mesh.h"
+#include "texture.h"
+#include "shader.h"
+#include "fbo.h"
+#include "resourceloader.h"
+#include "resourcecache.h"
+#include "ringbuffer.h"
+#include "uniformbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+#include "jobsystem.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+#ifdef USE_EGL
+	#include <EGL/egl.h>
+	#include <EGL/eglext.h>
+#endif
+
+CameraPath::CameraPath()
+{
+	recording = false;
+	record_start = 0.0f;
+}
+
+float CameraPath::getDuration()
+{
+	if (keys.empty())
+		return 0.0f;
+	return keys.back().time;
+}
+
+void CameraPath::sample(float time, Vector3& eye, Vector3& center)
+{
+	assert(keys.size());
+	if (time <= keys.front().time || keys.size() == 1)
+	{
+		eye = keys.front().eye;
+		center = keys.front().center;
+		return;
+	}
+	for (size_t i = 1; i < keys.size(); ++i)
+	{
+		sKey& next = keys[i];
+		if (time > next.time)
+			continue;
+		sKey& prev = keys[i - 1];
+		float f = next.time > prev.time ? (time - prev.time) / (next.time - prev.time) : 1.0f;
+		eye = lerp(prev.eye, next.eye, f);
+		center = lerp(prev.center, next.center, f);
+		return;
+	}
+	eye = keys.back().eye;
+	center = keys.back().center;
+}
+
+void CameraPath::startRecording(float time)
+{
+	keys.clear();
+	recording = true;
+	record_start = time;
+}
+
+void CameraPath::record(Camera* camera, float time)
+{
+	if (!recording)
+		return;
+	//ten keys per second at most, the sample interpolates between them
+	if (keys.size())
+	{
+		sKey& last = keys.back();
+		if (time - record_start - last.time < 0.1f || (last.eye.distance(camera->eye) < 0.001f && last.center.distance(camera->center) < 0.001f))
+			return;
+	}
+	sKey key;
+	key.time = time - record_start;
+	key.eye = camera->eye;
+	key.center = camera->center;
+	keys.push_back(key);
+}
+
+bool CameraPath::parseKey(const std::vector<std::string>& tokens)
+{
+	if (tokens.size() != 8 || tokens[0] != "key")
+		return false;
+	sKey key;
+	key.time = (float)atof(tokens[1].c_str());
+	key.eye.set((float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()), (float)atof(tokens[4].c_str()));
+	key.center.set((float)atof(tokens[5].c_str()), (float)atof(tokens[6].c_str()), (float)atof(tokens[7].c_str()));
+	if (keys.size() && key.time < keys.back().time)
+		return false;
+	keys.push_back(key);
+	return true;
+}
+
+//one line split in words, without the comments
+static std::vector<std::string> readTokens(const std::string& line)
+{
+	std::vector<std::string> tokens;
+	std::stringstream ss(line.substr(0, line.find('#')));
+	std::string token;
+	while (ss >> token)
+		tokens.push_back(token);
+	return tokens;
+}
+
+bool CameraPath::load(const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		std::cout << "[ERROR] camera path not found: " << filename << std::endl;
+		return false;
+	}
+	keys.clear();
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line))
+	{
+		line_number++;
+		std::vector<std::string> tokens = readTokens(line);
+		if (tokens.size() && !parseKey(tokens))
+		{
+			std::cout << "[ERROR] " << filename << ":" << line_number << " wrong key" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CameraPath::save(const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if (!file)
+		return false;
+	fprintf(file, "#key time eye.x eye.y eye.z center.x center.y center.z\n");
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		sKey& key = keys[i];
+		fprintf(file, "key %.3f %.4f %.4f %.4f %.4f %.4f %.4f\n", key.time, key.eye.x, key.eye.y, key.eye.z, key.center.x, key.center.y, key.center.z);
+	}
+	fclose(file);
+	return true;
+}
+
+//benchmark *******************************
+
+struct sBenchFrame {
+	float cpu_ms; //from the start of the frame till the last GL call is sent
+	float gpu_ms; //-1 without timer queries
+	long draw_calls;
+	long triangles;
+};
+
+struct sThreshold {
+	std::string metric;
+	std::string stat;
+	double limit;
+};
+
+struct sBenchConfig {
+	int width;
+	int height;
+	int frames;
+	int warmup;
+	float fps; //simulated, the time of the path advances 1/fps every frame whatever the real frame time
+	std::string output;
+	CameraPath path;
+	std::vector<sThreshold> thresholds;
+};
+
+static const char* bench_metrics[] = { "cpu_ms", "gpu_ms", "draw_calls", "triangles" };
+static const char* bench_stats[] = { "mean", "p50", "p95", "p99", "max" };
+static const int NUM_METRICS = 4;
+static const int NUM_STATS = 5;
+
+static int findName(const char** names, int num, const std::string& name)
+{
+	for (int i = 0; i < num; ++i)
+		if (name == names[i])
+			return i;
+	return -1;
+}
+
+static Material* createBenchMaterial(const std::string& texture)
+{
+	StandardMaterial* mat = new StandardMaterial();
+	if (texture != "-")
+	{
+		mat->texture = Texture::Get(texture.c_str());
+		mat->shader = Shader::Get("data/shaders/basic.vs", "data/shaders/texture.fs");
+	}
+	else
+		mat->shader = Shader::Get("data/shaders/basic.vs", "data/shaders/flat.fs");
+	return mat;
+}
+
+static SceneNode* createBenchNode(const std::string& mesh, Material* material, Vector3 position)
+{
+	SceneNode* node = new SceneNode("Bench node");
+	node->mesh = Mesh::Get(mesh.c_str());
+	node->material = material;
+	node->model.setTranslation(position.x, position.y, position.z);
+	node->previous_model = node->model;
+	return node;
+}
+
+//the nodes are created in the application of the bench, it must exist before
+static bool loadBenchFile(const char* filename, sBenchConfig& config)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		std::cout << "[ERROR] bench file not found: " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<SceneNode*>& nodes = Application::instance->node_list;
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line))
+	{
+		line_number++;
+		std::vector<std::string> t = readTokens(line);
+		if (t.empty())
+			continue;
+
+		bool ok = true;
+		if (t[0] == "size" && t.size() == 3)
+		{
+			config.width = atoi(t[1].c_str());
+			config.height = atoi(t[2].c_str());
+			ok = config.width > 0 && config.height > 0;
+		}
+		else if (t[0] == "frames" && t.size() == 2)
+			ok = (config.frames = atoi(t[1].c_str())) > 0;
+		else if (t[0] == "warmup" && t.size() == 2)
+			ok = (config.warmup = atoi(t[1].c_str())) >= 0;
+		else if (t[0] == "fps" && t.size() == 2)
+			ok = (config.fps = (float)atof(t[1].c_str())) > 0;
+		else if (t[0] == "output" && t.size() == 2)
+			config.output = t[1];
+		else if (t[0] == "node" && t.size() == 6) //node mesh texture x y z
+			nodes.push_back(createBenchNode(t[1], createBenchMaterial(t[2]), Vector3((float)atof(t[3].c_str()), (float)atof(t[4].c_str()), (float)atof(t[5].c_str()))));
+		else if (t[0] == "grid" && t.size() == 6) //grid mesh texture columns rows spacing, centered, sharing the material
+		{
+			int columns = atoi(t[3].c_str());
+			int rows = atoi(t[4].c_str());
+			float spacing = (float)atof(t[5].c_str());
+			Material* material = createBenchMaterial(t[2]);
+			for (int y = 0; y < rows; ++y)
+				for (int x = 0; x < columns; ++x)
+					nodes.push_back(createBenchNode(t[1], material, Vector3((x - (columns - 1) * 0.5f) * spacing, 0.0f, (y - (rows - 1) * 0.5f) * spacing)));
+		}
+		else if (t[0] == "path" && t.size() == 2)
+			ok = config.path.load(t[1].c_str());
+		else if (t[0] == "key")
+			ok = config.path.parseKey(t);
+		else if (t[0] == "threshold" && t.size() == 4) //threshold metric stat limit
+		{
+			sThreshold threshold;
+			threshold.metric = t[1];
+			threshold.stat = t[2];
+			threshold.limit = atof(t[3].c_str());
+			ok = findName(bench_metrics, NUM_METRICS, t[1]) != -1 && findName(bench_stats, NUM_STATS, t[2]) != -1;
+			config.thresholds.push_back(threshold);
+		}
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			std::cout << "[ERROR] " << filename << ":" << line_number << " wrong line: " << line << std::endl;
+			return false;
+		}
+	}
+
+	if (config.path.keys.empty())
+	{
+		std::cout << "[ERROR] " << filename << " has no camera path" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//context *******************************
+
+#ifdef USE_EGL
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+
+//without window nor display, Mesa can do it even in the servers without GPU (llvmpipe)
+static bool createBenchContext(int width, int height)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		egl_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (egl_display == EGL_NO_DISPLAY)
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major = 0, minor = 0;
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor))
+	{
+		std::cout << "[ERROR] EGL display not available" << std::endl;
+		return false;
+	}
+
+	//the framework uses the compatibility profile (matrix stack, glPushAttrib)
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		std::cout << "[ERROR] EGL without desktop OpenGL" << std::endl;
+		return false;
+	}
+
+	//the config is not used to render, it renders in an FBO, some surfaceless displays have none
+	EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &num_configs) || num_configs == 0)
+		config = EGL_NO_CONFIG_KHR;
+
+	EGLint context_attribs[] = {
+#ifdef _DEBUG
+		EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+		EGL_NONE };
+	egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	if (egl_context == EGL_NO_CONTEXT || !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+	{
+		std::cout << "[ERROR] EGL context could not be created: " << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	std::cout << " * EGL " << major << "." << minor << " surfaceless context" << std::endl;
+	return true;
+}
+
+static void destroyBenchContext()
+{
+	if (egl_display == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (egl_context != EGL_NO_CONTEXT)
+		eglDestroyContext(egl_display, egl_context);
+	eglTerminate(egl_display);
+}
+#else
+static SDL_Window* bench_window = NULL;
+static SDL_GLContext bench_context = NULL;
+
+//a hidden window, only its context is used
+static bool createBenchContext(int width, int height)
+{
+	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+	{
+		std::cout << "[ERROR] SDL video: " << SDL_GetError() << std::endl;
+		return false;
+	}
+	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16);
+#ifdef _DEBUG
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
+	bench_window = SDL_CreateWindow("bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (bench_window)
+		bench_context = SDL_GL_CreateContext(bench_window);
+	if (!bench_context)
+	{
+		std::cout << "[ERROR] context could not be created: " << SDL_GetError() << std::endl;
+		return false;
+	}
+	#ifdef USE_GLEW
+		glewInit();
+	#endif
+	return true;
+}
+
+static void destroyBenchContext()
+{
+	if (bench_context)
+		SDL_GL_DeleteContext(bench_context);
+	if (bench_window)
+		SDL_DestroyWindow(bench_window);
+	SDL_Quit();
+}
+#endif
+
+//results *******************************
+
+//nearest rank, values sorted
+static double percentile(const std::vector<double>& values, double p)
+{
+	int index = (int)ceil(p * 0.01 * values.size()) - 1;
+	return values[std::max(0, std::min(index, (int)values.size() - 1))];
+}
+
+static void computeStats(std::vector<double> values, double* stats)
+{
+	std::sort(values.begin(), values.end());
+	double sum = 0;
+	for (size_t i = 0; i < values.size(); ++i)
+		sum += values[i];
+	stats[0] = sum / values.size();
+	stats[1] = percentile(values, 50);
+	stats[2] = percentile(values, 95);
+	stats[3] = percentile(values, 99);
+	stats[4] = values.back();
+}
+
+static double getMetric(const sBenchFrame& frame, int metric)
+{
+	switch (metric)
+	{
+		case 0: return frame.cpu_ms;
+		case 1: return frame.gpu_ms;
+		case 2: return (double)frame.draw_calls;
+		default: return (double)frame.triangles;
+	}
+}
+
+int runBenchmark(const char* filename)
+{
+	sBenchConfig config;
+	config.width = 1280;
+	config.height = 720;
+	config.frames = 600;
+	config.warmup = 60;
+	config.fps = 60.0f;
+	config.output = "bench_results";
+
+	std::cout << "Benchmark: " << filename << std::endl;
+	Profiler::setThreadName("Main");
+
+	//the scene of the file needs the context, its size is only used by the FBO
+	if (!createBenchContext(config.width, config.height))
+		return 2;
+	GLDebug::init();
+	std::cout << " * GL: " << glGetString(GL_VERSION) << " " << glGetString(GL_RENDERER) << std::endl;
+
+	JobSystem::init();
+	ResourceLoader::async = false; //everything is in memory before the first frame
+
+	//its own timer query measures the frames, the ones of the profiler cannot be nested inside
+	Profiler::enabled = false;
+
+	Application* game = new Application(config.width, config.height, NULL, false);
+	game->render_debug = false;
+
+	if (!loadBenchFile(filename, config))
+	{
+		destroyBenchContext();
+		return 2;
+	}
+	game->onResize(config.width, config.height);
+	for (size_t i = 0; i < game->node_list.size(); ++i)
+		if (game->node_list[i]->material)
+			game->node_list[i]->material->precompileShaders();
+
+	FBO fbo;
+	if (!fbo.create(config.width, config.height))
+	{
+		destroyBenchContext();
+		return 2;
+	}
+
+	//the warmup frames are timed too, the first query with work of some drivers (llvmpipe) is wrong
+	bool gpu_timer = isGLExtensionSupported("GL_ARB_timer_query");
+	int num_frames = config.warmup + config.frames;
+	std::vector<GLuint> queries;
+	if (gpu_timer)
+	{
+		config.warmup = std::max(config.warmup, 1);
+		num_frames = config.warmup + config.frames;
+		queries.resize(num_frames);
+		glGenQueries(num_frames, &queries[0]);
+	}
+	else
+		std::cout << " * No timer queries, the GPU time is not measured" << std::endl;
+
+	std::cout << " * " << game->node_list.size() << " nodes, " << config.path.keys.size() << " camera keys, " << config.width << "x" << config.height << ", " << config.warmup << " + " << config.frames << " frames" << std::endl;
+
+	//the warmup frames stay at the start of the path, the path repeats if it is shorter than the frames
+	std::vector<sBenchFrame> results(config.frames);
+	float duration = config.path.getDuration();
+	for (int i = 0; i < num_frames; ++i)
+	{
+		int measured = i - config.warmup;
+		float time = measured > 0 ? measured / config.fps : 0.0f;
+		if (duration > 0.0f)
+			time = fmod(time, duration);
+
+		uint64_t start = Profiler::getTime();
+
+		ResourceLoader::update();
+		Shader::UpdateCompiles();
+		JobSystem::updateMainThread();
+		ResourceCacheBase::UpdateAll();
+
+		Vector3 eye, center;
+		config.path.sample(time, eye, center);
+		Application::camera->lookAt(eye, center, Vector3(0.f, 1.f, 0.f));
+		game->time = time;
+		game->frame = i;
+
+		fbo.bind();
+		if (gpu_timer)
+			glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+		game->render();
+		if (gpu_timer)
+			glEndQuery(GL_TIME_ELAPSED);
+		fbo.unbind();
+		glFlush(); //what the swap would do, so the driver does not queue all the frames
+
+		if (measured >= 0)
+		{
+			sBenchFrame& result = results[measured];
+			result.cpu_ms = float((Profiler::getTime() - start) * 1e-6);
+			result.gpu_ms = -1.0f;
+			result.draw_calls = Mesh::num_meshes_rendered;
+			result.triangles = Mesh::num_triangles_rendered;
+		}
+
+		RingBuffer::EndFrameAll();
+		UniformBuffer::endFrame();
+		GLState::endFrame();
+		Mesh::endFrame();
+		Profiler::endFrame();
+	}
+
+	//all at the end, reading them during the frames would stall
+	glFinish();
+	if (gpu_timer)
+	{
+		for (int i = 0; i < config.frames; ++i)
+		{
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(queries[config.warmup + i], GL_QUERY_RESULT, &ns);
+			results[i].gpu_ms = float(ns * 1e-6);
+		}
+		glDeleteQueries(num_frames, &queries[0]);
+	}
+
+	//stats
+	double stats[NUM_METRICS][NUM_STATS];
+	for (int m = 0; m < NUM_METRICS; ++m)
+	{
+		std::vector<double> values(config.frames);
+		for (int i = 0; i < config.frames; ++i)
+			values[i] = getMetric(results[i], m);
+		computeStats(values, stats[m]);
+	}
+
+	std::string csv_filename = config.output + ".csv";
+	FILE* csv = fopen(csv_filename.c_str(), "w");
+	if (!csv)
+	{
+		std::cout << "[ERROR] cannot write " << csv_filename << std::endl;
+		destroyBenchContext();
+		return 2;
+	}
+	fprintf(csv, "frame,cpu_ms,gpu_ms,draw_calls,triangles\n");
+	for (int i = 0; i < config.frames; ++i)
+		fprintf(csv, "%d,%.4f,%.4f,%ld,%ld\n", i, results[i].cpu_ms, results[i].gpu_ms, results[i].draw_calls, results[i].triangles);
+	fclose(csv);
+
+	//the thresholds on the GPU time are skipped if it could not be measured
+	bool passed = true;
+	std::string thresholds_json;
+	std::cout << std::endl;
+	for (size_t i = 0; i < config.thresholds.size(); ++i)
+	{
+		sThreshold& threshold = config.thresholds[i];
+		int m = findName(bench_metrics, NUM_METRICS, threshold.metric);
+		double value = stats[m][findName(bench_stats, NUM_STATS, threshold.stat)];
+		bool skipped = (m == 1 && !gpu_timer);
+		bool ok = skipped || value <= threshold.limit;
+		passed = passed && ok;
+		std::cout << " " << (skipped ? "[SKIP]" : ok ? "[OK]  " : "[FAIL]") << " " << threshold.metric << " " << threshold.stat << ": " << value << " limit " << threshold.limit << std::endl;
+
+		char buffer[256];
+		sprintf(buffer, "%s\t\t{ \"metric\": \"%s\", \"stat\": \"%s\", \"limit\": %g, \"value\": %g, \"passed\": %s }", i ? ",\n" : "", threshold.metric.c_str(), threshold.stat.c_str(), threshold.limit, value, skipped ? "null" : ok ? "true" : "false");
+		thresholds_json += buffer;
+	}
+
+	std::string json_filename = config.output + ".json";
+	FILE* json = fopen(json_filename.c_str(), "w");
+	if (!json)
+	{
+		std::cout << "[ERROR] cannot write " << json_filename << std::endl;
+		destroyBenchContext();
+		return 2;
+	}
+	fprintf(json, "{\n\t\"bench\": \"%s\",\n\t\"renderer\": \"%s\",\n\t\"version\": \"%s\",\n", escapeJSON(filename).c_str(), escapeJSON((const char*)glGetString(GL_RENDERER)).c_str(), escapeJSON((const char*)glGetString(GL_VERSION)).c_str());
+	fprintf(json, "\t\"width\": %d,\n\t\"height\": %d,\n\t\"frames\": %d,\n\t\"warmup\": %d,\n\t\"gpu_timer\": %s,\n\t\"metrics\": {\n", config.width, config.height, config.frames, config.warmup, gpu_timer ? "true" : "false");
+	for (int m = 0; m < NUM_METRICS; ++m)
+	{
+		fprintf(json, "\t\t\"%s\": {", bench_metrics[m]);
+		for (int s = 0; s < NUM_STATS; ++s)
+			fprintf(json, "%s \"%s\": %.4f", s ? "," : "", bench_stats[s], stats[m][s]);
+		fprintf(json, " }%s\n", m < NUM_METRICS - 1 ? "," : "");
+	}
+	fprintf(json, "\t},\n\t\"thresholds\": [\n%s\n\t],\n\t\"passed\": %s\n}\n", thresholds_json.c_str(), passed ? "true" : "false");
+	fclose(json);
+
+	std::cout << std::endl << " cpu_ms p50: " << stats[0][1] << " p95: " << stats[0][2] << " p99: " << stats[0][3];
+	if (gpu_timer)
+		std::cout << "  gpu_ms p50: " << stats[1][1] << " p95: " << stats[1][2] << " p99: " << stats[1][3];
+	std::cout << std::endl << " Results in " << csv_filename << " and " << json_filename << (passed ? "" : ", THRESHOLDS EXCEEDED") << std::endl;
+
+	ResourceLoader::shutdown();
+	JobSystem::shutdown();
+	destroyBenchContext();
+	return passed ? 0 : 1;
+}
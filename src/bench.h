@@ -0,0 +1,47 @@
+/*  Headless benchmark: main -bench file.bench renders a scene without a window, in an FBO, flying the camera along
+	a path for a fixed number of frames with a fixed timestep, so every run renders the same images. It writes the
+	CPU and GPU time, draws and triangles of every frame to a CSV and their percentiles to a JSON, and returns
+	non zero if any threshold of the file is exceeded, to be used in the CI (make run-bench).
+	Built with USE_EGL (make bench) the context is created with EGL without any display (Mesa surfaceless), if not
+	a hidden SDL window is used. See data/bench/default.bench for the format of the file.
+	The paths can be recorded in the application with F4.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "framework.h"
+#include <vector>
+#include <string>
+
+class Camera;
+
+class CameraPath
+{
+public:
+	struct sKey {
+		float time; //seconds
+		Vector3 eye;
+		Vector3 center;
+	};
+
+	std::vector<sKey> keys;
+	bool recording;
+	float record_start;
+
+	CameraPath();
+
+	float getDuration();
+	void sample(float time, Vector3& eye, Vector3& center); //linear between the keys, clamped to the first and last
+	void startRecording(float time);
+	void record(Camera* camera, float time); //adds a key if the camera moved since the last one
+
+	//one "key time eye.x eye.y eye.z center.x center.y center.z" per line
+	bool parseKey(const std::vector<std::string>& tokens);
+	bool load(const char* filename);
+	bool save(const char* filename);
+};
+
+int runBenchmark(const char* filename); //0 passed, 1 a threshold was exceeded, 2 it could not run
+
+#endif
@@ -4,6 +4,7 @@
 #include "camera.h"
 #include "mesh.h"
 #include "texture.h"
+#include "glstate.h"
 
 #include "game.h"
 #include "world.h"
@@ -100,10 +101,10 @@ void Character::render(Camera* camera)
 
 	if (0)
 	{
-		glDisable(GL_DEPTH_TEST);
+		GLState::disable(GL_DEPTH_TEST);
 		glLineWidth(3);
 		sk.renderSkeleton(camera, m);
-		glEnable(GL_DEPTH_TEST);
+		GLState::enable(GL_DEPTH_TEST);
 	}
 }
 
@@ -230,6 +230,11 @@ inline Matrix3D operator*(const Matrix3D& m1, const Matrix3D& m2)
     m1._41*m2._14 + m1._42*m2._24 + m1._43*m2._34 + m1._44*m2._44);
 }
 
+//the friend declarations are not visible outside the class in standard C++
+inline Matrix3D PitchMatrix3D(const float theta);
+inline Matrix3D YawMatrix3D(const float theta);
+inline Matrix3D RollMatrix3D(const float theta);
+
 inline void
 Matrix3D::rotate(const Vector3D& v)
 {
@@ -1,12 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <cstring>
 #include <cassert>
 #include <algorithm>
 
 #include "hdre.h"
 
-std::map<std::string, HDRE*> HDRE::sHDRELoaded;
+ResourceCache<HDRE> HDRE::sHDRELoaded("HDREs", 512 * 1024 * 1024);
 
 HDRE::HDRE()
 {
@@ -51,9 +52,9 @@ HDRE* HDRE::Get(const char* filename)
 {
 	assert(filename);
 
-	auto it = sHDRELoaded.find(filename);
-	if (it != sHDRELoaded.end())
-		return it->second;
+	HDRE* cached = sHDRELoaded.find(filename);
+	if (cached)
+		return cached;
 
 	HDRE* hdre = new HDRE();
 	if (!hdre->load(filename))
@@ -62,9 +63,22 @@ HDRE* HDRE::Get(const char* filename)
 		return NULL;
 	}
 
+	hdre->setName(filename);
 	return hdre;
 }
 
+size_t HDRE::getCPUBytes()
+{
+	size_t num_floats = 0;
+	int w = width;
+	for (int i = 0; i < N_LEVELS; i++)
+	{
+		num_floats += w * w * N_FACES * numChannels;
+		w = (int)(width / pow(2.0, i + 1));
+	}
+	return sizeof(HDRE) + num_floats * sizeof(float) * 3;
+}
+
 void flipYsides(float ** data, unsigned int size, short num_channels)
 {
 	// std::cout << "Flipping Y sides" << std::endl;
@@ -118,10 +132,9 @@ void flipY(float** data, unsigned int size, short num_channels, bool flip_sides)
 
 bool HDRE::load(const char* filename)
 {
-	FILE *f;
 	assert(filename);
 
-	fopen_s(&f, filename, "rb");
+	FILE* f = fopen(filename, "rb");
 	if (f == NULL)
 		return false;
 
@@ -4,6 +4,7 @@
 #include <map>
 #include <string>
 #include <cassert>
+#include "../resourcecache.h"
 
 #define N_LEVELS 6
 #define N_FACES 6
@@ -71,12 +72,15 @@ public:
 	~HDRE();
 
 	// class manager
-	static std::map<std::string, HDRE*> sHDRELoaded;
+	static ResourceCache<HDRE> sHDRELoaded;
 
 	bool load(const char* filename);
 
 	static HDRE* Get(const char* filename);
-	void setName(const char* name) { sHDRELoaded[name] = this; }
+	void setName(const char* name) { sHDRELoaded.add(name, this); }
+
+	size_t getCPUBytes(); //the pixels are stored three times (data, faces_array and pixels)
+	size_t getVRAMBytes() { return 0; } //the textures are created from it apart
 
 	// useful methods
 	float getMaxLuminance() { return this->header.maxLuminance; };
@@ -0,0 +1,771 @@
+#include "meshopt.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+//triangles that use every vertex, stored as offsets in a single array
+struct sTriangleAdjacency {
+	std::vector<unsigned int> counts;
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> data;
+};
+
+static void buildAdjacency(sTriangleAdjacency& adjacency, const unsigned int* indices, size_t num_indices, size_t num_vertices)
+{
+	size_t num_triangles = num_indices / 3;
+	adjacency.counts.assign(num_vertices, 0);
+	adjacency.offsets.resize(num_vertices);
+	adjacency.data.resize(num_indices);
+
+	for (size_t i = 0; i < num_indices; ++i)
+		adjacency.counts[indices[i]]++;
+
+	unsigned int offset = 0;
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		adjacency.offsets[i] = offset;
+		offset += adjacency.counts[i];
+	}
+
+	//fill using the offsets as cursors and restore them after
+	for (size_t i = 0; i < num_triangles; ++i)
+		for (int k = 0; k < 3; ++k)
+			adjacency.data[adjacency.offsets[indices[i * 3 + k]]++] = (unsigned int)i;
+
+	for (size_t i = 0; i < num_vertices; ++i)
+		adjacency.offsets[i] -= adjacency.counts[i];
+}
+
+//returns true if the vertex was not in the cache
+static inline bool updateCache(unsigned int v, std::vector<unsigned int>& timestamps, unsigned int& timestamp, int cache_size)
+{
+	if (timestamp - timestamps[v] > (unsigned int)cache_size)
+	{
+		timestamps[v] = timestamp++;
+		return true;
+	}
+	return false;
+}
+
+sVertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t num_indices, size_t num_vertices, int cache_size)
+{
+	sVertexCacheStats stats;
+	stats.acmr = stats.atvr = 0.0f;
+	if (!num_indices || !num_vertices)
+		return stats;
+
+	std::vector<unsigned int> timestamps(num_vertices, 0);
+	unsigned int timestamp = cache_size + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < num_indices; ++i)
+		misses += updateCache(indices[i], timestamps, timestamp, cache_size);
+
+	stats.acmr = misses / float(num_indices / 3);
+	stats.atvr = misses / float(num_vertices);
+	return stats;
+}
+
+void optimizeVertexCache(unsigned int* indices, size_t num_indices, size_t num_vertices, int cache_size)
+{
+	assert(num_indices % 3 == 0);
+	size_t num_triangles = num_indices / 3;
+	if (!num_triangles)
+		return;
+
+	sTriangleAdjacency adjacency;
+	buildAdjacency(adjacency, indices, num_indices, num_vertices);
+
+	std::vector<unsigned int> live = adjacency.counts; //triangles not emitted per vertex
+	std::vector<unsigned int> timestamps(num_vertices, 0);
+	std::vector<char> emitted(num_triangles, 0);
+	std::vector<unsigned int> dead_end; //recently used vertices, to continue when the fan is over
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result(num_indices);
+
+	unsigned int timestamp = cache_size + 1;
+	unsigned int input_cursor = 1;
+	size_t output_triangle = 0;
+	int current = 0;
+
+	while (current >= 0)
+	{
+		candidates.clear();
+
+		//emit the fan of triangles around the current vertex
+		const unsigned int* neighbours = &adjacency.data[0] + adjacency.offsets[current];
+		for (unsigned int i = 0; i < adjacency.counts[current]; ++i)
+		{
+			unsigned int t = neighbours[i];
+			if (emitted[t])
+				continue;
+
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = indices[t * 3 + k];
+				result[output_triangle * 3 + k] = v;
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				updateCache(v, timestamps, timestamp, cache_size);
+			}
+			emitted[t] = 1;
+			output_triangle++;
+		}
+
+		//next fanning vertex: the one that will stay longer in the cache after its fan
+		int best = -1;
+		int best_priority = -1;
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			unsigned int v = candidates[i];
+			if (!live[v])
+				continue;
+			int priority = 0;
+			if (timestamp - timestamps[v] + 2 * live[v] <= (unsigned int)cache_size)
+				priority = timestamp - timestamps[v];
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				best = v;
+			}
+		}
+
+		//dead end, continue with a recent vertex or the next one with triangles left
+		if (best == -1)
+		{
+			while (!dead_end.empty() && best == -1)
+			{
+				unsigned int v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v])
+					best = v;
+			}
+			while (best == -1 && input_cursor < num_vertices)
+			{
+				if (live[input_cursor])
+					best = input_cursor;
+				input_cursor++;
+			}
+		}
+
+		current = best;
+	}
+
+	assert(output_triangle == num_triangles);
+	std::copy(result.begin(), result.end(), indices);
+}
+
+//a group of consecutive triangles that can be moved without hurting the vertex cache
+struct sOverdrawCluster {
+	unsigned int start;
+	unsigned int end;
+	float sort_key;
+};
+
+void optimizeOverdraw(unsigned int* indices, size_t num_indices, const Vector3* positions, size_t num_vertices, float threshold, int cache_size)
+{
+	size_t num_triangles = num_indices / 3;
+	if (!num_triangles)
+		return;
+
+	std::vector<unsigned int> timestamps(num_vertices, 0);
+	unsigned int timestamp = cache_size + 1;
+
+	//hard clusters start where no vertex is in the cache, moving them costs nothing
+	std::vector<unsigned int> clusters;
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; ++k)
+			misses += updateCache(indices[i * 3 + k], timestamps, timestamp, cache_size);
+		if (i == 0 || misses == 3)
+			clusters.push_back(i);
+	}
+
+	//split them in soft ones where the ACMR is already good enough
+	std::vector<sOverdrawCluster> soft;
+
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		unsigned int start = clusters[c];
+		unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : (unsigned int)num_triangles;
+
+		size_t misses = 0;
+		timestamp += cache_size + 1;
+		for (unsigned int i = start * 3; i < end * 3; ++i)
+			misses += updateCache(indices[i], timestamps, timestamp, cache_size);
+		float cluster_threshold = threshold * misses / float(end - start);
+
+		sOverdrawCluster cluster = { start, end, 0.0f };
+		size_t running_misses = 0;
+		size_t running_triangles = 0;
+		timestamp += cache_size + 1;
+		for (unsigned int i = start; i < end; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+				running_misses += updateCache(indices[i * 3 + k], timestamps, timestamp, cache_size);
+			running_triangles++;
+
+			if (i + 1 < end && running_misses / float(running_triangles) <= cluster_threshold)
+			{
+				cluster.end = i + 1;
+				soft.push_back(cluster);
+				cluster.start = i + 1;
+				running_misses = running_triangles = 0;
+				timestamp += cache_size + 1;
+			}
+		}
+		cluster.end = end;
+		soft.push_back(cluster);
+	}
+
+	//area weighted centroid of the whole mesh
+	Vector3 mesh_centroid;
+	float mesh_area = 0.0f;
+	for (size_t i = 0; i < num_triangles; ++i)
+	{
+		const Vector3& a = positions[indices[i * 3]];
+		const Vector3& b = positions[indices[i * 3 + 1]];
+		const Vector3& c = positions[indices[i * 3 + 2]];
+		float area = (b - a).cross(c - a).length();
+		mesh_centroid = mesh_centroid + (a + b + c) * (area / 3.0f);
+		mesh_area += area;
+	}
+	if (mesh_area > 0.0f)
+		mesh_centroid = mesh_centroid * (1.0f / mesh_area);
+
+	//clusters facing outwards occlude the others, draw them first
+	for (size_t c = 0; c < soft.size(); ++c)
+	{
+		sOverdrawCluster& cluster = soft[c];
+		Vector3 centroid;
+		Vector3 normal;
+		float area_sum = 0.0f;
+		for (unsigned int i = cluster.start; i < cluster.end; ++i)
+		{
+			const Vector3& a = positions[indices[i * 3]];
+			const Vector3& b = positions[indices[i * 3 + 1]];
+			const Vector3& c = positions[indices[i * 3 + 2]];
+			Vector3 n = (b - a).cross(c - a);
+			float area = n.length();
+			centroid = centroid + (a + b + c) * (area / 3.0f);
+			normal = normal + n;
+			area_sum += area;
+		}
+		if (area_sum > 0.0f)
+			centroid = centroid * (1.0f / area_sum);
+		float normal_length = normal.length();
+		cluster.sort_key = normal_length > 0.0f ? (centroid - mesh_centroid).dot(normal) / normal_length : 0.0f;
+	}
+
+	std::stable_sort(soft.begin(), soft.end(), [](const sOverdrawCluster& a, const sOverdrawCluster& b) { return a.sort_key > b.sort_key; });
+
+	std::vector<unsigned int> result;
+	result.reserve(num_indices);
+	for (size_t c = 0; c < soft.size(); ++c)
+		result.insert(result.end(), indices + soft[c].start * 3, indices + soft[c].end * 3);
+	std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeVertexFetch(unsigned int* indices, size_t num_indices, size_t num_vertices, std::vector<unsigned int>& new_to_old)
+{
+	std::vector<unsigned int> old_to_new(num_vertices, (unsigned int)-1);
+	new_to_old.clear();
+	new_to_old.reserve(num_vertices);
+
+	for (size_t i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (old_to_new[v] == (unsigned int)-1)
+		{
+			old_to_new[v] = (unsigned int)new_to_old.size();
+			new_to_old.push_back(v);
+		}
+		indices[i] = old_to_new[v];
+	}
+}
+
+//remap gets for every vertex the first one with the same position
+static void remapPositions(const Vector3* positions, size_t num_vertices, std::vector<unsigned int>& remap)
+{
+	size_t table_size = 1;
+	while (table_size < num_vertices * 2)
+		table_size <<= 1;
+	std::vector<int> table(table_size, -1);
+	remap.resize(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		unsigned int hash = 2166136261u;
+		const unsigned char* bytes = (const unsigned char*)&positions[i];
+		for (size_t k = 0; k < sizeof(float) * 3; ++k)
+			hash = (hash ^ bytes[k]) * 16777619u;
+		size_t slot = hash & (table_size - 1);
+		while (table[slot] != -1 && memcmp(&positions[table[slot]], &positions[i], sizeof(float) * 3) != 0)
+			slot = (slot + 1) & (table_size - 1);
+		if (table[slot] == -1)
+			table[slot] = i;
+		remap[i] = table[slot];
+	}
+}
+
+static void computeClusterBounds(sMeshCluster& cluster, const unsigned int* indices, const Vector3* positions, const std::vector<Vector3>& normals)
+{
+	unsigned int start = cluster.start;
+	unsigned int end = cluster.start + cluster.count;
+
+	//sphere around the center of the AABB of the vertices
+	Vector3 min = positions[indices[start * 3]];
+	Vector3 max = min;
+	for (unsigned int i = start * 3; i < end * 3; ++i)
+	{
+		min.setMin(positions[indices[i]]);
+		max.setMax(positions[indices[i]]);
+	}
+	cluster.center = (min + max) * 0.5f;
+	float radius2 = 0.0f;
+	for (unsigned int i = start * 3; i < end * 3; ++i)
+	{
+		Vector3 d = positions[indices[i]] - cluster.center;
+		radius2 = std::max(radius2, d.dot(d));
+	}
+	cluster.radius = sqrt(radius2);
+
+	//normal cone, degenerated triangles do not count
+	Vector3 axis;
+	for (unsigned int i = start; i < end; ++i)
+		axis = axis + normals[i];
+	float axis_length = axis.length();
+	cluster.cone_axis = axis_length > 0.0f ? axis * (1.0f / axis_length) : Vector3(0, 0, 1);
+	cluster.cone_cutoff = 1.0f;
+	if (axis_length == 0.0f)
+		return;
+
+	float min_dot = 1.0f;
+	for (unsigned int i = start; i < end; ++i)
+	{
+		float length = normals[i].length();
+		if (length > 0.0f)
+			min_dot = std::min(min_dot, normals[i].dot(cluster.cone_axis) / length);
+	}
+	if (min_dot > 0.0f) //the half angle is below 90 degrees
+		cluster.cone_cutoff = sqrt(1.0f - min_dot * min_dot);
+}
+
+void buildClusters(unsigned int* indices, size_t num_indices, const Vector3* positions, size_t num_vertices, std::vector<sMeshCluster>& clusters, unsigned int max_triangles)
+{
+	assert(max_triangles > 0);
+	size_t num_triangles = num_indices / 3;
+	if (!num_triangles)
+		return;
+
+	//vertices split by uv or normal seams are still connected, adjacency uses the first vertex with the same position
+	std::vector<unsigned int> remap;
+	remapPositions(positions, num_vertices, remap);
+	std::vector<unsigned int> position_indices(num_indices);
+	for (size_t i = 0; i < num_indices; ++i)
+		position_indices[i] = remap[indices[i]];
+
+	sTriangleAdjacency adjacency;
+	buildAdjacency(adjacency, &position_indices[0], num_indices, num_vertices);
+
+	//area weighted normals
+	std::vector<Vector3> normals(num_triangles);
+	for (size_t i = 0; i < num_triangles; ++i)
+	{
+		const Vector3& a = positions[indices[i * 3]];
+		const Vector3& b = positions[indices[i * 3 + 1]];
+		const Vector3& c = positions[indices[i * 3 + 2]];
+		normals[i] = (b - a).cross(c - a);
+	}
+
+	std::vector<char> assigned(num_triangles, 0);
+	std::vector<unsigned int> vertex_cluster(num_vertices, (unsigned int)-1); //last cluster that used the vertex
+	std::vector<unsigned int> triangles; //of the current cluster
+	std::vector<unsigned int> candidates; //unassigned triangles that share a vertex with the cluster
+	std::vector<unsigned int> result;
+	std::vector<unsigned int> order; //old triangle of every new one
+	result.reserve(num_indices);
+	order.reserve(num_triangles);
+	size_t input_cursor = 0;
+
+	while (true)
+	{
+		while (input_cursor < num_triangles && assigned[input_cursor])
+			input_cursor++;
+		if (input_cursor == num_triangles)
+			break;
+
+		unsigned int id = (unsigned int)clusters.size();
+		triangles.clear();
+		candidates.clear();
+		Vector3 cluster_normal;
+		unsigned int next = (unsigned int)input_cursor;
+
+		while (true)
+		{
+			assigned[next] = 1;
+			triangles.push_back(next);
+			cluster_normal = cluster_normal + normals[next];
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = position_indices[next * 3 + k];
+				if (vertex_cluster[v] == id)
+					continue;
+				vertex_cluster[v] = id;
+				const unsigned int* neighbours = &adjacency.data[0] + adjacency.offsets[v];
+				for (unsigned int i = 0; i < adjacency.counts[v]; ++i)
+					if (!assigned[neighbours[i]])
+						candidates.push_back(neighbours[i]);
+			}
+			if (triangles.size() == max_triangles)
+				break;
+
+			//grow with the triangle that shares more vertices and faces the same way, keeps the patches compact and the cones narrow
+			float normal_length = cluster_normal.length();
+			Vector3 axis = normal_length > 0.0f ? cluster_normal * (1.0f / normal_length) : Vector3();
+			float best_score = -1e10f;
+			int best = -1;
+			for (size_t i = 0; i < candidates.size(); ++i)
+			{
+				unsigned int t = candidates[i];
+				if (assigned[t])
+				{
+					candidates[i--] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+				int shared = 0;
+				for (int k = 0; k < 3; ++k)
+					shared += vertex_cluster[position_indices[t * 3 + k]] == id;
+				float length = normals[t].length();
+				float score = shared + (length > 0.0f ? normals[t].dot(axis) / length : 0.0f);
+				if (score > best_score)
+				{
+					best_score = score;
+					best = (int)i;
+				}
+			}
+
+			//disconnected, the cluster ends here
+			if (best == -1)
+				break;
+			next = candidates[best];
+			candidates[best] = candidates.back();
+			candidates.pop_back();
+		}
+
+		//same relative order than before to keep the cache behaviour
+		std::sort(triangles.begin(), triangles.end());
+
+		sMeshCluster cluster;
+		cluster.start = (unsigned int)(result.size() / 3);
+		cluster.count = (unsigned int)triangles.size();
+		for (size_t i = 0; i < triangles.size(); ++i)
+			result.insert(result.end(), indices + triangles[i] * 3, indices + triangles[i] * 3 + 3);
+		order.insert(order.end(), triangles.begin(), triangles.end());
+		clusters.push_back(cluster);
+	}
+
+	assert(result.size() == num_indices);
+	std::copy(result.begin(), result.end(), indices);
+
+	//bounds with the final order
+	std::vector<Vector3> sorted_normals(num_triangles);
+	for (size_t i = 0; i < num_triangles; ++i)
+		sorted_normals[i] = normals[order[i]];
+	for (size_t i = 0; i < clusters.size(); ++i)
+		computeClusterBounds(clusters[i], indices, positions, sorted_normals);
+}
+
+bool isClusterBackfacing(const sMeshCluster& cluster, const Vector3& eye)
+{
+	//if the view direction is inside the cone rotated 90 degrees no triangle can be front facing
+	Vector3 v = cluster.center - eye;
+	return v.dot(cluster.cone_axis) >= cluster.cone_cutoff * v.length() + cluster.radius;
+}
+
+//sum of squared distances to a set of planes, weighted by the area of the triangles
+struct sQuadric {
+	double a2, b2, c2, d2, ab, ac, ad, bc, bd, cd;
+	double weight;
+};
+
+static void addTriangleQuadric(sQuadric& q, const Vector3& p0, const Vector3& p1, const Vector3& p2)
+{
+	Vector3 n = (p1 - p0).cross(p2 - p0);
+	double area = n.length();
+	if (area == 0.0)
+		return;
+	double a = n.x / area, b = n.y / area, c = n.z / area;
+	double d = -(a * p0.x + b * p0.y + c * p0.z);
+	q.a2 += area * a * a; q.b2 += area * b * b; q.c2 += area * c * c; q.d2 += area * d * d;
+	q.ab += area * a * b; q.ac += area * a * c; q.ad += area * a * d;
+	q.bc += area * b * c; q.bd += area * b * d; q.cd += area * c * d;
+	q.weight += area;
+}
+
+static void addQuadric(sQuadric& q, const sQuadric& other)
+{
+	q.a2 += other.a2; q.b2 += other.b2; q.c2 += other.c2; q.d2 += other.d2;
+	q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+	q.bc += other.bc; q.bd += other.bd; q.cd += other.cd;
+	q.weight += other.weight;
+}
+
+//mean squared distance from v to the planes
+static double evaluateQuadric(const sQuadric& q, const Vector3& v)
+{
+	double x = v.x, y = v.y, z = v.z;
+	double error = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + q.d2
+		+ 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z + q.ad * x + q.bd * y + q.cd * z);
+	return q.weight > 0.0 ? fabs(error) / q.weight : 0.0;
+}
+
+//moving vertex "from" onto "to" (positions)
+struct sCollapse {
+	unsigned int from;
+	unsigned int to;
+	double error;
+};
+
+//plane through the edge perpendicular to the triangle, keeps the open borders in place
+static void addBorderQuadric(sQuadric& q, const Vector3& p0, const Vector3& p1, const Vector3& p2)
+{
+	Vector3 edge = p1 - p0;
+	Vector3 n = edge.cross((p1 - p0).cross(p2 - p0));
+	double length = n.length();
+	if (length == 0.0)
+		return;
+	double weight = edge.dot(edge) * 2.0;
+	double a = n.x / length, b = n.y / length, c = n.z / length;
+	double d = -(a * p0.x + b * p0.y + c * p0.z);
+	q.a2 += weight * a * a; q.b2 += weight * b * b; q.c2 += weight * c * c; q.d2 += weight * d * d;
+	q.ab += weight * a * b; q.ac += weight * a * c; q.ad += weight * a * d;
+	q.bc += weight * b * c; q.bd += weight * b * d; q.cd += weight * c * d;
+	q.weight += weight;
+}
+
+static inline unsigned long long edgeKey(unsigned long long a, unsigned long long b)
+{
+	return a < b ? (a << 32) | b : (b << 32) | a;
+}
+
+size_t simplifyMesh(unsigned int* destination, const unsigned int* indices, size_t num_indices, const Vector3* positions, size_t num_vertices, size_t target_num_indices, bool lock_borders, float* result_error)
+{
+	assert(num_indices % 3 == 0);
+	std::vector<unsigned int> result(indices, indices + num_indices);
+	double max_error = 0.0;
+
+	//collapses are done in positions space, every vertex with the same position (a wedge) follows
+	std::vector<unsigned int> remap;
+	remapPositions(positions, num_vertices, remap);
+
+	std::vector<sQuadric> quadrics(num_vertices);
+	memset(&quadrics[0], 0, sizeof(sQuadric) * num_vertices);
+	for (size_t i = 0; i < num_indices; i += 3)
+		for (int k = 0; k < 3; ++k)
+			addTriangleQuadric(quadrics[remap[indices[i + k]]], positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+
+	//vertices in open borders can only slide along them (or never move with lock_borders), the ones in non manifold edges never move
+	std::vector<char> locked(num_vertices, 0);
+	std::vector<char> border(num_vertices, 0);
+	std::vector<unsigned long long> border_edges;
+	{
+		std::vector<unsigned long long> edges;
+		edges.reserve(num_indices);
+		for (size_t i = 0; i < num_indices; i += 3)
+			for (int k = 0; k < 3; ++k)
+				edges.push_back(edgeKey(remap[indices[i + k]], remap[indices[i + (k + 1) % 3]]));
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			unsigned int a = (unsigned int)(edges[i] >> 32), b = (unsigned int)(edges[i] & 0xFFFFFFFF);
+			if (j - i == 1)
+			{
+				border[a] = border[b] = 1;
+				border_edges.push_back(edges[i]);
+				if (lock_borders)
+					locked[a] = locked[b] = 1;
+			}
+			else if (j - i > 2)
+				locked[a] = locked[b] = 1;
+			i = j;
+		}
+	}
+
+	for (size_t i = 0; i < num_indices; i += 3)
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3], c = indices[i + (k + 2) % 3];
+			if (std::binary_search(border_edges.begin(), border_edges.end(), edgeKey(remap[a], remap[b])))
+			{
+				addBorderQuadric(quadrics[remap[a]], positions[a], positions[b], positions[c]);
+				addBorderQuadric(quadrics[remap[b]], positions[a], positions[b], positions[c]);
+			}
+		}
+
+	std::vector<unsigned int> position_indices(num_indices);
+	std::vector<unsigned long long> edges;
+	std::vector<sCollapse> collapses;
+	std::vector<char> collapse_locked(num_vertices);
+	std::vector< std::pair<unsigned int, unsigned int> > wedge_map; //old vertex, new vertex
+	sTriangleAdjacency adjacency;
+
+	while (result.size() > target_num_indices)
+	{
+		size_t count = result.size();
+		for (size_t i = 0; i < count; ++i)
+			position_indices[i] = remap[result[i]];
+		buildAdjacency(adjacency, &position_indices[0], count, num_vertices);
+
+		//every edge once
+		edges.clear();
+		for (size_t i = 0; i < count; i += 3)
+			for (int k = 0; k < 3; ++k)
+				edges.push_back(edgeKey(position_indices[i + k], position_indices[i + (k + 1) % 3]));
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		//cheapest direction of every edge
+		collapses.clear();
+		for (size_t i = 0; i < edges.size(); ++i)
+		{
+			unsigned int a = (unsigned int)(edges[i] >> 32), b = (unsigned int)(edges[i] & 0xFFFFFFFF);
+			bool border_edge = (border[a] || border[b]) && std::binary_search(border_edges.begin(), border_edges.end(), edges[i]);
+			bool can_ab = !locked[a] && (!border[a] || border_edge);
+			bool can_ba = !locked[b] && (!border[b] || border_edge);
+			if (!can_ab && !can_ba)
+				continue;
+			sQuadric q = quadrics[a];
+			addQuadric(q, quadrics[b]);
+			double error_ab = can_ab ? evaluateQuadric(q, positions[b]) : 1e30;
+			double error_ba = can_ba ? evaluateQuadric(q, positions[a]) : 1e30;
+			sCollapse collapse = { a, b, error_ab };
+			if (error_ba < error_ab)
+				collapse = { b, a, error_ba };
+			collapses.push_back(collapse);
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const sCollapse& a, const sCollapse& b) { return a.error < b.error; });
+
+		//an interior collapse removes two triangles
+		size_t goal = (count - target_num_indices) / 6 + 1;
+		size_t done = 0;
+		std::fill(collapse_locked.begin(), collapse_locked.end(), 0);
+
+		for (size_t c = 0; c < collapses.size() && done < goal; ++c)
+		{
+			unsigned int from = collapses[c].from, to = collapses[c].to;
+			if (collapse_locked[from] || collapse_locked[to])
+				continue;
+
+			const unsigned int* neighbours = &adjacency.data[0] + adjacency.offsets[from];
+			unsigned int num_neighbours = adjacency.counts[from];
+
+			//every wedge of "from" must follow the edge to a single wedge of "to"
+			wedge_map.clear();
+			bool valid = true;
+			for (unsigned int i = 0; i < num_neighbours && valid; ++i)
+			{
+				unsigned int* t = &result[neighbours[i] * 3];
+				int slot_from = -1, slot_to = -1;
+				for (int k = 0; k < 3; ++k)
+				{
+					if (remap[t[k]] == from) slot_from = k;
+					if (remap[t[k]] == to) slot_to = k;
+				}
+				if (slot_from == -1 || slot_to == -1)
+					continue;
+				size_t j = 0;
+				while (j < wedge_map.size() && wedge_map[j].first != t[slot_from])
+					j++;
+				if (j == wedge_map.size())
+					wedge_map.push_back(std::make_pair(t[slot_from], t[slot_to]));
+				else if (wedge_map[j].second != t[slot_to])
+					valid = false;
+			}
+
+			//the remaining triangles cannot flip or become degenerate
+			for (unsigned int i = 0; i < num_neighbours && valid; ++i)
+			{
+				unsigned int* t = &result[neighbours[i] * 3];
+				int slot_from = -1;
+				bool has_to = false;
+				for (int k = 0; k < 3; ++k)
+				{
+					if (remap[t[k]] == from) slot_from = k;
+					if (remap[t[k]] == to) has_to = true;
+				}
+				if (slot_from == -1 || has_to)
+					continue;
+
+				size_t j = 0;
+				while (j < wedge_map.size() && wedge_map[j].first != t[slot_from])
+					j++;
+				if (j == wedge_map.size()) //a wedge that does not touch the edge
+				{
+					valid = false;
+					break;
+				}
+
+				const Vector3& p1 = positions[t[(slot_from + 1) % 3]];
+				const Vector3& p2 = positions[t[(slot_from + 2) % 3]];
+				Vector3 before = (p1 - positions[t[slot_from]]).cross(p2 - positions[t[slot_from]]);
+				Vector3 after = (p1 - positions[to]).cross(p2 - positions[to]);
+				if (after.dot(before) <= 0.25f * before.length() * after.length())
+					valid = false;
+			}
+			if (!valid)
+				continue;
+
+			for (unsigned int i = 0; i < num_neighbours; ++i)
+			{
+				unsigned int* t = &result[neighbours[i] * 3];
+				for (int k = 0; k < 3; ++k)
+					if (remap[t[k]] == from)
+						for (size_t j = 0; j < wedge_map.size(); ++j)
+							if (wedge_map[j].first == t[k])
+								t[k] = wedge_map[j].second;
+			}
+
+			addQuadric(quadrics[to], quadrics[from]);
+
+			//the rest of the pass can't touch their one-rings, the quadrics and the flip tests there are stale
+			unsigned int ring[2] = { from, to };
+			for (int r = 0; r < 2; ++r)
+			{
+				const unsigned int* triangles = &adjacency.data[0] + adjacency.offsets[ring[r]];
+				for (unsigned int i = 0; i < adjacency.counts[ring[r]]; ++i)
+					for (int k = 0; k < 3; ++k)
+						collapse_locked[position_indices[triangles[i] * 3 + k]] = 1;
+			}
+			max_error = std::max(max_error, collapses[c].error);
+			done++;
+		}
+
+		if (!done)
+			break;
+
+		//remove the collapsed triangles
+		size_t write = 0;
+		for (size_t i = 0; i < count; i += 3)
+		{
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = result[i];
+			result[write++] = result[i + 1];
+			result[write++] = result[i + 2];
+		}
+		result.resize(write);
+	}
+
+	if (result_error)
+		*result_error = (float)sqrt(max_error);
+	std::copy(result.begin(), result.end(), destination);
+	return result.size();
+}
@@ -0,0 +1,57 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+/*
+	Offline optimizations for indexed triangle lists, used by Mesh::optimize when baking the .mbin files.
+	Triangles are sorted for the post transform cache with Tipsify (Sander et al. 2007), then the clusters it generates
+	are sorted to reduce overdraw without knowing the view, and finally vertices are sorted in first use order.
+*/
+
+#include <vector>
+#include <cstddef>
+#include "../framework.h"
+
+#define MESHOPT_CACHE_SIZE 16 //FIFO size used to optimize and to measure
+#define MESHOPT_CLUSTER_TRIANGLES 64 //max triangles per cluster
+
+struct sVertexCacheStats {
+	float acmr; //average cache miss ratio: transformed vertices per triangle (3 is the worst, ~0.5 the best)
+	float atvr; //average transformed vertex ratio: transformed vertices per vertex (1 is the best)
+};
+
+//a range of triangles that can be culled on its own
+struct sMeshCluster {
+	unsigned int start; //first triangle
+	unsigned int count; //number of triangles
+	Vector3 center; //bounding sphere
+	float radius;
+	Vector3 cone_axis; //average normal
+	float cone_cutoff; //sin of the normal cone half angle, 1 if the cone is too wide to cull
+};
+
+//simulates a FIFO post transform cache
+sVertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t num_indices, size_t num_vertices, int cache_size = MESHOPT_CACHE_SIZE);
+
+//reorders the triangles to reuse the transformed vertices
+void optimizeVertexCache(unsigned int* indices, size_t num_indices, size_t num_vertices, int cache_size = MESHOPT_CACHE_SIZE);
+
+//call after optimizeVertexCache: splits the triangles in clusters (where the cache restarts or the ACMR is below threshold * cluster ACMR) and sorts them so the ones facing outwards are drawn first
+void optimizeOverdraw(unsigned int* indices, size_t num_indices, const Vector3* positions, size_t num_vertices, float threshold = 1.05f, int cache_size = MESHOPT_CACHE_SIZE);
+
+//renames the vertices in the order they are used, new_to_old gets the old index of every new vertex (unused ones are removed)
+void optimizeVertexFetch(unsigned int* indices, size_t num_indices, size_t num_vertices, std::vector<unsigned int>& new_to_old);
+
+//groups the triangles in patches of connected and similarly oriented triangles and sorts them so every cluster is consecutive
+//call after optimizeOverdraw, the order inside every cluster is kept. start of the output clusters is relative to indices
+void buildClusters(unsigned int* indices, size_t num_indices, const Vector3* positions, size_t num_vertices, std::vector<sMeshCluster>& clusters, unsigned int max_triangles = MESHOPT_CLUSTER_TRIANGLES);
+
+//true if every triangle of the cluster faces away from eye (both in the same space)
+bool isClusterBackfacing(const sMeshCluster& cluster, const Vector3& eye);
+
+//quadric error metric edge collapse (Garland and Heckbert 1997) that keeps the vertices (collapses move onto existing ones) so the
+//result can share the vertex buffer. Writes the indices to destination (num_indices at most) and returns how many. result_error gets the
+//distance error of the worst collapse in mesh units. Open borders only collapse along themselves, or never with lock_borders (to simplify
+//submeshes one by one without cracks between them)
+size_t simplifyMesh(unsigned int* destination, const unsigned int* indices, size_t num_indices, const Vector3* positions, size_t num_vertices, size_t target_num_indices, bool lock_borders = false, float* result_error = NULL);
+
+#endif
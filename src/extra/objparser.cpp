@@ -0,0 +1,499 @@
+#include "objparser.h"
+#include "../jobsystem.h"
+
+#include <cstdlib>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <chrono>
+#include <string>
+
+#define OBJ_MIN_CHUNK_SIZE (64 * 1024) //smaller chunks are not worth a job
+#define OBJ_MAX_CHUNKS 64
+
+//every chunk is parsed by one job, offsets are filled after the counting pass
+struct sOBJChunk {
+	const char* start;
+	const char* end;
+	int num_positions;
+	int num_normals;
+	int num_uvs;
+	int num_triangles;
+	int first_position;
+	int first_normal;
+	int first_uv;
+	int first_triangle;
+	Vector3 aabb_min;
+	Vector3 aabb_max;
+};
+
+enum { OBJ_LINE_NONE, OBJ_LINE_POSITION, OBJ_LINE_NORMAL, OBJ_LINE_UV, OBJ_LINE_FACE };
+
+static inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+static inline bool isEndLine(char c) { return c == '\n' || c == '\r'; }
+
+static inline const char* skipSpaces(const char* pos, const char* end)
+{
+	while (pos < end && isSpace(*pos)) pos++;
+	return pos;
+}
+
+static inline const char* skipToken(const char* pos, const char* end)
+{
+	while (pos < end && !isSpace(*pos) && !isEndLine(*pos)) pos++;
+	return pos;
+}
+
+static inline const char* endOfLine(const char* pos, const char* end)
+{
+	while (pos < end && !isEndLine(*pos)) pos++;
+	return pos;
+}
+
+//reads the keyword at the beginning of the line and leaves pos after it
+static inline int classifyLine(const char*& pos, const char* end)
+{
+	pos = skipSpaces(pos, end);
+	const char* token_end = skipToken(pos, end);
+	int type = OBJ_LINE_NONE;
+	size_t len = token_end - pos;
+	if (len == 1 && pos[0] == 'v')
+		type = OBJ_LINE_POSITION;
+	else if (len == 1 && pos[0] == 'f')
+		type = OBJ_LINE_FACE;
+	else if (len == 2 && pos[0] == 'v' && pos[1] == 'n')
+		type = OBJ_LINE_NORMAL;
+	else if (len == 2 && pos[0] == 'v' && pos[1] == 't')
+		type = OBJ_LINE_UV;
+	pos = token_end;
+	return type;
+}
+
+static inline int countTokens(const char* pos, const char* end)
+{
+	int num = 0;
+	while (true)
+	{
+		pos = skipSpaces(pos, end);
+		if (pos >= end || isEndLine(*pos))
+			return num;
+		pos = skipToken(pos, end);
+		num++;
+	}
+}
+
+//powers of ten that are exactly representable as double (used by the fast path)
+static const double s_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+const char* parseOBJFloat(const char* pos, const char* end, float& value)
+{
+	const char* token_start = pos;
+	const char* p = pos;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	//mantissa: exact as long as it fits in 53 bits (Clinger fast path)
+	uint64_t mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+	bool any_digit = false;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		any_digit = true;
+		if (num_digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) num_digits++; }
+		else exponent++;
+		p++;
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			any_digit = true;
+			if (num_digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) num_digits++; exponent--; }
+			p++;
+		}
+	}
+	if (any_digit && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool exp_negative = false;
+		if (e < end && (*e == '-' || *e == '+'))
+			exp_negative = *e++ == '-';
+		if (e < end && *e >= '0' && *e <= '9')
+		{
+			int exp_value = 0;
+			while (e < end && *e >= '0' && *e <= '9')
+			{
+				if (exp_value < 10000) exp_value = exp_value * 10 + (*e - '0');
+				e++;
+			}
+			exponent += exp_negative ? -exp_value : exp_value;
+			p = e;
+		}
+	}
+
+	bool fast = any_digit && num_digits < 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22 && (p >= end || isSpace(*p) || isEndLine(*p) || *p == '/');
+	if (fast)
+	{
+		double d = (double)mantissa;
+		d = exponent < 0 ? d / s_pow10[-exponent] : d * s_pow10[exponent];
+		value = (float)(negative ? -d : d);
+		return p;
+	}
+
+	//slow path (long mantissas, big exponents, nan, inf...), copied to the stack so it stays allocation free
+	char buffer[64];
+	const char* token_end = skipToken(token_start, end);
+	size_t len = token_end - token_start;
+	if (len > sizeof(buffer) - 1)
+		len = sizeof(buffer) - 1;
+	memcpy(buffer, token_start, len);
+	buffer[len] = 0;
+	value = (float)atof(buffer);
+	return token_end;
+}
+
+//reads up to max floats in the current line, missing ones are left to zero
+static inline const char* parseFloats(const char* pos, const char* end, float* values, int max)
+{
+	for (int i = 0; i < max; ++i)
+	{
+		values[i] = 0.0f;
+		pos = skipSpaces(pos, end);
+		if (pos >= end || isEndLine(*pos))
+			continue;
+		pos = parseOBJFloat(pos, end, values[i]);
+		pos = skipToken(pos, end); //garbage after the number
+	}
+	return pos;
+}
+
+static inline const char* parseInt(const char* pos, const char* end, int& value)
+{
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+	int v = 0;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+		v = v * 10 + (*pos++ - '0');
+	value = negative ? -v : v;
+	return pos;
+}
+
+//parses a face corner like 1/2/3, 1//3, 1/2 or 1, missing indices are 0
+static inline const char* parseCorner(const char* pos, const char* end, int* index)
+{
+	index[0] = index[1] = index[2] = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (pos < end && *pos != '/')
+			pos = parseInt(pos, end, index[i]);
+		if (pos >= end || *pos != '/')
+			break;
+		pos++;
+	}
+	return skipToken(pos, end);
+}
+
+//OBJ indices start in 1, negative ones are relative to the last element read
+static inline int resolveIndex(int index, int num_read, int total)
+{
+	int i = index > 0 ? index - 1 : num_read + index;
+	return (i >= 0 && i < total) ? i : -1;
+}
+
+static void countChunk(sOBJChunk& chunk)
+{
+	const char* pos = chunk.start;
+	const char* end = chunk.end;
+	chunk.num_positions = chunk.num_normals = chunk.num_uvs = chunk.num_triangles = 0;
+	while (pos < end)
+	{
+		int type = classifyLine(pos, end);
+		if (type == OBJ_LINE_POSITION)
+			chunk.num_positions++;
+		else if (type == OBJ_LINE_NORMAL)
+			chunk.num_normals++;
+		else if (type == OBJ_LINE_UV)
+			chunk.num_uvs++;
+		else if (type == OBJ_LINE_FACE)
+		{
+			int num = countTokens(pos, end);
+			if (num >= 3)
+				chunk.num_triangles += num - 2;
+		}
+		pos = endOfLine(pos, end);
+		while (pos < end && isEndLine(*pos)) pos++;
+	}
+}
+
+static void parseAttributesChunk(sOBJChunk& chunk, Vector3* positions, Vector3* normals, Vector2* uvs)
+{
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	chunk.aabb_min.set(max_float, max_float, max_float);
+	chunk.aabb_max.set(min_float, min_float, min_float);
+
+	positions += chunk.first_position;
+	normals += chunk.first_normal;
+	uvs += chunk.first_uv;
+
+	const char* pos = chunk.start;
+	const char* end = chunk.end;
+	float v[3];
+	while (pos < end)
+	{
+		int type = classifyLine(pos, end);
+		if (type == OBJ_LINE_POSITION)
+		{
+			pos = parseFloats(pos, end, v, 3);
+			Vector3& p = *positions++;
+			p.set(v[0], v[1], v[2]);
+			chunk.aabb_min.setMin(p);
+			chunk.aabb_max.setMax(p);
+		}
+		else if (type == OBJ_LINE_NORMAL)
+		{
+			pos = parseFloats(pos, end, v, 3);
+			(normals++)->set(v[0], v[1], v[2]);
+		}
+		else if (type == OBJ_LINE_UV)
+		{
+			pos = parseFloats(pos, end, v, 2);
+			(uvs++)->set(v[0], v[1]);
+		}
+		pos = endOfLine(pos, end);
+		while (pos < end && isEndLine(*pos)) pos++;
+	}
+}
+
+struct sOBJIndexed {
+	const Vector3* positions;
+	const Vector3* normals;
+	const Vector2* uvs;
+	int num_positions;
+	int num_normals;
+	int num_uvs;
+};
+
+static void parseFacesChunk(sOBJChunk& chunk, const sOBJIndexed& indexed, Vector3* out_vertices, Vector3* out_normals, Vector2* out_uvs)
+{
+	size_t first = (size_t)chunk.first_triangle * 3;
+	out_vertices += first;
+	if (out_normals) out_normals += first;
+	if (out_uvs) out_uvs += first;
+
+	//needed to resolve negative (relative) indices
+	int read_positions = chunk.first_position;
+	int read_normals = chunk.first_normal;
+	int read_uvs = chunk.first_uv;
+
+	const Vector3 zero3;
+	const Vector2 zero2;
+
+	const char* pos = chunk.start;
+	const char* end = chunk.end;
+	int corner[3][3];
+	while (pos < end)
+	{
+		int type = classifyLine(pos, end);
+		if (type == OBJ_LINE_POSITION)
+			read_positions++;
+		else if (type == OBJ_LINE_NORMAL)
+			read_normals++;
+		else if (type == OBJ_LINE_UV)
+			read_uvs++;
+		else if (type == OBJ_LINE_FACE && countTokens(pos, end) >= 3)
+		{
+			//triangle fan: (0, i, i+1)
+			pos = skipSpaces(pos, end);
+			pos = parseCorner(pos, end, corner[0]);
+			pos = skipSpaces(pos, end);
+			pos = parseCorner(pos, end, corner[2]);
+			while (true)
+			{
+				pos = skipSpaces(pos, end);
+				if (pos >= end || isEndLine(*pos))
+					break;
+				memcpy(corner[1], corner[2], sizeof(corner[1]));
+				pos = parseCorner(pos, end, corner[2]);
+
+				for (int k = 0; k < 3; ++k)
+				{
+					int i = resolveIndex(corner[k][0], read_positions, indexed.num_positions);
+					*out_vertices++ = i != -1 ? indexed.positions[i] : zero3;
+					if (out_uvs)
+					{
+						i = resolveIndex(corner[k][1], read_uvs, indexed.num_uvs);
+						*out_uvs++ = i != -1 ? indexed.uvs[i] : zero2;
+					}
+					if (out_normals)
+					{
+						i = resolveIndex(corner[k][2], read_normals, indexed.num_normals);
+						*out_normals++ = i != -1 ? indexed.normals[i] : zero3;
+					}
+				}
+			}
+		}
+		pos = endOfLine(pos, end);
+		while (pos < end && isEndLine(*pos)) pos++;
+	}
+}
+
+//runs func(chunk) for every chunk in the jobs of the framework, one chunk per job
+template<typename F>
+static void runChunks(sOBJChunk* chunks, int num_chunks, F func)
+{
+	JobSystem::parallelFor(num_chunks, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			func(chunks[i]);
+	}, 1);
+}
+
+bool parseOBJ(const char* data, size_t size, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& uvs, Vector3& aabb_min, Vector3& aabb_max, int num_threads, sOBJStats* stats)
+{
+	assert(data);
+
+	if (num_threads <= 0)
+		num_threads = JobSystem::getNumThreads();
+	if (num_threads <= 0)
+		num_threads = 1;
+
+	int num_chunks = (int)(size / OBJ_MIN_CHUNK_SIZE);
+	if (num_chunks > num_threads) num_chunks = num_threads;
+	if (num_chunks > OBJ_MAX_CHUNKS) num_chunks = OBJ_MAX_CHUNKS;
+	if (num_chunks < 1) num_chunks = 1;
+
+	//split in chunks that start at the beginning of a line
+	sOBJChunk chunks[OBJ_MAX_CHUNKS];
+	const char* end = data + size;
+	const char* pos = data;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		const char* chunk_end = (i == num_chunks - 1) ? end : data + (size / num_chunks) * (i + 1);
+		if (chunk_end < pos)
+			chunk_end = pos;
+		chunk_end = endOfLine(chunk_end, end);
+		while (chunk_end < end && isEndLine(*chunk_end)) chunk_end++;
+		chunks[i].start = pos;
+		chunks[i].end = chunk_end;
+		pos = chunk_end;
+	}
+
+	//pass 1: count elements so every chunk knows where to write
+	runChunks(chunks, num_chunks, countChunk);
+
+	int num_positions = 0, num_normals = 0, num_uvs = 0, num_triangles = 0;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		chunk.first_position = num_positions;
+		chunk.first_normal = num_normals;
+		chunk.first_uv = num_uvs;
+		chunk.first_triangle = num_triangles;
+		num_positions += chunk.num_positions;
+		num_normals += chunk.num_normals;
+		num_uvs += chunk.num_uvs;
+		num_triangles += chunk.num_triangles;
+	}
+
+	//pass 2: indexed attributes (faces may reference attributes from any chunk)
+	std::vector<Vector3> indexed_positions(num_positions);
+	std::vector<Vector3> indexed_normals(num_normals);
+	std::vector<Vector2> indexed_uvs(num_uvs);
+	runChunks(chunks, num_chunks, [&](sOBJChunk& chunk) {
+		parseAttributesChunk(chunk, indexed_positions.data(), indexed_normals.data(), indexed_uvs.data());
+	});
+
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	aabb_min.set(max_float, max_float, max_float);
+	aabb_max.set(min_float, min_float, min_float);
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		if (!chunks[i].num_positions)
+			continue;
+		aabb_min.setMin(chunks[i].aabb_min);
+		aabb_max.setMax(chunks[i].aabb_max);
+	}
+
+	//pass 3: expand the faces straight into the final buffers
+	size_t num_vertices = (size_t)num_triangles * 3;
+	vertices.resize(num_vertices);
+	normals.resize(num_normals ? num_vertices : 0);
+	uvs.resize(num_uvs ? num_vertices : 0);
+
+	sOBJIndexed indexed;
+	indexed.positions = indexed_positions.data();
+	indexed.normals = indexed_normals.data();
+	indexed.uvs = indexed_uvs.data();
+	indexed.num_positions = num_positions;
+	indexed.num_normals = num_normals;
+	indexed.num_uvs = num_uvs;
+
+	Vector3* out_vertices = vertices.data();
+	Vector3* out_normals = num_normals ? normals.data() : NULL;
+	Vector2* out_uvs = num_uvs ? uvs.data() : NULL;
+	runChunks(chunks, num_chunks, [&](sOBJChunk& chunk) {
+		parseFacesChunk(chunk, indexed, out_vertices, out_normals, out_uvs);
+	});
+
+	if (stats)
+	{
+		stats->bytes = size;
+		stats->num_threads = num_chunks;
+		stats->num_positions = num_positions;
+		stats->num_normals = num_normals;
+		stats->num_uvs = num_uvs;
+		stats->num_triangles = num_triangles;
+	}
+
+	return true;
+}
+
+void benchmarkOBJ(const char* filename, int iterations)
+{
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		std::cerr << "File not found: " << filename << std::endl;
+		return;
+	}
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	rewind(f);
+	std::string content;
+	content.resize(size);
+	if (size)
+		size = fread(&content[0], 1, size, f);
+	fclose(f);
+
+	if (iterations < 1)
+		iterations = 1;
+
+	std::cout << " + OBJ benchmark: " << filename << " (" << size / (1024.0 * 1024.0) << " MB)" << std::endl;
+
+	int threads[2] = { 1, 0 };
+	for (int t = 0; t < 2; ++t)
+	{
+		std::vector<Vector3> vertices, normals;
+		std::vector<Vector2> uvs;
+		Vector3 aabb_min, aabb_max;
+		sOBJStats stats;
+
+		double best = 1e10;
+		for (int i = 0; i < iterations; ++i)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			parseOBJ(content.data(), size, vertices, normals, uvs, aabb_min, aabb_max, threads[t], &stats);
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			if (seconds < best)
+				best = seconds;
+		}
+
+		std::cout << "\t threads: " << stats.num_threads << " tris: " << stats.num_triangles << " best: " << best * 1000.0 << "ms " << (size / (1024.0 * 1024.0)) / best << " MB/s" << std::endl;
+	}
+}
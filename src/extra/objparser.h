@@ -0,0 +1,32 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+/*
+	Streaming OBJ parser used by Mesh::loadOBJ.
+	The file is split in newline aligned chunks that are parsed in parallel without allocating per line or per token,
+	the result is the same triangle soup (positions, normals and uvs expanded per face) that the old tokenizer produced.
+*/
+
+#include <vector>
+#include <cstddef>
+#include "../framework.h"
+
+struct sOBJStats {
+	size_t bytes;
+	int num_threads;
+	int num_positions;
+	int num_normals;
+	int num_uvs;
+	int num_triangles;
+};
+
+//parses an OBJ file already in memory (data doesnt need to be null terminated), num_threads = 0 uses all the cores
+bool parseOBJ(const char* data, size_t size, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& uvs, Vector3& aabb_min, Vector3& aabb_max, int num_threads = 0, sOBJStats* stats = NULL);
+
+//fast float reader (from_chars style), returns the pointer after the number, result is identical to (float)atof
+const char* parseOBJFloat(const char* pos, const char* end, float& value);
+
+//loads the file several times and prints the throughput in MB/s using one thread and all the cores
+void benchmarkOBJ(const char* filename, int iterations = 5);
+
+#endif
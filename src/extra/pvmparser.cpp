@@ -2,6 +2,7 @@
 #include "pvmparser.h"
 
 #include <sstream>
+#include <cstring>
 
 #define DDS_MAXSTR (256)
 
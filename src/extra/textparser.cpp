@@ -4,6 +4,7 @@
 
 #include <sys/stat.h>
 #include <string>
+#include <cstring>
 #include <algorithm>
 
 #pragma warning(disable: 4996)
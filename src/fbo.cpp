@@ -1,4 +1,5 @@
 #include "fbo.h"
+#include "gldebug.h"
 #include <cassert>
 FBO::FBO()
 {
@@ -37,7 +38,7 @@ FBO::~FBO()
 
 bool FBO::create( int width, int height, int format, int type, int num_textures )
 {
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	assert(width &&& height);
 	assert(num_textures < 5);
 
@@ -78,14 +79,14 @@ bool FBO::create( int width, int height, int format, int type, int num_textures
 		return false;
 	}
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	return true;
 }
 
 bool FBO::createFromTextures(Texture* color_texture, Texture* color_textureB, Texture* depth_texture)
 {
 	assert(color_texture);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	width = (int)color_texture->width;
 	height = (int)color_texture->height;
 	owns_textures = false;
@@ -125,7 +126,7 @@ bool FBO::createFromTextures(Texture* color_texture, Texture* color_textureB, Te
 		return false;
 	}
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	return true;
 }
 
@@ -157,7 +158,7 @@ bool FBO::createDepthOnly(int width, int height)
 
 void FBO::bind()
 {
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	Texture* tex = color_textures[0] ? color_textures[0] : depth_texture;
 	assert(tex && "framebuffer without texture");
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
@@ -166,7 +167,7 @@ void FBO::bind()
 	glDrawBuffers(4, bufs);
 
 	glViewport(0, 0, (int)tex->width, (int)tex->height);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 GLenum one_buffer = GL_BACK;
@@ -177,5 +178,5 @@ void FBO::unbind()
 	glPopAttrib();
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 	//glDrawBuffers(1, &one_buffer);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
\ No newline at end of file
@@ -175,6 +175,11 @@ Vector3 cross(const Vector3& a, const Vector3& b)
 	return Vector3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
 }
 
+Vector3 lerp(const Vector3& a, const Vector3& b, float v)
+{
+	return a*(1.f - v) + b*v;
+}
+
 //*********************************
 const Matrix44 Matrix44::IDENTITY;
 
@@ -221,7 +226,7 @@ void Matrix44::transpose()
 
 Vector3 Matrix44::rotateVector(const Vector3& v) const
 {
-	return (*this * Vector4(v,0.0)).xyz;
+	return (*this * Vector4(v,0.0)).xyz();
 }
 
 void Matrix44::translateGlobal(float x, float y, float z)
@@ -459,6 +464,14 @@ Vector4 operator * (const Matrix44& matrix, const Vector4& v)
 	return Vector4(x, y, z, w);
 }
 
+Matrix44 lerp(const Matrix44& a, const Matrix44& b, float v)
+{
+	Matrix44 result;
+	for (int i = 0; i < 16; ++i)
+		result.m[i] = a.m[i] * (1.f - v) + b.m[i] * v;
+	return result;
+}
+
 void Matrix44::setUpAndOrthonormalize(Vector3 up)
 {
 	up.normalize();
@@ -1206,7 +1219,7 @@ Vector3 normalize(Vector3 n)
 
 int planeBoxOverlap( const Vector4& plane, const Vector3& center, const Vector3& halfsize )
 {
-	Vector3 n = plane.xyz;
+	Vector3 n = plane.xyz();
 	float d = plane.w;
 	float radius = abs(halfsize.x * n[0]) + abs(halfsize.y * n[1]) + abs(halfsize.z * n[2]);
 	float distance = dot(n, center) + d;
@@ -1219,7 +1232,7 @@ int planeBoxOverlap( const Vector4& plane, const Vector3& center, const Vector3&
 
 float signedDistanceToPlane( const Vector4& plane, const Vector3& point )
 {
-	return dot(plane.xyz, point) + plane.w;
+	return dot(plane.xyz(), point) + plane.w;
 }
 
 const Vector3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
@@ -132,7 +132,6 @@ public:
 	{
 		struct { float x,y,z,w; };
 		float v[4];
-		struct { Vector3 xyz; float w; };
 	};
 
 	Vector4() { x = y = z = w = 0.0; }
@@ -140,6 +139,7 @@ public:
 	Vector4(const Vector3& v, float w) { x = v.x; y = v.y; z = v.z; this->w = w; }
 	Vector4(const float* v) { x = v[0]; x = v[1]; x = v[2]; x = v[3]; }
 	void set(float x, float y, float z, float w) { this->x = x; this->y = y; this->z = z; this->w = w; }
+	Vector3 xyz() const { return Vector3(x, y, z); } //a Vector3 can't be in the union outside msvc
 };
 
 inline Vector4 operator * (const Vector4& a, float v) { return Vector4(a.x * v, a.y * v, a.z * v, a.w * v); }
@@ -169,7 +169,7 @@ public:
 	Vector4ub() { x = y = z = 0; }
 	Vector4ub(unsigned char x, unsigned char y, unsigned char z, unsigned char w = 0) { this->x = x; this->y = y; this->z = z; this->w = w; }
 	void set(unsigned char x, unsigned char y, unsigned char z, unsigned char w = 0) { this->x = x; this->y = y; this->z = z; this->w = w; }
-	Vector4ub operator = (const Vector4& a) { x = (unsigned char)a.x; y = (unsigned char)a.y; z = (unsigned char)a.z; w = (unsigned char)a.w; }
+	Vector4ub operator = (const Vector4& a) { x = (unsigned char)a.x; y = (unsigned char)a.y; z = (unsigned char)a.z; w = (unsigned char)a.w; return *this; }
 	Vector4 toVector4() { return Vector4(x, y, z, w); }
 };
 
@@ -260,6 +260,9 @@ class Matrix44
 Vector3 operator * (const Matrix44& matrix, const Vector3& v);
 Vector4 operator * (const Matrix44& matrix, const Vector4& v); 
 
+//per component, like the blending of the skeletons, only right for close matrices (rotations would shrink)
+Matrix44 lerp(const Matrix44& a, const Matrix44& b, float v);
+
 
 class Quaternion
 {
@@ -0,0 +1,95 @@
+#include "gldebug.h"
+#include "utils.h"
+
+#include <iostream>
+#include <cassert>
+
+#ifdef _DEBUG
+	bool GLDebug::enabled = true;
+#else
+	bool GLDebug::enabled = false;
+#endif
+bool GLDebug::synchronous = true;
+bool GLDebug::break_on_error = true;
+bool GLDebug::sync_check = false;
+bool GLDebug::show_notifications = false;
+int GLDebug::num_errors = 0;
+int GLDebug::num_warnings = 0;
+const char* GLDebug::call_site_file = NULL;
+int GLDebug::call_site_line = 0;
+
+static const char* getSourceName(GLenum source)
+{
+	switch (source)
+	{
+		case GL_DEBUG_SOURCE_API: return "API";
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+		case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+		case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+		case GL_DEBUG_SOURCE_APPLICATION: return "application";
+		default: return "other";
+	}
+}
+
+static const char* getTypeName(GLenum type)
+{
+	switch (type)
+	{
+		case GL_DEBUG_TYPE_ERROR: return "ERROR";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "UNDEFINED";
+		case GL_DEBUG_TYPE_PORTABILITY: return "PORTABILITY";
+		case GL_DEBUG_TYPE_PERFORMANCE: return "PERFORMANCE";
+		default: return "INFO";
+	}
+}
+
+static void APIENTRY onDebugMessage(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* user_param)
+{
+	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION && !GLDebug::show_notifications)
+		return;
+
+	bool error = type == GL_DEBUG_TYPE_ERROR;
+	if (error)
+		GLDebug::num_errors++;
+	else
+		GLDebug::num_warnings++;
+
+	std::cout << "[GL " << getTypeName(type) << "] " << message << " (" << getSourceName(source) << " " << id << ")";
+	if (GLDebug::call_site_file)
+		std::cout << " after " << GLDebug::call_site_file << ":" << GLDebug::call_site_line;
+	std::cout << std::endl;
+
+	if (error && GLDebug::break_on_error)
+		assert(!"GL error, see the log");
+}
+
+bool GLDebug::init()
+{
+	if (!enabled)
+		return false;
+	if (!isGLExtensionSupported("GL_KHR_debug"))
+	{
+		std::cout << "[WARN] GL_KHR_debug not supported, the GL errors are only found with GLDebug::sync_check" << std::endl;
+		return false;
+	}
+
+	glEnable(GL_DEBUG_OUTPUT);
+	if (synchronous)
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback((GLDEBUGPROC)onDebugMessage, NULL);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+	std::cout << " * GL debug output enabled" << (synchronous ? " (synchronous)" : "") << std::endl;
+	return true;
+}
+
+void GLDebug::check(const char* file, int line)
+{
+	GLenum error = glGetError();
+	if (error == GL_NO_ERROR)
+		return;
+	num_errors++;
+	std::cout << "[GL ERROR] 0x" << std::hex << error << std::dec << " at " << file << ":" << line << std::endl;
+	if (break_on_error)
+		assert(!"GL error, see the log");
+}
@@ -0,0 +1,49 @@
+/*  Validation of the GL calls in debug builds.
+	With KHR_debug the driver reports the errors (and warnings about performance or deprecated usage) through a
+	callback, so there is no need to call glGetError after every call, which waits for the GPU.
+	GL_CHECK() marks a call site: it only stores the file and line so the messages can tell the last one before
+	the error. With synchronous output the callback runs inside the failing call, so breaking there shows it in
+	the stack. sync_check makes GL_CHECK call glGetError like before, only to bisect an error without KHR_debug.
+	In release builds GL_CHECK does nothing.
+*/
+
+#ifndef GLDEBUG_H
+#define GLDEBUG_H
+
+#include "includes.h"
+
+class GLDebug
+{
+public:
+	static bool enabled; //in debug builds
+	static bool synchronous; //the callback runs in the call that failed, slower but the stack shows it
+	static bool break_on_error; //asserts on errors, so the debugger stops there
+	static bool sync_check; //GL_CHECK calls glGetError, very slow
+	static bool show_notifications; //the driver is quite verbose with them
+
+	static int num_errors;
+	static int num_warnings;
+
+	//last GL_CHECK
+	static const char* call_site_file;
+	static int call_site_line;
+
+	static bool init(); //after creating the context, false if KHR_debug is not supported
+	static void check(const char* file, int line); //glGetError, used by sync_check
+
+	static void checkpoint(const char* file, int line)
+	{
+		call_site_file = file;
+		call_site_line = line;
+		if (sync_check)
+			check(file, line);
+	}
+};
+
+#ifdef _DEBUG
+	#define GL_CHECK() GLDebug::checkpoint(__FILE__, __LINE__)
+#else
+	#define GL_CHECK()
+#endif
+
+#endif
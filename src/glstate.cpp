@@ -0,0 +1,295 @@
+#include "glstate.h"
+
+#include <cassert>
+
+bool GLState::enabled = true;
+int GLState::num_calls = 0;
+int GLState::num_filtered = 0;
+int GLState::num_calls_last_frame = 0;
+int GLState::num_filtered_last_frame = 0;
+
+const GLuint UNKNOWN = 0xFFFFFFFF; //never a valid name
+const int MAX_TEXTURE_UNITS = 16;
+const int MAX_UNIFORM_BINDINGS = 16;
+
+//the targets and capabilities shadowed, the rest go straight to the driver
+static const GLenum texture_targets[] = { GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_3D };
+static const GLenum buffer_targets[] = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_DRAW_INDIRECT_BUFFER };
+static const GLenum capabilities[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_SCISSOR_TEST, GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_3D };
+const int NUM_TEXTURE_TARGETS = sizeof(texture_targets) / sizeof(GLenum);
+const int NUM_BUFFER_TARGETS = sizeof(buffer_targets) / sizeof(GLenum);
+const int NUM_CAPABILITIES = sizeof(capabilities) / sizeof(GLenum);
+
+static struct sState {
+	GLuint program;
+	int active_unit;
+	GLuint textures[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+	GLuint buffers[NUM_BUFFER_TARGETS];
+	GLuint uniform_bindings[MAX_UNIFORM_BINDINGS]; //only the whole buffer ones, the ranges are always sent
+	GLuint vao;
+	int caps[NUM_CAPABILITIES]; //-1 unknown
+	GLenum blend_src, blend_dst;
+	int depth_mask;
+	GLenum depth_func;
+	GLenum cull_face;
+	GLenum polygon_mode;
+} state;
+
+static bool initialized = false;
+
+template<typename T> static int indexOf(const T* array, int num, T value)
+{
+	for (int i = 0; i < num; ++i)
+		if (array[i] == value)
+			return i;
+	return -1;
+}
+
+//true if it has to be sent, and then the shadow is updated
+template<typename T> static bool changes(T& shadow, T value)
+{
+	if (!initialized)
+		GLState::invalidate();
+	if (GLState::enabled && shadow == value)
+	{
+		GLState::num_filtered++;
+		return false;
+	}
+	shadow = value;
+	GLState::num_calls++;
+	return true;
+}
+
+void GLState::useProgram(GLuint program)
+{
+	if (changes(state.program, program))
+		glUseProgram(program);
+}
+
+void GLState::activeTexture(int unit)
+{
+	if (changes(state.active_unit, unit))
+		glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+	if (!initialized)
+		invalidate();
+	int index = indexOf(texture_targets, NUM_TEXTURE_TARGETS, target);
+	int unit = state.active_unit;
+	if (index == -1 || unit < 0 || unit >= MAX_TEXTURE_UNITS)
+	{
+		num_calls++;
+		glBindTexture(target, texture);
+		return;
+	}
+	if (changes(state.textures[unit][index], texture))
+		glBindTexture(target, texture);
+}
+
+void GLState::bindTexture(int unit, GLenum target, GLuint texture)
+{
+	if (!initialized)
+		invalidate();
+	int index = indexOf(texture_targets, NUM_TEXTURE_TARGETS, target);
+	if (enabled && index != -1 && unit < MAX_TEXTURE_UNITS && state.textures[unit][index] == texture)
+	{
+		num_filtered++;
+		return;
+	}
+	activeTexture(unit);
+	bindTexture(target, texture);
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+	if (!initialized)
+		invalidate();
+	int index = indexOf(buffer_targets, NUM_BUFFER_TARGETS, target);
+	if (index == -1)
+	{
+		num_calls++;
+		glBindBuffer(target, buffer);
+		return;
+	}
+	if (changes(state.buffers[index], buffer))
+		glBindBuffer(target, buffer);
+}
+
+void GLState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	if (!initialized)
+		invalidate();
+	int target_index = indexOf(buffer_targets, NUM_BUFFER_TARGETS, target);
+	if (target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS)
+	{
+		if (!changes(state.uniform_bindings[index], buffer))
+			return;
+	}
+	else
+		num_calls++;
+	glBindBufferBase(target, index, buffer);
+	if (target_index != -1)
+		state.buffers[target_index] = buffer;
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (!initialized)
+		invalidate();
+	num_calls++;
+	glBindBufferRange(target, index, buffer, offset, size);
+	int target_index = indexOf(buffer_targets, NUM_BUFFER_TARGETS, target);
+	if (target_index != -1)
+		state.buffers[target_index] = buffer;
+	if (target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS)
+		state.uniform_bindings[index] = UNKNOWN; //a range is not the whole buffer
+}
+
+void GLState::bindVertexArray(GLuint vao)
+{
+	if (!changes(state.vao, vao))
+		return;
+	glBindVertexArray(vao);
+	state.buffers[indexOf(buffer_targets, NUM_BUFFER_TARGETS, (GLenum)GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+}
+
+void GLState::setCapability(GLenum cap, bool enable)
+{
+	if (!initialized)
+		invalidate();
+	int index = indexOf(capabilities, NUM_CAPABILITIES, cap);
+	if (index != -1 && !changes(state.caps[index], enable ? 1 : 0))
+		return;
+	if (index == -1)
+		num_calls++;
+	if (enable)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+void GLState::blendFunc(GLenum src, GLenum dst)
+{
+	if (!initialized)
+		invalidate();
+	if (enabled && state.blend_src == src && state.blend_dst == dst)
+	{
+		num_filtered++;
+		return;
+	}
+	state.blend_src = src;
+	state.blend_dst = dst;
+	num_calls++;
+	glBlendFunc(src, dst);
+}
+
+void GLState::depthMask(bool write)
+{
+	if (changes(state.depth_mask, write ? 1 : 0))
+		glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+void GLState::depthFunc(GLenum func)
+{
+	if (changes(state.depth_func, func))
+		glDepthFunc(func);
+}
+
+void GLState::cullFace(GLenum face)
+{
+	if (changes(state.cull_face, face))
+		glCullFace(face);
+}
+
+void GLState::polygonMode(GLenum mode)
+{
+	if (changes(state.polygon_mode, mode))
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+bool GLState::isEnabled(GLenum cap)
+{
+	if (!initialized)
+		invalidate();
+	int index = indexOf(capabilities, NUM_CAPABILITIES, cap);
+	if (index == -1)
+		return glIsEnabled(cap) == GL_TRUE;
+	if (state.caps[index] == -1)
+		state.caps[index] = glIsEnabled(cap) == GL_TRUE ? 1 : 0;
+	return state.caps[index] == 1;
+}
+
+GLuint GLState::getProgram()
+{
+	if (!initialized)
+		invalidate();
+	return state.program;
+}
+
+GLuint GLState::getVertexArray()
+{
+	if (!initialized)
+		invalidate();
+	return state.vao;
+}
+
+void GLState::forgetProgram(GLuint program)
+{
+	if (state.program == program)
+		state.program = UNKNOWN;
+}
+
+void GLState::forgetTexture(GLuint texture)
+{
+	for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+		for (int j = 0; j < NUM_TEXTURE_TARGETS; ++j)
+			if (state.textures[i][j] == texture)
+				state.textures[i][j] = UNKNOWN;
+}
+
+void GLState::forgetBuffer(GLuint buffer)
+{
+	for (int i = 0; i < NUM_BUFFER_TARGETS; ++i)
+		if (state.buffers[i] == buffer)
+			state.buffers[i] = UNKNOWN;
+	for (int i = 0; i < MAX_UNIFORM_BINDINGS; ++i)
+		if (state.uniform_bindings[i] == buffer)
+			state.uniform_bindings[i] = UNKNOWN;
+}
+
+void GLState::forgetVertexArray(GLuint vao)
+{
+	if (state.vao == vao)
+		state.vao = UNKNOWN;
+}
+
+void GLState::invalidate()
+{
+	initialized = true;
+	state.program = UNKNOWN;
+	state.active_unit = -1;
+	for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+		for (int j = 0; j < NUM_TEXTURE_TARGETS; ++j)
+			state.textures[i][j] = UNKNOWN;
+	for (int i = 0; i < NUM_BUFFER_TARGETS; ++i)
+		state.buffers[i] = UNKNOWN;
+	for (int i = 0; i < MAX_UNIFORM_BINDINGS; ++i)
+		state.uniform_bindings[i] = UNKNOWN;
+	state.vao = UNKNOWN;
+	for (int i = 0; i < NUM_CAPABILITIES; ++i)
+		state.caps[i] = -1;
+	state.blend_src = state.blend_dst = UNKNOWN;
+	state.depth_mask = -1;
+	state.depth_func = UNKNOWN;
+	state.cull_face = UNKNOWN;
+	state.polygon_mode = UNKNOWN;
+}
+
+void GLState::endFrame()
+{
+	num_calls_last_frame = num_calls;
+	num_filtered_last_frame = num_filtered;
+	num_calls = num_filtered = 0;
+}
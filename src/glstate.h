@@ -0,0 +1,55 @@
+/*  Shadow of the GL state that changes between draws (program, textures, buffers, vertex array, blend, depth, cull
+	and polygon mode). Every change goes through here and the ones that would not change anything are not sent
+	to the driver. The code that changes the state directly (like ImGui) must call invalidate after it, and the
+	objects must be forgotten when deleted because GL unbinds them and a new object could reuse the id.
+	All the functions must be called from the thread of the context.
+*/
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "includes.h"
+
+class GLState
+{
+public:
+	static bool enabled; //false sends every call to the driver, to find code changing the state behind its back
+
+	//stats
+	static int num_calls; //this frame, sent to the driver
+	static int num_filtered; //this frame, redundant
+	static int num_calls_last_frame;
+	static int num_filtered_last_frame;
+
+	static void useProgram(GLuint program);
+	static void activeTexture(int unit);
+	static void bindTexture(GLenum target, GLuint texture); //in the active unit
+	static void bindTexture(int unit, GLenum target, GLuint texture); //it only changes the active unit if it has to bind
+	static void bindBuffer(GLenum target, GLuint buffer);
+	static void bindBufferBase(GLenum target, GLuint index, GLuint buffer); //like GL it also binds it to target
+	static void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	static void bindVertexArray(GLuint vao); //the element array buffer is part of it
+	static void setCapability(GLenum cap, bool enable);
+	static void enable(GLenum cap) { setCapability(cap, true); }
+	static void disable(GLenum cap) { setCapability(cap, false); }
+	static void blendFunc(GLenum src, GLenum dst);
+	static void depthMask(bool write);
+	static void depthFunc(GLenum func);
+	static void cullFace(GLenum face);
+	static void polygonMode(GLenum mode); //front and back
+
+	static bool isEnabled(GLenum cap); //from the shadow, only asks the driver if it is unknown
+	static GLuint getProgram();
+	static GLuint getVertexArray();
+
+	//GL unbinds the deleted objects, the shadow has to do the same
+	static void forgetProgram(GLuint program);
+	static void forgetTexture(GLuint texture);
+	static void forgetBuffer(GLuint buffer);
+	static void forgetVertexArray(GLuint vao);
+
+	static void invalidate(); //everything unknown, the next calls are sent
+	static void endFrame();
+};
+
+#endif
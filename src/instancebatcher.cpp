@@ -0,0 +1,130 @@
+#include "instancebatcher.h"
+#include "scenenode.h"
+#include "material.h"
+#include "ringbuffer.h"
+#include "renderqueue.h"
+#include "jobsystem.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <tuple>
+
+bool InstanceBatcher::enabled = true;
+int InstanceBatcher::min_instances = 2;
+int InstanceBatcher::num_batches = 0;
+int InstanceBatcher::num_batched_nodes = 0;
+
+void InstanceBatcher::collect(std::vector<SceneNode*>& nodes, Camera* camera, RenderQueue& queue)
+{
+	cull(nodes, camera, visible_nodes);
+	collect(visible_nodes, camera, queue);
+}
+
+void InstanceBatcher::cull(std::vector<SceneNode*>& nodes, Camera* camera, std::vector<sVisibleNode>& visible)
+{
+	PROFILE_SCOPE("cull");
+	//the frustum test and the lod of every node are independent, the list is not
+	visible_flags.resize(nodes.size());
+	JobSystem::parallelFor((int)nodes.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			SceneNode* node = nodes[i];
+			Material* material = node->material;
+			visible_flags[i] = material && node->mesh && material->shader && node->isInFrustum(camera);
+			if (visible_flags[i])
+				node->updateLOD(camera);
+		}
+	}, 256);
+
+	visible.clear();
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		if (!visible_flags[i])
+			continue;
+		SceneNode* node = nodes[i];
+		sVisibleNode visible_node;
+		visible_node.node = node;
+		visible_node.material = node->material;
+		visible_node.mesh = node->mesh;
+		visible_node.model = node->model;
+		visible_node.lod = node->lod;
+		visible.push_back(visible_node);
+	}
+}
+
+void InstanceBatcher::collect(const std::vector<sVisibleNode>& visible, Camera* camera, RenderQueue& queue)
+{
+	PROFILE_SCOPE("batch");
+	num_batches = num_batched_nodes = 0;
+	items.clear();
+	for (size_t i = 0; i < visible.size(); ++i)
+	{
+		const sVisibleNode& node = visible[i];
+		Material* material = node.material;
+
+		sItem item;
+		item.mesh = node.mesh;
+		item.lod = node.lod;
+		item.shader = material->getShader(); //the permutation, the base shader is shared by different programs
+		item.texture = material->texture;
+		item.material_key = enabled && !material->transparent ? material->getBatchKey() : 0; //the translucent ones must be sorted one by one
+		item.node = &node;
+		items.push_back(item);
+	}
+
+	//the nodes of a batch end up together
+	std::sort(items.begin(), items.end(), [](const sItem& a, const sItem& b) {
+		return std::tie(a.mesh, a.lod, a.shader, a.texture, a.material_key) < std::tie(b.mesh, b.lod, b.shader, b.texture, b.material_key);
+	});
+
+	RingBuffer* ring = RingBuffer::getDefault();
+	size_t start = 0;
+	while (start < items.size())
+	{
+		const sItem& first = items[start];
+		size_t end = start + 1;
+		while (end < items.size() && items[end].mesh == first.mesh && items[end].lod == first.lod && items[end].shader == first.shader &&
+			items[end].texture == first.texture && items[end].material_key == first.material_key)
+			end++;
+		int num = (int)(end - start);
+		Material* material = first.node->material;
+
+		if (num < min_instances || !first.material_key || !material->getInstancedShader())
+		{
+			for (size_t i = start; i < end; ++i)
+			{
+				const sVisibleNode* node = items[i].node;
+				queue.add(node->material, node->mesh, node->model, node->lod, camera);
+			}
+		}
+		else
+		{
+			//all the matrices and then all the colors, sorted by the nearest one
+			size_t models_offset = 0;
+			Vector3 center = first.node->model * first.mesh->box.center;
+			float min_distance = (float)(center - camera->eye).length();
+			char* data = (char*)ring->map(num * (sizeof(Matrix44) + sizeof(Vector4)), models_offset);
+			Matrix44* models = (Matrix44*)data;
+			Vector4* colors = (Vector4*)(data + num * sizeof(Matrix44));
+			for (int i = 0; i < num; ++i)
+			{
+				const sVisibleNode* node = items[start + i].node;
+				models[i] = node->model;
+				colors[i] = node->material->color;
+				Vector3 node_center = node->model * first.mesh->box.center;
+				float distance = (float)(node_center - camera->eye).length();
+				if (distance < min_distance)
+				{
+					min_distance = distance;
+					center = node_center;
+				}
+			}
+			ring->unmap();
+
+			queue.addInstanced(material, first.mesh, first.lod, center, ring->buffer_id, models_offset, models_offset + num * sizeof(Matrix44), num, camera);
+			num_batches++;
+			num_batched_nodes += num;
+		}
+		start = end;
+	}
+}
@@ -0,0 +1,61 @@
+/*  Groups the visible nodes that share mesh, lod, shader, texture and material key so every group is drawn with
+	one instanced call (see Material::renderInstanced). The model matrices and colors of the instances are written
+	straight in the ring buffer of the frame. The nodes that cannot be instanced, or groups too small, are added one by one.
+	Everything goes to a RenderQueue that decides the final order.
+	The culling is separated (it does not touch GL) so it can run in the jobs of the next frame and the grouping
+	only reads the visible list, with the matrices and lods copied from the nodes.
+*/
+
+#ifndef INSTANCEBATCHER_H
+#define INSTANCEBATCHER_H
+
+#include <vector>
+
+#include "framework.h"
+
+class SceneNode;
+class Camera;
+class Mesh;
+class Shader;
+class Texture;
+class RenderQueue;
+class Material;
+
+class InstanceBatcher
+{
+public:
+	static bool enabled;
+	static int min_instances; //smaller groups are rendered node by node
+
+	//stats of the last collect
+	static int num_batches;
+	static int num_batched_nodes;
+
+	struct sVisibleNode {
+		SceneNode* node;
+		Material* material;
+		Mesh* mesh;
+		Matrix44 model;
+		int lod;
+	};
+
+	void collect(std::vector<SceneNode*>& nodes, Camera* camera, RenderQueue& queue); //culls, groups and adds the draws to the queue
+	void cull(std::vector<SceneNode*>& nodes, Camera* camera, std::vector<sVisibleNode>& visible); //updates the lods, no GL calls
+	void collect(const std::vector<sVisibleNode>& visible, Camera* camera, RenderQueue& queue); //groups and adds the draws, GL thread
+
+private:
+	struct sItem {
+		Mesh* mesh;
+		int lod;
+		Shader* shader;
+		Texture* texture;
+		unsigned int material_key;
+		const sVisibleNode* node;
+	};
+
+	std::vector<sItem> items; //reused every frame to avoid allocations
+	std::vector<char> visible_flags; //by node, written by the culling jobs
+	std::vector<sVisibleNode> visible_nodes; //for the collect that also culls
+};
+
+#endif
@@ -0,0 +1,447 @@
+#include "jobsystem.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+int JobSystem::num_threads = 0;
+std::atomic<int> JobSystem::num_executed(0);
+std::atomic<int> JobSystem::num_stolen(0);
+
+struct sJob {
+	JobSystem::tJobFunc func;
+	sJob* parent;
+	bool detached; //nobody waits it, so it deletes itself
+	std::atomic<int> unfinished; //itself plus the children not finished
+};
+
+struct sJobQueue {
+	std::mutex mutex;
+	std::deque<sJob*> jobs;
+};
+
+//queue 0 belongs to the main thread, the last one to the other threads that are not workers
+static std::vector<sJobQueue*> queues;
+static std::vector<std::thread> workers;
+static std::atomic<int> num_queued(0);
+static std::mutex sleep_mutex;
+static std::condition_variable sleep_cond; //idle workers wait for jobs
+static bool stop_workers = false;
+static bool initialized = false;
+
+static thread_local int queue_index = -1; //-1 for the threads that are not the main one nor workers
+static thread_local sJob* current_job = NULL;
+
+static std::mutex main_thread_mutex;
+static std::vector<JobSystem::tJobFunc> main_thread_jobs;
+
+static void pushJob(sJob* job)
+{
+	sJobQueue* queue = queue_index >= 0 ? queues[queue_index] : queues.back();
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->jobs.push_back(job);
+	}
+	num_queued++;
+
+	//taking the lock avoids waking a worker that checked the count but is not waiting yet
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	sleep_cond.notify_one();
+}
+
+//the newest of its own queue, or the oldest of another one, the threads without queue start by the shared one
+static sJob* popJob()
+{
+	if (num_queued.load() == 0)
+		return NULL;
+
+	int num = (int)queues.size();
+	int first = queue_index >= 0 ? queue_index : num - 1;
+	for (int i = 0; i < num; ++i)
+	{
+		int index = (first + i) % num;
+		sJobQueue* queue = queues[index];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->jobs.empty())
+			continue;
+		sJob* job = NULL;
+		if (index == queue_index)
+		{
+			job = queue->jobs.back();
+			queue->jobs.pop_back();
+		}
+		else
+		{
+			job = queue->jobs.front();
+			queue->jobs.pop_front();
+			if (i > 0)
+				JobSystem::num_stolen++;
+		}
+		num_queued--;
+		return job;
+	}
+	return NULL;
+}
+
+static void finishJob(sJob* job)
+{
+	//read before, once it reaches 0 wait can delete it
+	sJob* parent = job->parent;
+	bool detached = job->detached;
+	if (--job->unfinished > 0)
+		return;
+	if (!parent) //the ones without parent are deleted by wait, unless nobody waits them
+	{
+		if (detached)
+			delete job;
+		return;
+	}
+	delete job;
+	finishJob(parent);
+}
+
+static void executeJob(sJob* job)
+{
+	sJob* previous = current_job;
+	current_job = job;
+	if (job->func)
+	{
+		PROFILE_SCOPE("job");
+		job->func();
+	}
+	current_job = previous;
+	JobSystem::num_executed++;
+	finishJob(job);
+}
+
+static void workerLoop(int index)
+{
+	queue_index = index;
+	std::string name = "Worker " + std::to_string(index);
+	Profiler::setThreadName(name.c_str());
+	while (true)
+	{
+		sJob* job = popJob();
+		if (job)
+		{
+			executeJob(job);
+			continue;
+		}
+
+		//the queued jobs are finished before stopping
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		if (stop_workers && num_queued.load() == 0)
+			return;
+		sleep_cond.wait(lock, [] { return stop_workers || num_queued.load() > 0; });
+	}
+}
+
+void JobSystem::init()
+{
+	if (initialized)
+		return;
+
+	int num = num_threads;
+	if (num <= 0)
+		num = (int)std::thread::hardware_concurrency();
+	if (num <= 0)
+		num = 1;
+
+	stop_workers = false;
+	queue_index = 0;
+	for (int i = 0; i <= num; ++i) //plus the shared one
+		queues.push_back(new sJobQueue());
+	for (int i = 1; i < num; ++i)
+		workers.push_back(std::thread(workerLoop, i));
+	initialized = true;
+	std::cout << " + Job system: " << num << " threads" << std::endl;
+}
+
+void JobSystem::shutdown()
+{
+	if (!initialized)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stop_workers = true;
+	}
+	sleep_cond.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+
+	//with no workers the jobs of the first queue are not run by anybody
+	sJob* job = NULL;
+	while ((job = popJob()))
+		executeJob(job);
+
+	for (size_t i = 0; i < queues.size(); ++i)
+		delete queues[i];
+	queues.clear();
+	initialized = false;
+}
+
+int JobSystem::getNumThreads()
+{
+	init();
+	return (int)workers.size() + 1;
+}
+
+sJob* JobSystem::create(tJobFunc func, sJob* parent)
+{
+	init();
+	sJob* job = new sJob();
+	job->func = func;
+	job->parent = parent;
+	job->detached = false;
+	job->unfinished = 1;
+	if (parent)
+	{
+		assert(parent->unfinished > 0 && "the parent has already finished");
+		parent->unfinished++;
+	}
+	return job;
+}
+
+void JobSystem::run(sJob* job)
+{
+	assert(job);
+	pushJob(job);
+}
+
+void JobSystem::runDetached(tJobFunc func)
+{
+	sJob* job = create(func);
+	job->detached = true;
+	pushJob(job);
+}
+
+void JobSystem::wait(sJob* job)
+{
+	assert(job && !job->parent && !job->detached && "only the jobs without parent can be waited");
+	while (job->unfinished.load() > 0)
+	{
+		sJob* other = popJob();
+		if (other)
+			executeJob(other);
+		else
+			std::this_thread::yield();
+	}
+	delete job;
+}
+
+sJob* JobSystem::getCurrentJob()
+{
+	return current_job;
+}
+
+//the second half goes to the queue and the first one is split again, so the thieves take the biggest ranges
+static void splitRange(sJob* parent, int begin, int end, int grain, const JobSystem::tRangeFunc& func)
+{
+	while (end - begin > grain)
+	{
+		int middle = begin + (end - begin) / 2;
+		int range_end = end;
+		sJob* job = JobSystem::create([parent, middle, range_end, grain, &func]() { splitRange(parent, middle, range_end, grain, func); }, parent);
+		JobSystem::run(job);
+		end = middle;
+	}
+	func(begin, end);
+}
+
+void JobSystem::parallelFor(int count, tRangeFunc func, int grain)
+{
+	if (count <= 0)
+		return;
+
+	//a few ranges per thread so the ones that finish early can steal
+	int threads = getNumThreads();
+	grain = std::max(std::max(grain, 1), count / (threads * 4));
+	if (threads == 1 || count <= grain)
+	{
+		func(0, count);
+		return;
+	}
+
+	sJob* root = NULL;
+	root = create([&]() { splitRange(root, 0, count, grain, func); });
+	run(root);
+	wait(root);
+}
+
+void JobSystem::runOnMainThread(tJobFunc func)
+{
+	std::lock_guard<std::mutex> lock(main_thread_mutex);
+	main_thread_jobs.push_back(func);
+}
+
+void JobSystem::updateMainThread()
+{
+	std::vector<tJobFunc> jobs;
+	{
+		std::lock_guard<std::mutex> lock(main_thread_mutex);
+		jobs.swap(main_thread_jobs);
+	}
+	for (size_t i = 0; i < jobs.size(); ++i)
+		jobs[i]();
+}
+
+//children created inside their parent, like a recursive algorithm would do
+static void spawnTree(sJob* parent, int depth, std::atomic<int>& counter)
+{
+	counter++;
+	if (depth == 0)
+		return;
+	for (int i = 0; i < 4; ++i)
+	{
+		sJob* child = JobSystem::create([depth, &counter]() { spawnTree(JobSystem::getCurrentJob(), depth - 1, counter); }, parent);
+		JobSystem::run(child);
+	}
+}
+
+static bool stressTest()
+{
+	bool ok = true;
+
+	//dependencies: the root is not finished till all the tree is
+	const int depth = 6;
+	int tree_size = 0;
+	for (int i = 0, level = 1; i <= depth; ++i, level *= 4)
+		tree_size += level;
+	for (int i = 0; i < 20; ++i)
+	{
+		std::atomic<int> counter(0);
+		sJob* root = JobSystem::create([&counter]() { spawnTree(JobSystem::getCurrentJob(), depth, counter); });
+		JobSystem::run(root);
+		JobSystem::wait(root);
+		if (counter.load() != tree_size)
+		{
+			std::cout << "\t [ERROR] job tree: " << counter.load() << " of " << tree_size << std::endl;
+			ok = false;
+			break;
+		}
+	}
+
+	//every item exactly once, whatever the grain
+	const int count = 1000003;
+	std::vector<unsigned char> marks(count);
+	int grains[] = { 0, 1, 7, 1000, count };
+	for (int g = 0; g < 5; ++g)
+	{
+		std::fill(marks.begin(), marks.end(), 0);
+		JobSystem::parallelFor(count, [&](int begin, int end) {
+			for (int i = begin; i < end; ++i)
+				marks[i]++;
+		}, grains[g]);
+		for (int i = 0; i < count; ++i)
+			if (marks[i] != 1)
+			{
+				std::cout << "\t [ERROR] parallelFor with grain " << grains[g] << ": item " << i << " run " << (int)marks[i] << " times" << std::endl;
+				ok = false;
+				break;
+			}
+	}
+
+	//nested, the outer jobs help while they wait for the inner ones
+	std::atomic<int> nested(0);
+	JobSystem::parallelFor(64, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			JobSystem::parallelFor(1000, [&](int begin2, int end2) { nested += end2 - begin2; }, 1);
+	}, 1);
+	if (nested.load() != 64 * 1000)
+	{
+		std::cout << "\t [ERROR] nested parallelFor: " << nested.load() << " of " << 64 * 1000 << std::endl;
+		ok = false;
+	}
+
+	//nobody waits them, they delete themselves
+	std::atomic<int> detached(0);
+	for (int i = 0; i < 1000; ++i)
+		JobSystem::runDetached([&detached]() { detached++; });
+	while (detached.load() < 1000)
+	{
+		sJob* job = popJob();
+		if (job)
+			executeJob(job);
+		else
+			std::this_thread::yield();
+	}
+	if (detached.load() != 1000)
+	{
+		std::cout << "\t [ERROR] detached jobs: " << detached.load() << " of 1000" << std::endl;
+		ok = false;
+	}
+
+	//sent from the workers, run by the main thread
+	int main_thread_count = 0;
+	JobSystem::parallelFor(1000, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			JobSystem::runOnMainThread([&main_thread_count]() { main_thread_count++; });
+	}, 1);
+	JobSystem::updateMainThread();
+	if (main_thread_count != 1000)
+	{
+		std::cout << "\t [ERROR] main thread queue: " << main_thread_count << " of 1000" << std::endl;
+		ok = false;
+	}
+
+	return ok;
+}
+
+void JobSystem::benchmark()
+{
+	int max_threads = (int)std::thread::hardware_concurrency();
+	if (max_threads <= 0)
+		max_threads = 1;
+	int default_threads = num_threads;
+
+	std::cout << " + Job system benchmark: 1 to " << max_threads << " threads" << std::endl;
+
+	const int count = 1 << 20;
+	std::vector<float> values(count);
+	double single = 0;
+	for (int n = 1; n <= max_threads; ++n)
+	{
+		shutdown();
+		num_threads = n;
+		init();
+
+		bool ok = stressTest();
+
+		double best = 1e10;
+		for (int i = 0; i < 5; ++i)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			JobSystem::parallelFor(count, [&](int begin, int end) {
+				for (int j = begin; j < end; ++j)
+				{
+					float v = (float)j;
+					for (int k = 0; k < 32; ++k)
+						v = std::sin(v) + 1.0f;
+					values[j] = v;
+				}
+			});
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			if (seconds < best)
+				best = seconds;
+		}
+		if (n == 1)
+			single = best;
+
+		std::cout << "\t threads: " << n << " best: " << best * 1000.0 << "ms speedup: " << single / best << "x stress test: " << (ok ? "OK" : "FAILED") << std::endl;
+	}
+
+	shutdown();
+	num_threads = default_threads;
+}
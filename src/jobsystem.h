@@ -0,0 +1,55 @@
+/*  Job scheduler shared by the whole framework (culling, animation, volume generators, parsers...).
+	Every worker has its own deque: it pushes and pops its jobs at the back and, when it runs out, steals from the
+	front of the others, so the big jobs (the first halves of a parallelFor) are the ones that move between threads.
+	A job can have a parent, the parent is not finished till all its children are. wait helps running jobs meanwhile,
+	so it can be called from inside a job without blocking a worker.
+	The GL calls can only be done in the main thread, the jobs send them there with runOnMainThread.
+	init must be called from the main thread before using it from other threads, it owns the first deque. The other
+	threads that are not workers (the resource loaders) push to a last one shared between them, and only take
+	jobs from the front of the deques, so they never pop from the back of a deque they don't own.
+*/
+
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <functional>
+#include <atomic>
+#include <cstddef>
+
+struct sJob;
+
+class JobSystem
+{
+public:
+	typedef std::function<void()> tJobFunc;
+	typedef std::function<void(int, int)> tRangeFunc; //from begin to end (not included)
+
+	static int num_threads; //including the calling thread, 0 to use all the cores
+
+	//stats
+	static std::atomic<int> num_executed;
+	static std::atomic<int> num_stolen;
+
+	static void init(); //starts the workers, called by the first create if not done before
+	static void shutdown(); //runs the queued jobs and stops the workers
+	static int getNumThreads(); //workers plus the calling thread
+
+	//the jobs without parent must be waited once, that deletes them, the children are deleted when they finish
+	static sJob* create(tJobFunc func, sJob* parent = NULL);
+	static void run(sJob* job);
+	static void wait(sJob* job);
+	static void runDetached(tJobFunc func); //a job without parent that nobody waits, deleted when it finishes
+	static sJob* getCurrentJob(); //the one running in this thread, NULL outside the jobs
+
+	//splits [0,count) in ranges of at least grain items (0 to choose it from the threads) and waits for all of them
+	static void parallelFor(int count, tRangeFunc func, int grain = 0);
+
+	//from any thread, func runs in the main thread inside updateMainThread
+	static void runOnMainThread(tJobFunc func);
+	static void updateMainThread(); //once per frame
+
+	//checks the results with many small dependent jobs and measures the speedup from 1 to all the cores
+	static void benchmark();
+};
+
+#endif
@@ -15,7 +15,19 @@
 #include "utils.h"
 #include "input.h"
 #include "application.h"
-#include "extra/directory_watcher.h"
+#ifdef WIN32
+	#include "extra/directory_watcher.h" //reloads the shaders when they change, it uses the win32 API
+#endif
+#include "extra/objparser.h"
+#include "resourceloader.h"
+#include "resourcecache.h"
+#include "ringbuffer.h"
+#include "uniformbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+#include "jobsystem.h"
+#include "profiler.h"
+#include "bench.h"
 
 #include <iostream> //to output
 
@@ -23,7 +35,9 @@ long last_time = 0; //this is used to calcule the elapsed time between frames
 
 Application* game = NULL;
 SDL_GLContext glcontext;
+#ifdef WIN32
 CDirectoryWatcher dir_watcher_data;
+#endif
 
 // *********************************
 //create a window using SDL
@@ -39,6 +53,9 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16); //or 24
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 	SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+#ifdef _DEBUG
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG); //some drivers only report with a debug context
+#endif
 
 	//SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	//SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
@@ -75,6 +92,9 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 		glewInit();
 	#endif
 
+	//errors reported by the driver instead of checking glGetError after the calls
+	GLDebug::init();
+
 	int window_width, window_height;
 	SDL_GetWindowSize(sdl_window, &window_width, &window_height);
 	std::cout << " * Window size: " << window_width << " x " << window_height << std::endl;
@@ -84,8 +104,10 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 	return sdl_window;
 }
 
-void renderGUI(SDL_Window* window, Application * game)
+//the widgets, with pipelined frames they are built before the update of the next frame starts
+void buildGUI(SDL_Window* window, Application * game)
 {
+	PROFILE_SCOPE("gui");
 	
 	ImGuiIO& io = ImGui::GetIO(); (void)io;
 	io.MousePos.x = Input::mouse_position.x;
@@ -98,6 +120,11 @@ void renderGUI(SDL_Window* window, Application * game)
 
 		//System stats
 		ImGui::Text(getGPUStats().c_str());					   // Display some text (you can use a format strings too)
+		ImGui::Text("Frame: %.2fms Input latency: %.2fms", game->frame_ms, game->latency_ms);
+		ImGui::Text("Update: %.2fms Render: %.2fms Ticks: %ld (%ld dropped)", game->update_ms, game->render_ms, game->num_ticks, game->num_dropped_ticks);
+		ImGui::Checkbox("Pipelined frames (F3)", &Application::pipelined);
+		ImGui::Checkbox("Fixed timestep", &Application::fixed_timestep);
+		ImGui::DragFloat("Tick rate", &Application::tick_rate, 1.0f, 10.0f, 240.0f);
 		
 		if (ImGui::TreeNode("Scene")) {
 			ImGui::DragFloat("Exposure", &Application::instance->scene_exposure, 0.01f,-2, 2);
@@ -105,6 +132,11 @@ void renderGUI(SDL_Window* window, Application * game)
 			ImGui::TreePop();
 		}
 
+		if (ImGui::TreeNode("Profiler")) {
+			Profiler::renderInMenu();
+			ImGui::TreePop();
+		}
+
 		if (ImGui::TreeNode("Camera")) {
 			game->camera->renderInMenu();
 			ImGui::TreePop();
@@ -115,40 +147,6 @@ void renderGUI(SDL_Window* window, Application * game)
 		{
 			unsigned int count = 0;
 			std::stringstream ss;
-<<<<<<< Updated upstream
-=======
-
-			//Creating and adding a light to the scene
-			if (ImGui::Button("Add Light", ImVec2(200.0, 20.0)))
-			{
-				Light* light = new Light();
-				game->light_list.push_back(light);
-			}
-
-			//Creating and adding a mesh to the scene
-			if (ImGui::Button("Add Mesh", ImVec2(200.0, 20.0)))
-			{
-				SceneNode* node = new SceneNode();
-				game->node_list.push_back(node);
-			}
-
-			//Configure skybox
-			game->sky->renderInMenu();
-
-			for (auto& node : game->light_list)
-			{
-				ss << count;
-				if (ImGui::TreeNode(node->name.c_str()))
-				{
-					node->renderInMenu();
-					ImGui::TreePop();
-				}
-				++count;
-				ss.str("");
-			}
-			//ImGui::TreePop();
-
->>>>>>> Stashed changes
 			for (auto& node : game->node_list)
 			{
 				ss << count;
@@ -165,10 +163,23 @@ void renderGUI(SDL_Window* window, Application * game)
 		ImGui::End();
 	}
 
-	// Rendering
 	ImGui::Render();
+}
+
+//only reads the draw data of the last buildGUI
+void drawGUI()
+{
+	PROFILE_GPU_SCOPE("gui draw");
+	ImGuiIO& io = ImGui::GetIO();
 	glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	GLState::invalidate(); //it changes the state without telling
+}
+
+void renderGUI(SDL_Window* window, Application * game)
+{
+	buildGUI(window, game);
+	drawGUI();
 }
 
 //The application main loop
@@ -176,13 +187,18 @@ void mainLoop(SDL_Window* window)
 {
 	SDL_Event sdlEvent;
 
-	long start_time = SDL_GetTicks();
-	long now = start_time;
+	//the performance counter, the milliseconds of SDL_GetTicks are too coarse for the fixed timestep
+	Uint64 start_time = SDL_GetPerformanceCounter();
+	Uint64 now = start_time;
 	long frames_this_second = 0;
+	Uint64 last_swap = SDL_GetPerformanceCounter();
+	Uint64 shown_input_ticks = 0; //of the frame rendered before the swap
+	double ticks_to_ms = 1000.0 / SDL_GetPerformanceFrequency();
 
 	while (!game->must_exit)
 	{
 		Input::update();
+		Uint64 input_ticks = SDL_GetPerformanceCounter();
 
 		//update events
 		while(SDL_PollEvent(&sdlEvent))
@@ -225,23 +241,43 @@ void mainLoop(SDL_Window* window)
 					break;
 				}
 				break;
+#ifdef WIN32
 			case CDirectoryWatcher::WM_FILE_CHANGED:
-
+			{
 				const char* filename = (const char*)(sdlEvent.text.text);
 				Application::instance->onFileChanged(filename);
 				break;
 			}
+#endif
+			}
 		}
 
 		// swap between front buffer and back buffer
-		SDL_GL_SwapWindow(window);
+		{
+			PROFILE_SCOPE("swap");
+			SDL_GL_SwapWindow(window);
+		}
+
+		//smoothed, to compare the serial and the pipelined loops
+		Uint64 swap = SDL_GetPerformanceCounter();
+		game->frame_ms = game->frame_ms * 0.9f + float((swap - last_swap) * ticks_to_ms) * 0.1f;
+		if (shown_input_ticks)
+			game->latency_ms = game->latency_ms * 0.9f + float((swap - shown_input_ticks) * ticks_to_ms) * 0.1f;
+		last_swap = swap;
+
+		//the per frame data written till now is fenced, next frame writes in another region
+		RingBuffer::EndFrameAll();
+		UniformBuffer::endFrame();
+		GLState::endFrame();
+		Mesh::endFrame();
+		Profiler::endFrame();
 
 		//compute delta time
-		long last_time = now;
-		now = SDL_GetTicks();
-		double elapsed_time = (now - last_time) * 0.001; //0.001 converts from milliseconds to seconds
+		Uint64 last_time = now;
+		now = SDL_GetPerformanceCounter();
+		double elapsed_time = (now - last_time) * ticks_to_ms * 0.001; //0.001 converts from milliseconds to seconds
 		double last_time_seconds = game->time;
-        game->time = float(now * 0.001f);
+        game->time = float((now - start_time) * ticks_to_ms * 0.001);
 		game->elapsed_time = elapsed_time;
 		game->frame++;
 		frames_this_second++;
@@ -251,18 +287,69 @@ void mainLoop(SDL_Window* window)
 			frames_this_second = 0;
 		}
 
-		//update game logic
-		game->update(elapsed_time);
+		//upload the resources loaded in the background, with a time budget
+		ResourceLoader::update();
+
+		//the shaders compiling in the background that are done
+		Shader::UpdateCompiles();
 
-		// Start the Dear ImGui frame
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplSDL2_NewFrame(window);
-		ImGui::NewFrame();
+		//the GL work sent by the jobs
+		JobSystem::updateMainThread();
 
-		//render frame
-		game->render();
+		//free the unused resources if the caches are over budget
+		ResourceCacheBase::UpdateAll();
+
+		if (!Application::pipelined)
+		{
+			//update game logic, in fixed ticks
+			game->gui_wants_mouse = ImGui::IsAnyWindowHovered() || ImGui::IsAnyItemHovered() || ImGui::IsAnyItemActive();
+			game->simulate(elapsed_time);
+
+			// Start the Dear ImGui frame
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplSDL2_NewFrame(window);
+			ImGui::NewFrame();
+
+			//render frame
+			game->snapshots[game->render_snapshot].input_ticks = input_ticks;
+			shown_input_ticks = input_ticks;
+			game->render();
+
+			renderGUI(window, game);
+		}
+		else
+		{
+			//the first frame after switching has nothing prepared, it shows the last update
+			sFrameSnapshot& current = game->snapshots[game->render_snapshot];
+			sFrameSnapshot& next = game->snapshots[1 - game->render_snapshot];
+			if (!current.ready)
+			{
+				current.input_ticks = input_ticks;
+				game->prepareFrame(current);
+			}
 
-		renderGUI(window, game);
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplSDL2_NewFrame(window);
+			ImGui::NewFrame();
+			buildGUI(window, game);
+
+			//the next frame is updated and culled in the jobs while this one is submitted from its snapshot,
+			//the rest of the loop runs when nothing is in the jobs
+			next.input_ticks = input_ticks;
+			game->gui_wants_mouse = ImGui::IsAnyWindowHovered() || ImGui::IsAnyItemHovered() || ImGui::IsAnyItemActive(); //ImGui is used by drawGUI meanwhile
+			sJob* update_job = JobSystem::create([&next, elapsed_time]() {
+				game->simulate(elapsed_time);
+				game->prepareFrame(next);
+			});
+			JobSystem::run(update_job);
+
+			shown_input_ticks = current.input_ticks;
+			game->renderFrame(current);
+			drawGUI();
+
+			JobSystem::wait(update_job);
+			game->render_snapshot = 1 - game->render_snapshot;
+		}
 
 		//check errors in opengl only when working in debug
 		#ifdef _DEBUG
@@ -281,7 +368,30 @@ void mainLoop(SDL_Window* window)
 
 int main(int argc, char **argv)
 {
+	//measure the OBJ parser throughput without opening a window: main -benchobj file.obj
+	if (argc > 2 && strcmp(argv[1], "-benchobj") == 0)
+	{
+		benchmarkOBJ(argv[2]);
+		return 0;
+	}
+
+	//start with the update of the next frame overlapped with the render of the current one: main -pipelined
+	if (argc > 1 && strcmp(argv[1], "-pipelined") == 0)
+		Application::pipelined = true;
+
+	//check the job system and measure how it scales with the cores: main -benchjobs
+	if (argc > 1 && strcmp(argv[1], "-benchjobs") == 0)
+	{
+		JobSystem::benchmark();
+		return 0;
+	}
+
+	//render the scene of the file offscreen along its camera path, non zero exit code if it is slower than the limits: main -bench file.bench
+	if (argc > 2 && strcmp(argv[1], "-bench") == 0)
+		return runBenchmark(argv[2]);
+
 	std::cout << "Initiating game..." << std::endl;
+	Profiler::setThreadName("Main");
 
 	//prepare SDL
 	SDL_Init(SDL_INIT_EVERYTHING);
@@ -315,21 +425,31 @@ int main(int argc, char **argv)
 
 	Input::init(window);
 
+	//the workers start before anything can use them from another thread
+	JobSystem::init();
+
+	//meshes, textures and animations are loaded in the background, Get returns a placeholder
+	ResourceLoader::async = true;
+
 	//launch the game (game is a global variable)
 	game = new Application(window_width, window_height, window);
 
+#ifdef WIN32
 	SDL_SysWMinfo  wmInfo;
 	SDL_VERSION(&wmInfo.version);
 	SDL_GetWindowWMInfo(window, &wmInfo);
 	HWND hwnd = wmInfo.info.win.window;
 
 	dir_watcher_data.start("data/shaders", hwnd);
+#endif
 
 	//main loop, application gets inside here till user closes it
 	mainLoop(window);
 
 	//save state and free memory
 	// Cleanup
+	ResourceLoader::shutdown();
+	JobSystem::shutdown();
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext();
@@ -1,8 +1,68 @@
 #include "material.h"
 #include "texture.h"
 #include "application.h"
+#include "glstate.h"
 #include "extra/hdre.h"
 
+unsigned int Material::s_last_id = 0;
+
+unsigned int Material::getShaderFeatures(bool instanced)
+{
+	unsigned int features = 0;
+	if (texture)
+		features |= SHADER_TEXTURE;
+	if (instanced)
+		features |= SHADER_INSTANCING;
+	if (UniformBuffer::isSupported())
+		features |= SHADER_UBOS;
+	return features;
+}
+
+Shader* Material::getShader(bool instanced)
+{
+	if (!shader)
+		return NULL;
+	unsigned int features = getShaderFeatures(instanced) & shader->features;
+	if (instanced && !(features & SHADER_INSTANCING)) //the shader does not support it
+		return NULL;
+
+	Shader* sh = shader->getPermutation(features, false);
+	if (!sh && (features & SHADER_UBOS)) //the blocks are optional
+		sh = shader->getPermutation(features & ~SHADER_UBOS, false);
+	if (!sh && !instanced)
+		sh = shader;
+	return sh;
+}
+
+Shader* Material::getInstancedShader()
+{
+	Shader* sh = getShader(true);
+	if (!sh || sh->model_attrib_location == -1) //the shader ignores the macro
+		return NULL;
+	return sh;
+}
+
+void Material::precompileShaders()
+{
+	if (!shader)
+		return;
+	shader->requestPermutation(getShaderFeatures(false));
+	if (getBatchKey())
+		shader->requestPermutation(getShaderFeatures(true));
+}
+
+void Material::bindBlock()
+{
+	if (dirty || !block.buffer_id)
+	{
+		sMaterialBlock data;
+		data.color = color;
+		block.upload(&data, sizeof(data));
+		dirty = false;
+	}
+	block.bind(UniformBuffer::MATERIAL_BINDING);
+}
+
 StandardMaterial::StandardMaterial()
 {
 	color = vec4(1.f, 1.f, 1.f, 1.f);
@@ -14,43 +74,80 @@ StandardMaterial::~StandardMaterial()
 
 }
 
+//the shader must be enabled, the one returned by getShader
 void StandardMaterial::setUniforms(Camera* camera, Matrix44 model)
 {
-	//upload node uniforms
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shader->setUniform("u_camera_position", camera->eye);
-	shader->setUniform("u_model", model);
-	shader->setUniform("u_time", Application::instance->time);
-	shader->setUniform("u_output", Application::instance->output);
+	Shader* sh = Shader::current;
+	assert(sh);
 
-	shader->setUniform("u_color", color);
-	shader->setUniform("u_exposure", Application::instance->scene_exposure);
+	//upload node uniforms
+	setSharedUniforms(sh, camera);
+	sh->setUniform("u_model"_u, model);
+	if (sh->num_uniform_blocks)
+		bindBlock();
+	else
+		sh->setUniform("u_color"_u, color);
+}
 
+void StandardMaterial::setSharedUniforms(Shader* sh, Camera* camera)
+{
 	if (texture)
-		shader->setUniform("u_texture", texture);
+		sh->setUniform("u_texture"_u, texture);
+
+	//with blocks only the model and the textures are set per draw
+	if (sh->num_uniform_blocks)
+	{
+		UniformBuffer::setFrameUniforms(camera);
+		return;
+	}
+
+	sh->setUniform("u_viewprojection"_u, camera->viewprojection_matrix);
+	sh->setUniform("u_camera_position"_u, camera->eye);
+	sh->setUniform("u_time"_u, Application::instance->time);
+	sh->setUniform("u_output"_u, (float)Application::instance->output);
+	sh->setUniform("u_exposure"_u, Application::instance->scene_exposure);
 }
 
-void StandardMaterial::render(Mesh* mesh, Matrix44 model, Camera* camera)
+void StandardMaterial::render(Mesh* mesh, Matrix44 model, Camera* camera, int lod)
 {
-	if (mesh && shader)
+	Shader* sh = getShader();
+	if (mesh && sh)
 	{
 		//enable shader
-		shader->enable();
+		sh->enable();
 
 		//upload uniforms
 		setUniforms(camera, model);
+		GLState::setCapability(GL_CULL_FACE, !two_sided);
 
-		//do the draw call
-		mesh->render(GL_TRIANGLES);
+		//do the draw call, only the visible clusters (backfacing ones too when drawing both faces)
+		//the simplified lods are not split in clusters, they are already cheap
+		if (lod)
+			mesh->render(GL_TRIANGLES, 0, 0, lod);
+		else
+			mesh->renderClusters(GL_TRIANGLES, model, camera, GLState::isEnabled(GL_CULL_FACE));
 
-		//disable shader
-		shader->disable();
+		//the shader is left enabled, consecutive draws with the same one do not switch (see RenderQueue)
 	}
 }
 
+void StandardMaterial::renderInstanced(Mesh* mesh, Camera* camera, unsigned int instances_buffer_id, size_t models_offset, size_t colors_offset, int num_instances, int lod)
+{
+	Shader* instanced_shader = getInstancedShader();
+	if (!mesh || !instanced_shader)
+		return;
+
+	instanced_shader->enable();
+	setSharedUniforms(instanced_shader, camera);
+	GLState::setCapability(GL_CULL_FACE, !two_sided);
+	mesh->renderInstanced(GL_TRIANGLES, instances_buffer_id, models_offset, num_instances, colors_offset, lod);
+}
+
 void StandardMaterial::renderInMenu()
 {
-	ImGui::ColorEdit3("Color", (float*)&color); // Edit 3 floats representing a color
+	if (ImGui::ColorEdit3("Color", (float*)&color)) // Edit 3 floats representing a color
+		markDirty();
+	ImGui::Checkbox("Two sided", &two_sided);
 }
 
 WireframeMaterial::WireframeMaterial()
@@ -64,21 +161,30 @@ WireframeMaterial::~WireframeMaterial()
 
 }
 
-void WireframeMaterial::render(Mesh* mesh, Matrix44 model, Camera * camera)
+WireframeMaterial* WireframeMaterial::getDefault()
+{
+	static WireframeMaterial* material = NULL;
+	if (!material)
+		material = new WireframeMaterial();
+	return material;
+}
+
+void WireframeMaterial::render(Mesh* mesh, Matrix44 model, Camera * camera, int lod)
 {
-	if (shader && mesh)
+	Shader* sh = getShader();
+	if (sh && mesh)
 	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		GLState::polygonMode(GL_LINE);
 
 		//enable shader
-		shader->enable();
+		sh->enable();
 
 		//upload material specific uniforms
 		setUniforms(camera, model);
 
 		//do the draw call
-		mesh->render(GL_TRIANGLES);
+		mesh->render(GL_TRIANGLES, 0, 0, lod);
 
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		GLState::polygonMode(GL_FILL);
 	}
 }
\ No newline at end of file
@@ -5,18 +5,41 @@
 #include "shader.h"
 #include "camera.h"
 #include "mesh.h"
+#include "uniformbuffer.h"
 #include "extra/hdre.h"
 
 class Material {
 public:
+	static unsigned int s_last_id;
 
-	Shader* shader = NULL;
-	Texture* texture = NULL;
+	ResourceHandle<Shader> shader;
+	ResourceHandle<Texture> texture;
 	vec4 color;
+	bool transparent = false; //drawn after the opaque ones, back to front and with blending (see RenderQueue)
+	bool two_sided = false; //without face culling, the clusters facing away are drawn too
+	unsigned int id = ++s_last_id; //to sort the draws
+
+	//the parameters in the MaterialBlock of the shaders, uploaded only when dirty, so after changing color call markDirty
+	UniformBuffer block;
+	bool dirty = true;
+	void markDirty() { dirty = true; }
+	void setColor(const vec4& color) { this->color = color; dirty = true; }
+	void bindBlock(); //uploads it if dirty
 
 	virtual void setUniforms(Camera* camera, Matrix44 model) = 0;
-	virtual void render(Mesh* mesh, Matrix44 model, Camera * camera) = 0;
+	virtual void render(Mesh* mesh, Matrix44 model, Camera * camera, int lod = 0) = 0;
 	virtual void renderInMenu() = 0;
+
+	//materials with the same key, shader and texture can be drawn together in one instanced call (the color goes per instance), 0 if it cannot be instanced
+	virtual unsigned int getBatchKey() { return 0; }
+	//the matrices and colors are in instances_buffer_id, see InstanceBatcher
+	virtual void renderInstanced(Mesh* mesh, Camera* camera, unsigned int instances_buffer_id, size_t models_offset, size_t colors_offset, int num_instances, int lod = 0) {}
+	//the permutation of the shader for the features of the material (see eShaderFeature), while it compiles one with less
+	//features is used, instanced draws need the USE_INSTANCING one so it is NULL till it is ready
+	virtual unsigned int getShaderFeatures(bool instanced);
+	Shader* getShader(bool instanced = false);
+	Shader* getInstancedShader(); //NULL if the shader does not support instancing (or it is still compiling)
+	void precompileShaders(); //starts compiling the permutations it will use
 };
 
 class StandardMaterial : public Material {
@@ -26,8 +49,14 @@ public:
 	~StandardMaterial();
 
 	void setUniforms(Camera* camera, Matrix44 model);
-	void render(Mesh* mesh, Matrix44 model, Camera * camera);
+	void render(Mesh* mesh, Matrix44 model, Camera * camera, int lod = 0);
 	void renderInMenu();
+
+	unsigned int getBatchKey() { return 1; }
+	void renderInstanced(Mesh* mesh, Camera* camera, unsigned int instances_buffer_id, size_t models_offset, size_t colors_offset, int num_instances, int lod = 0);
+
+protected:
+	void setSharedUniforms(Shader* sh, Camera* camera); //all but the ones of every instance (model and color)
 };
 
 class WireframeMaterial : public StandardMaterial {
@@ -36,7 +65,11 @@ public:
 	WireframeMaterial();
 	~WireframeMaterial();
 
-	void render(Mesh* mesh, Matrix44 model, Camera * camera);
+	static WireframeMaterial* getDefault(); //shared by the debug draws, so its buffer is not created every time
+
+	void render(Mesh* mesh, Matrix44 model, Camera * camera, int lod = 0);
+
+	unsigned int getBatchKey() { return 0; }
 };
 
 #endif
\ No newline at end of file
@@ -8,19 +8,41 @@
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <cstddef>
 #include <sys/stat.h>
 
 #include "camera.h"
 #include "texture.h"
 #include "animation.h"
 #include "extra/coldet/coldet.h"
-
-std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
+#include "extra/objparser.h"
+#include "extra/meshopt.h"
+#include "resourceloader.h"
+#include "ringbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+
+ResourceCache<Mesh> Mesh::sMeshesLoaded("Meshes", 512 * 1024 * 1024, 512 * 1024 * 1024);
 bool Mesh::use_binary = true;
 bool Mesh::auto_upload_to_vram = true;
 bool Mesh::interleave_meshes = true;
+bool Mesh::weld_meshes = true;
+bool Mesh::map_binary_meshes = true;
+bool Mesh::quantize_meshes = true;
+bool Mesh::optimize_meshes = true;
+bool Mesh::cluster_meshes = true;
+bool Mesh::generate_lods = true;
+float Mesh::lod_error_pixels = 1.0f;
+float Mesh::lod_hysteresis = 0.2f;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
+long Mesh::num_clusters_culled = 0;
+long Mesh::num_meshes_rendered_last_frame = 0;
+long Mesh::num_triangles_rendered_last_frame = 0;
+long Mesh::num_clusters_culled_last_frame = 0;
+bool Mesh::use_vaos = true;
+int Mesh::max_vaos = 8;
+bool Mesh::use_indirect_draw = true;
 
 #define FORMAT_ASE 1
 #define FORMAT_OBJ 2
@@ -31,7 +53,16 @@ Mesh::Mesh()
 {
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	indices_vbo_type = GL_UNSIGNED_INT;
 	collision_model = NULL;
+	mapped_file = NULL;
+	bin_version = 0;
+	is_optimized = false;
+	lods_generated = false;
+	quantization.vertex_offset.set(0, 0, 0);
+	quantization.vertex_scale.set(1, 1, 1);
+	quantization.uv_offset.set(0, 0);
+	quantization.uv_scale.set(1, 1);
 	clear();
 }
 
@@ -41,25 +72,28 @@ Mesh::~Mesh()
 }
 
 
+//the state cache has to forget it, GL unbinds it
+static void deleteBuffer(GLuint id)
+{
+	if (!id)
+		return;
+	GLState::forgetBuffer(id);
+	glDeleteBuffersARB(1, &id);
+}
+
 void Mesh::clear()
 {
+	releaseVAOs();
+
 	//Free VBOs
-	if (vertices_vbo_id) 
-		glDeleteBuffersARB(1,&vertices_vbo_id);
-	if (uvs_vbo_id)
-		glDeleteBuffersARB(1,&uvs_vbo_id);
-	if (normals_vbo_id) 
-		glDeleteBuffersARB(1,&normals_vbo_id);
-	if (colors_vbo_id) 
-		glDeleteBuffersARB(1,&colors_vbo_id);
-	if (interleaved_vbo_id)
-		glDeleteBuffersARB(1, &interleaved_vbo_id);
-	if (indices_vbo_id)
-		glDeleteBuffersARB(1, &indices_vbo_id);
-	if (bones_vbo_id)
-		glDeleteBuffersARB(1, &bones_vbo_id);
-	if (weights_vbo_id)
-		glDeleteBuffersARB(1, &weights_vbo_id);
+	deleteBuffer(vertices_vbo_id);
+	deleteBuffer(uvs_vbo_id);
+	deleteBuffer(normals_vbo_id);
+	deleteBuffer(colors_vbo_id);
+	deleteBuffer(interleaved_vbo_id);
+	deleteBuffer(indices_vbo_id);
+	deleteBuffer(bones_vbo_id);
+	deleteBuffer(weights_vbo_id);
 
 	//VBOs ids
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = 0;
@@ -70,10 +104,18 @@ void Mesh::clear()
 	uvs.clear();
 	colors.clear();
 	interleaved.clear();
+	quantized.clear();
 	indices.clear();
+	clusters.clear();
+	lods.clear();
+	lod_indices.clear();
 	bones.clear();
 	weights.clear();
 
+	if (mapped_file)
+		delete mapped_file;
+	mapped_file = NULL;
+
 	if (collision_model)
 		delete collision_model;
 }
@@ -93,11 +135,14 @@ void Mesh::enableBuffers(Shader* sh)
 	if (vertex_location == -1)
 		return;
 
+	//client side pointers when not in VRAM (vectors or mapped file)
+	sStreams s = getStreams();
+
 	int spacing = 0;
 	int offset_normal = 0;
 	int offset_uv = 0;
 
-	if (interleaved.size())
+	if (s.interleaved)
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(Vector3);
@@ -106,50 +151,78 @@ void Mesh::enableBuffers(Shader* sh)
 
 	glEnableVertexAttribArray(vertex_location);
 
-	if (vertices_vbo_id || interleaved_vbo_id)
+	if (s.quantized)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
-	}
-	else
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
+		//normalized attributes, the shader applies the quantization uniforms
+		const char* base = NULL;
+		if (interleaved_vbo_id)
+			GLState::bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id);
+		else
+			base = (const char*)s.quantized;
+
+		glVertexAttribPointer(vertex_location, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(tQuantized), base);
 
-	normal_location = -1;
-	if (normals.size() || spacing)
-	{
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
 		{
 			glEnableVertexAttribArray(normal_location);
-			if (normals_vbo_id || interleaved_vbo_id)
-			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
-			}
-			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+			glVertexAttribPointer(normal_location, 2, GL_SHORT, GL_TRUE, sizeof(tQuantized), base + offsetof(tQuantized, normal));
 		}
-	}
 
-	uv_location = -1;
-	if (uvs.size() || spacing)
-	{
 		uv_location = sh->getAttribLocation("a_uv");
 		if (uv_location != -1)
 		{
 			glEnableVertexAttribArray(uv_location);
-			if (uvs_vbo_id || interleaved_vbo_id)
+			glVertexAttribPointer(uv_location, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(tQuantized), base + offsetof(tQuantized, uv));
+		}
+	}
+	else
+	{
+		if (vertices_vbo_id || interleaved_vbo_id)
+		{
+			GLState::bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
+			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+		}
+		else
+			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, s.interleaved ? (const void*)&s.interleaved[0].vertex : s.vertices);
+
+		normal_location = -1;
+		if (s.normals || spacing)
+		{
+			normal_location = sh->getAttribLocation("a_normal");
+			if (normal_location != -1)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glEnableVertexAttribArray(normal_location);
+				if (normals_vbo_id || interleaved_vbo_id)
+				{
+					GLState::bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				}
+				else
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, s.interleaved ? (const void*)&s.interleaved[0].normal : s.normals);
+			}
+		}
+
+		uv_location = -1;
+		if (s.uvs || spacing)
+		{
+			uv_location = sh->getAttribLocation("a_uv");
+			if (uv_location != -1)
+			{
+				glEnableVertexAttribArray(uv_location);
+				if (uvs_vbo_id || interleaved_vbo_id)
+				{
+					GLState::bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				}
+				else
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, s.interleaved ? (const void*)&s.interleaved[0].uv : s.uvs);
 			}
-			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
 		}
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (s.colors)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -157,16 +230,16 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(color_location);
 			if (colors_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
+				GLState::bindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
 				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
+				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, s.colors);
 		}
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (s.bones)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -174,15 +247,15 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(bones_location);
 			if (bones_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, bones_vbo_id);
+				GLState::bindBuffer(GL_ARRAY_BUFFER, bones_vbo_id);
 				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, &bones[0]);
+				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, s.bones);
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (s.weights)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -190,19 +263,108 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(weights_location);
 			if (weights_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
+				GLState::bindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
+				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, s.weights);
 		}
 	}
 
-	assert(glGetError() == GL_NO_ERROR);
+	setQuantizationUniforms(sh);
+
+	GL_CHECK();
+
+}
+
+//decoding of quantized vertices, identity when not quantized
+void Mesh::setQuantizationUniforms(Shader* shader)
+{
+	if (getStreams().quantized)
+	{
+		shader->setUniform("u_vertex_offset"_u, quantization.vertex_offset);
+		shader->setUniform("u_vertex_scale"_u, quantization.vertex_scale);
+		shader->setUniform("u_uv_transform"_u, Vector4(quantization.uv_offset.x, quantization.uv_offset.y, quantization.uv_scale.x, quantization.uv_scale.y));
+		shader->setUniform("u_oct_normals"_u, 1.0f);
+	}
+	else
+	{
+		shader->setUniform("u_vertex_offset"_u, Vector3(0.0f, 0.0f, 0.0f));
+		shader->setUniform("u_vertex_scale"_u, Vector3(1.0f, 1.0f, 1.0f));
+		shader->setUniform("u_uv_transform"_u, Vector4(0.0f, 0.0f, 1.0f, 1.0f));
+		shader->setUniform("u_oct_normals"_u, 0.0f);
+	}
+}
+
+static GLuint bound_vao = 0; //while bound the element buffer must not be unbound, it is part of the vao
+
+//core since 3.0, checked once because it needs a context
+static bool isVAOSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		const char* version = (const char*)glGetString(GL_VERSION);
+		supported = (version && atoi(version) >= 3) || isGLExtensionSupported("GL_ARB_vertex_array_object") ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+bool Mesh::bindVAO(Shader* shader)
+{
+	if (!use_vaos || (!vertices_vbo_id && !interleaved_vbo_id) || !isVAOSupported())
+		return false;
+
+	for (size_t i = 0; i < vaos.size(); ++i)
+	{
+		if (vaos[i].shader_uid != shader->uid)
+			continue;
+		if (i) //move to the front
+			std::rotate(vaos.begin(), vaos.begin() + i, vaos.begin() + i + 1);
+		bound_vao = vaos[0].id;
+		GLState::bindVertexArray(bound_vao);
+		setQuantizationUniforms(shader);
+		return true;
+	}
+
+	if ((int)vaos.size() >= max_vaos)
+	{
+		GLState::forgetVertexArray(vaos.back().id);
+		glDeleteVertexArrays(1, &vaos.back().id);
+		vaos.pop_back();
+	}
+
+	sVAO vao;
+	vao.shader_uid = shader->uid;
+	glGenVertexArrays(1, &vao.id);
+	GLState::bindVertexArray(vao.id);
+	enableBuffers(shader); //the attributes are recorded in the vao
+	if (indices_vbo_id)
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0); //not part of the vao
+	vaos.insert(vaos.begin(), vao);
+	bound_vao = vao.id;
+	GL_CHECK();
+	return true;
+}
+
+void Mesh::unbindVAO()
+{
+	GLState::bindVertexArray(0);
+	bound_vao = 0;
+}
 
+void Mesh::releaseVAOs()
+{
+	for (size_t i = 0; i < vaos.size(); ++i)
+	{
+		GLState::forgetVertexArray(vaos[i].id);
+		glDeleteVertexArrays(1, &vaos[i].id);
+	}
+	vaos.clear();
 }
 
-void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::render(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
 	Shader* shader = Shader::current;
 	if (!shader || !shader->compiled)
@@ -210,56 +372,76 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
+
+	//the instanced attributes are set by the caller outside any vao, so those use the regular path
+	if (num_instances == 0 && bindVAO(shader))
+	{
+		drawCall(primitive, submesh_id, num_instances, lod);
+		unbindVAO();
+		return;
+	}
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
 
 	//draw call
-	drawCall(primitive, submesh_id, num_instances);
+	drawCall(primitive, submesh_id, num_instances, lod);
 
 	//unbind them
 	disableBuffers(shader);
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
+	//start and size are in vertices, or in indices if the mesh is indexed
 	int start = 0;
-	int size = vertices.size();
-	if (indices.size())
-		size = indices.size();
-	else if (interleaved.size())
-		size = interleaved.size();
+	int size = isIndexed() ? getNumTriangles() * 3 : getNumVertices();
+	bool use_lod = lod > 0 && lod <= (int)lods.size() && isIndexed();
 
-	if (submesh_id > 0)
+	if (use_lod) //lods go after the mesh in the index buffer, the submeshes are not kept
+	{
+		start = (getNumTriangles() + lods[lod - 1].start) * 3;
+		size = lods[lod - 1].count * 3;
+	}
+	else if (submesh_id > 0 && submesh_id <= (int)material_range.size())
 	{
-		submesh_id -= 1;
-		start = submesh_id == 0 ? 0 : material_range[submesh_id - 1] * 3;
-		if (!material_range.empty())
-			size = material_range[submesh_id] * 3 - start;
+		unsigned int first, count;
+		getSubmeshRange(submesh_id - 1, first, count);
+		start = first * 3;
+		size = count * 3;
 	}
 
 	//DRAW
-	if (indices.size())
+	if (isIndexed())
 	{
-		if (num_instances > 0)
+		unsigned int index_type = indices_vbo_type;
+		const char* offset = NULL; //in VRAM is an offset, otherwise a pointer
+		if (indices_vbo_id)
 		{
-			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3)), num_instances);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			if (!bound_vao)
+				GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
 		}
 		else
 		{
-			if (indices_vbo_id)
+			sStreams s = getStreams();
+			index_type = s.index_type;
+			offset = (const char*)s.indices;
+			if (use_lod) //in their own stream
 			{
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)));
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				offset = (const char*)s.lod_indices;
+				start -= s.num_triangles * 3;
 			}
-			else
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(&indices[0] + start)); //no multiply, its a vector3u pointer)
 		}
+		offset += start * (index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int));
+
+		if (num_instances > 0)
+			glDrawElementsInstanced(primitive, size, index_type, offset, num_instances);
+		else
+			glDrawElements(primitive, size, index_type, offset);
+
+		if (indices_vbo_id && !bound_vao)
+			GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 	else
 	{
@@ -269,12 +451,263 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 			glDrawArrays(primitive, start, size);
 	}
 
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	num_triangles_rendered += (size / 3) * (num_instances ? num_instances : 1);
 	num_meshes_rendered++;
 }
 
+bool Mesh::cullClusters(const Matrix44& model, Camera* camera, sDrawRanges& ranges, bool backface_culling)
+{
+	ranges.counts.clear();
+	ranges.offsets.clear();
+	ranges.num_triangles = 0;
+	if (clusters.empty() || !isIndexed())
+		return false;
+
+	//cones are tested in object space (the sign of a dot with the normal survives the transform), spheres in world space
+	Matrix44 m = model;
+	Matrix44 inv = model;
+	inv.inverse();
+	Vector3 local_eye = inv * camera->eye;
+	float scale = (float)std::max(m.rightVector().length(), std::max(m.topVector().length(), m.frontVector().length()));
+
+	//in VRAM the offsets are offsets, otherwise pointers
+	sStreams s = getStreams();
+	unsigned int index_type = indices_vbo_id ? indices_vbo_type : s.index_type;
+	const char* base = indices_vbo_id ? NULL : (const char*)s.indices;
+	size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+
+	unsigned int range_end = (unsigned int)-1;
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		const sMeshCluster& cluster = clusters[i];
+		if ((backface_culling && isClusterBackfacing(cluster, local_eye)) ||
+			camera->testSphereInFrustum(model * cluster.center, cluster.radius * scale) == CLIP_OUTSIDE)
+		{
+			num_clusters_culled++;
+			continue;
+		}
+
+		if (cluster.start == range_end)
+			ranges.counts.back() += cluster.count * 3;
+		else
+		{
+			ranges.counts.push_back(cluster.count * 3);
+			ranges.offsets.push_back(base + cluster.start * 3 * index_size);
+		}
+		range_end = cluster.start + cluster.count;
+		ranges.num_triangles += cluster.count;
+	}
+
+	return true;
+}
+
+//GL_ARB_multi_draw_indirect, checked once because it needs a context
+static bool isIndirectDrawSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = isGLExtensionSupported("GL_ARB_multi_draw_indirect") ? 1 : 0;
+	return supported == 1;
+}
+
+//layout defined by GL for glMultiDrawElementsIndirect
+struct sDrawElementsIndirectCommand {
+	unsigned int count;
+	unsigned int instance_count;
+	unsigned int first_index;
+	int base_vertex;
+	unsigned int base_instance;
+};
+
+//the commands change every draw, they are streamed like the instance data
+static RingBuffer* getIndirectBuffer()
+{
+	static RingBuffer* buffer = NULL;
+	if (!buffer)
+		buffer = new RingBuffer(64 * 1024, GL_DRAW_INDIRECT_BUFFER);
+	return buffer;
+}
+
+void Mesh::drawRanges(unsigned int primitive, const sDrawRanges& ranges, int num_instances)
+{
+	if (ranges.counts.empty())
+		return;
+
+	unsigned int index_type = indices_vbo_type;
+	if (indices_vbo_id && !bound_vao)
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	else if (!indices_vbo_id)
+		index_type = getStreams().index_type;
+
+	if (indices_vbo_id && use_indirect_draw && ranges.counts.size() > 1 && isIndirectDrawSupported())
+	{
+		//one command per range, in VRAM the offsets are in bytes from the start of the buffer
+		size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+		size_t num_commands = ranges.counts.size();
+		size_t offset = 0;
+		RingBuffer* ring = getIndirectBuffer();
+		sDrawElementsIndirectCommand* commands = (sDrawElementsIndirectCommand*)ring->map(num_commands * sizeof(sDrawElementsIndirectCommand), offset);
+		for (size_t i = 0; i < num_commands; ++i)
+		{
+			sDrawElementsIndirectCommand& command = commands[i];
+			command.count = ranges.counts[i];
+			command.instance_count = num_instances > 0 ? num_instances : 1;
+			command.first_index = (unsigned int)((size_t)ranges.offsets[i] / index_size);
+			command.base_vertex = 0;
+			command.base_instance = 0;
+		}
+		ring->unmap(); //left bound to GL_DRAW_INDIRECT_BUFFER
+		glMultiDrawElementsIndirect(primitive, index_type, (void*)offset, (GLsizei)num_commands, 0);
+		GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else if (num_instances > 0) //there is no instanced glMultiDrawElements
+	{
+		for (size_t i = 0; i < ranges.counts.size(); ++i)
+			glDrawElementsInstanced(primitive, ranges.counts[i], index_type, ranges.offsets[i], num_instances);
+	}
+	else if (ranges.counts.size() == 1)
+		glDrawElements(primitive, ranges.counts[0], index_type, ranges.offsets[0]);
+	else
+		glMultiDrawElements(primitive, &ranges.counts[0], index_type, &ranges.offsets[0], (GLsizei)ranges.counts.size());
+
+	if (indices_vbo_id && !bound_vao)
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	GL_CHECK();
+
+	num_triangles_rendered += ranges.num_triangles * (num_instances ? num_instances : 1);
+	num_meshes_rendered++;
+}
+
+void Mesh::renderClusters(unsigned int primitive, const Matrix44& model, Camera* camera, bool backface_culling)
+{
+	static sDrawRanges ranges; //reused every call to avoid allocations
+
+	if (!cullClusters(model, camera, ranges, backface_culling))
+	{
+		render(primitive);
+		return;
+	}
+	if (ranges.counts.empty()) //nothing visible
+		return;
+
+	Shader* shader = Shader::current;
+	if (!shader || !shader->compiled)
+	{
+		assert(0 && "no shader or shader not compiled or enabled");
+		return;
+	}
+
+	if (bindVAO(shader))
+	{
+		drawRanges(primitive, ranges);
+		unbindVAO();
+		return;
+	}
+
+	enableBuffers(shader);
+	drawRanges(primitive, ranges);
+	disableBuffers(shader);
+}
+
+void Mesh::renderSubmeshes(unsigned int primitive, const std::vector<int>& submeshes, int num_instances)
+{
+	if (submeshes.empty())
+		return;
+
+	Shader* shader = Shader::current;
+	if (!shader || !shader->compiled)
+	{
+		assert(0 && "no shader or shader not compiled or enabled");
+		return;
+	}
+
+	//nothing to merge, one call per submesh
+	if (material_range.empty() || !isIndexed())
+	{
+		if (material_range.empty())
+			render(primitive, 0, num_instances);
+		else
+			for (size_t i = 0; i < submeshes.size(); ++i)
+				render(primitive, submeshes[i] + 1, num_instances);
+		return;
+	}
+
+	static sDrawRanges ranges; //reused every call to avoid allocations
+	ranges.counts.clear();
+	ranges.offsets.clear();
+	ranges.num_triangles = 0;
+
+	//in VRAM the offsets are offsets, otherwise pointers
+	sStreams s = getStreams();
+	unsigned int index_type = indices_vbo_id ? indices_vbo_type : s.index_type;
+	const char* base = indices_vbo_id ? NULL : (const char*)s.indices;
+	size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+
+	unsigned int range_end = (unsigned int)-1;
+	for (size_t i = 0; i < submeshes.size(); ++i)
+	{
+		unsigned int start, count;
+		getSubmeshRange(submeshes[i], start, count);
+		if (!count)
+			continue;
+		if (start == range_end)
+			ranges.counts.back() += count * 3;
+		else
+		{
+			ranges.counts.push_back(count * 3);
+			ranges.offsets.push_back(base + start * 3 * index_size);
+		}
+		range_end = start + count;
+		ranges.num_triangles += count;
+	}
+	if (ranges.counts.empty())
+		return;
+
+	if (num_instances == 0 && bindVAO(shader))
+	{
+		drawRanges(primitive, ranges);
+		unbindVAO();
+		return;
+	}
+
+	enableBuffers(shader);
+	drawRanges(primitive, ranges, num_instances);
+	disableBuffers(shader);
+}
+
+void Mesh::renderSubmeshes(unsigned int primitive, int material_id, int num_instances)
+{
+	if (material_range.empty()) //the whole mesh is one submesh
+	{
+		if (material_id == 0)
+			render(primitive, 0, num_instances);
+		return;
+	}
+
+	static std::vector<int> submeshes;
+	getSubmeshesOfMaterial(material_id, submeshes);
+	renderSubmeshes(primitive, submeshes, num_instances);
+}
+
+void Mesh::getSubmeshRange(int submesh, unsigned int& start, unsigned int& count)
+{
+	assert(submesh >= 0 && submesh < (int)material_range.size());
+	start = submesh == 0 ? 0 : material_range[submesh - 1];
+	count = material_range[submesh] - start;
+}
+
+//when the materials are not known every submesh has its own
+void Mesh::getSubmeshesOfMaterial(int material_id, std::vector<int>& submeshes)
+{
+	submeshes.clear();
+	for (size_t i = 0; i < material_range.size(); ++i)
+		if ((i < submesh_material.size() ? submesh_material[i] : (int)i) == material_id)
+			submeshes.push_back((int)i);
+}
+
 void Mesh::disableBuffers(Shader* shader)
 {
 	glDisableVertexAttribArray(vertex_location);
@@ -283,14 +716,27 @@ void Mesh::disableBuffers(Shader* shader)
 	if (color_location != -1) glDisableVertexAttribArray(color_location);
 	if (bones_location != -1) glDisableVertexAttribArray(bones_location);
 	if (weights_location != -1) glDisableVertexAttribArray(weights_location);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
-	assert(glGetError() == GL_NO_ERROR);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
+	GL_CHECK();
 }
 
-GLuint instances_buffer_id = 0;
-
 //should be faster but in some system it is slower
 void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
+{
+	if (!num_instances)
+		return;
+
+	//copied to the ring buffer of this frame, to avoid the copy write straight into it and use the other renderInstanced
+	RingBuffer* ring = RingBuffer::getDefault();
+	size_t offset = 0;
+	void* data = ring->map(num_instances * sizeof(Matrix44), offset);
+	memcpy(data, instanced_models, num_instances * sizeof(Matrix44));
+	ring->unmap();
+
+	renderInstanced(primitive, ring->buffer_id, offset, num_instances);
+}
+
+void Mesh::renderInstanced(unsigned int primitive, unsigned int instances_buffer_id, size_t models_offset, int num_instances, size_t colors_offset, int lod)
 {
 	if (!num_instances)
 		return;
@@ -298,28 +744,41 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
-
-	int attribLocation = shader->getAttribLocation("u_model");
+	int attribLocation = shader->model_attrib_location;
 	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
 	if (attribLocation == -1)
 		return; //this shader doesnt support instanced model
 
+	GLState::bindBuffer(GL_ARRAY_BUFFER, instances_buffer_id);
+
 	//mat4 count as 4 different attributes of vec4... (thanks opengl...)
 	for (int k = 0; k < 4; ++k)
 	{
 		glEnableVertexAttribArray(attribLocation + k );
-		int offset = sizeof(float) * 4 * k;
-		const Uint8* addr = (Uint8*) offset;
+		const Uint8* addr = (Uint8*)(models_offset + sizeof(float) * 4 * k);
 		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr); 
 		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 	}
 
+	//a vec4 per instance, white if not given
+	int colorLocation = shader->instance_color_attrib_location;
+	if (colorLocation != -1)
+	{
+		if (colors_offset != (size_t)-1)
+		{
+			glEnableVertexAttribArray(colorLocation);
+			glVertexAttribPointer(colorLocation, 4, GL_FLOAT, false, sizeof(Vector4), (Uint8*)colors_offset);
+			glVertexAttribDivisor(colorLocation, 1);
+		}
+		else
+			glVertexAttrib4f(colorLocation, 1.0f, 1.0f, 1.0f, 1.0f);
+	}
+
+	//unbound so the meshes not in VRAM can use client pointers
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+
 	//regular render
-	render(primitive, 0, num_instances);
+	render(primitive, 0, num_instances, lod);
 
 	//disable instanced attribs
 	for (int k = 0; k < 4; ++k)
@@ -327,14 +786,21 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 		glDisableVertexAttribArray(attribLocation + k);
 		glVertexAttribDivisor(attribLocation + k, 0);
 	}
+	if (colorLocation != -1 && colors_offset != (size_t)-1)
+	{
+		glDisableVertexAttribArray(colorLocation);
+		glVertexAttribDivisor(colorLocation, 0);
+	}
 }
 
 //super obsolete rendering method, do not use
 void Mesh::renderFixedPipeline(int primitive)
 {
-	assert((vertices.size() || interleaved.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
-	int interleave_offset = interleaved.size() ? sizeof(tInterleaved) : 0;
+	sStreams s = getStreams();
+	assert(!s.quantized && "quantized meshes need a shader to decode them");
+	int interleave_offset = s.interleaved ? sizeof(tInterleaved) : 0;
 	int offset_normal = sizeof(Vector3);
 	int offset_uv = sizeof(Vector3) + sizeof(Vector3);
 
@@ -342,68 +808,77 @@ void Mesh::renderFixedPipeline(int primitive)
 
 	if (vertices_vbo_id || interleaved_vbo_id)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, interleave_offset ? interleaved_vbo_id : vertices_vbo_id);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, interleave_offset ? interleaved_vbo_id : vertices_vbo_id);
 		glVertexPointer(3, GL_FLOAT, interleave_offset, 0);
 	}
 	else
-		glVertexPointer(3, GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].vertex : &vertices[0]);
+		glVertexPointer(3, GL_FLOAT, interleave_offset, interleave_offset ? (const void*)&s.interleaved[0].vertex : s.vertices);
 
-	if (normals.size() || interleave_offset)
+	if (s.normals || interleave_offset)
 	{
 		glEnableClientState(GL_NORMAL_ARRAY);
 		if (normals_vbo_id || interleaved_vbo_id)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
 			glNormalPointer(GL_FLOAT, interleave_offset, (void*)offset_normal);
 		}
 		else
-			glNormalPointer(GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].normal : &normals[0]);
+			glNormalPointer(GL_FLOAT, interleave_offset, interleave_offset ? (const void*)&s.interleaved[0].normal : s.normals);
 	}
 
-	if (uvs.size() || interleave_offset)
+	if (s.uvs || interleave_offset)
 	{
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 		if (uvs_vbo_id || interleaved_vbo_id)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
 			glTexCoordPointer(2, GL_FLOAT, interleave_offset, (void*)offset_uv);
 		}
 		else
-			glTexCoordPointer(2, GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].uv : &uvs[0]);
+			glTexCoordPointer(2, GL_FLOAT, interleave_offset, interleave_offset ? (const void*)&s.interleaved[0].uv : s.uvs);
 	}
 
-	if (colors.size())
+	if (s.colors)
 	{
 		glEnableClientState(GL_COLOR_ARRAY);
 		if (colors_vbo_id)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
+			GLState::bindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
 			glColorPointer(4, GL_FLOAT, 0, NULL);
 		}
 		else
-			glColorPointer(4, GL_FLOAT, 0, &colors[0]);
+			glColorPointer(4, GL_FLOAT, 0, s.colors);
 	}
 
-	int size = vertices.size();
-	if (!size)
-		size = interleaved.size();
+	if (s.indices)
+	{
+		if (indices_vbo_id)
+		{
+			GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			glDrawElements(primitive, s.num_triangles * 3, indices_vbo_type, NULL);
+			GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		else
+			glDrawElements(primitive, s.num_triangles * 3, s.index_type, s.indices);
+	}
+	else
+		glDrawArrays(primitive, 0, (GLsizei)s.num_vertices);
 
-	glDrawArrays(primitive, 0, (GLsizei)size);
 	glDisableClientState(GL_VERTEX_ARRAY);
-	if (normals.size())
+	if (s.normals || interleave_offset)
 		glDisableClientState(GL_NORMAL_ARRAY);
-	if (uvs.size())
+	if (s.uvs || interleave_offset)
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	if (colors.size())
+	if (s.colors)
 		glDisableClientState(GL_COLOR_ARRAY);
-	glBindBuffer(GL_ARRAY_BUFFER, 0); //if it crashes, comment this line
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0); //if it crashes, comment this line
 }
 
 void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 {
 	Shader* shader = Shader::current;
 	std::vector<Matrix44> bone_matrices;
-	assert(bones.size());
+	assert(getStreams().bones);
 	int bones_loc = shader->getUniformLocation("u_bones");
 	if (bones_loc != -1)
 	{
@@ -414,9 +889,24 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 	render(primitive);
 }
 
+//fills part of the bound GL_ELEMENT_ARRAY_BUFFER converting 32 bits indices to 16 bits if needed
+static void uploadIndices(size_t offset, const void* indices, unsigned int index_type, unsigned int num, unsigned int vbo_type)
+{
+	if (index_type == GL_UNSIGNED_INT && vbo_type == GL_UNSIGNED_SHORT)
+	{
+		std::vector<unsigned short> indices16(num);
+		const unsigned int* src = (const unsigned int*)indices;
+		for (size_t i = 0; i < indices16.size(); ++i)
+			indices16[i] = (unsigned short)src[i];
+		glBufferSubDataARB(GL_ELEMENT_ARRAY_BUFFER, offset, num * sizeof(unsigned short), &indices16[0]);
+	}
+	else
+		glBufferSubDataARB(GL_ELEMENT_ARRAY_BUFFER, offset, num * (index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int)), indices);
+}
+
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	assert(getNumVertices());
 
 	if (glGenBuffersARB == 0)
 	{
@@ -424,139 +914,146 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
-	if (interleaved.size())
+	//the vaos point to the old buffers
+	releaseVAOs();
+
+	//from the vectors or straight from the mapped file
+	sStreams s = getStreams();
+
+	if (s.interleaved || s.quantized)
 	{
 		// Vertex,Normal,UV
 		if (interleaved_vbo_id == 0)
 			glGenBuffersARB(1, &interleaved_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
+		if (s.quantized)
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(tQuantized), s.quantized, GL_STATIC_DRAW_ARB);
+		else
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(tInterleaved), s.interleaved, GL_STATIC_DRAW_ARB);
 	}
 	else
 	{
 		// Vertices
 		if (vertices_vbo_id == 0)
 			glGenBuffersARB(1, &vertices_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3), &vertices[0], GL_STATIC_DRAW_ARB);
+		GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(Vector3), s.vertices, GL_STATIC_DRAW_ARB);
 
 		// UVs
-		if (uvs.size())
+		if (s.uvs)
 		{
 			if (uvs_vbo_id == 0)
 				glGenBuffersARB(1, &uvs_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2), &uvs[0], GL_STATIC_DRAW_ARB);
+			GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(Vector2), s.uvs, GL_STATIC_DRAW_ARB);
 		}
 
 		// Normals
-		if (normals.size())
+		if (s.normals)
 		{
 			if (normals_vbo_id == 0)
 				glGenBuffersARB(1, &normals_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3), &normals[0], GL_STATIC_DRAW_ARB);
+			GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(Vector3), s.normals, GL_STATIC_DRAW_ARB);
 		}
 	}
 
 	// Colors
-	if (colors.size())
+	if (s.colors)
 	{
 		if (colors_vbo_id == 0)
 			glGenBuffersARB(1, &colors_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
+		GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(Vector4), s.colors, GL_STATIC_DRAW_ARB);
 	}
 
-	if (bones.size())
+	if (s.bones)
 	{
 		if (bones_vbo_id == 0)
 			glGenBuffersARB(1, &bones_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
+		GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(Vector4ub), s.bones, GL_STATIC_DRAW_ARB);
 	}
-	if (weights.size())
+	if (s.weights)
 	{
 		if (weights_vbo_id == 0)
 			glGenBuffersARB(1, &weights_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4), &weights[0], GL_STATIC_DRAW_ARB);
+		GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, s.num_vertices * sizeof(Vector4), s.weights, GL_STATIC_DRAW_ARB);
 	}
 
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, 0);
 
-	// Indices
-	if (indices.size())
+	// Indices (16 bits when possible, half the memory), the lods go after the mesh in the same buffer
+	if (s.indices)
 	{
 		if (indices_vbo_id == 0)
 			glGenBuffersARB(1, &indices_vbo_id);
-		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Vector3u), &indices[0], GL_STATIC_DRAW_ARB);
+		GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+		unsigned int num_indices = s.num_triangles * 3;
+		unsigned int num_lod_indices = s.lod_indices ? s.num_lod_triangles * 3 : 0;
+		indices_vbo_type = s.index_type == GL_UNSIGNED_SHORT || canUse16BitIndices() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		size_t index_size = indices_vbo_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, (num_indices + num_lod_indices) * index_size, NULL, GL_STATIC_DRAW_ARB);
+		uploadIndices(0, s.indices, s.index_type, num_indices, indices_vbo_type);
+		if (num_lod_indices)
+			uploadIndices(num_indices * index_size, s.lod_indices, s.index_type, num_lod_indices, indices_vbo_type);
 	}
-	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 
 
-	checkGLErrors();
+	GL_CHECK();
 
 	//clear buffers to save memory
 }
 
+//reads an index from a 16 or 32 bits index stream
+static inline unsigned int getIndex(const Mesh::sStreams& s, unsigned int i)
+{
+	return s.index_type == GL_UNSIGNED_SHORT ? ((const unsigned short*)s.indices)[i] : ((const unsigned int*)s.indices)[i];
+}
+
 bool Mesh::createCollisionModel(bool is_static)
 {
 	if (collision_model)
 		return true;
 
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
-
-	if (indices.size()) //indexed
+	sStreams s = getStreams();
+	if (!s.num_vertices)
 	{
-		collision_model->setTriangleNumber(indices.size());
-
-		if (interleaved.size())
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = interleaved[indices[i].x];
-				auto v2 = interleaved[indices[i].y];
-				auto v3 = interleaved[indices[i].z];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = vertices[indices[i].x];
-				auto v2 = vertices[indices[i].y];
-				auto v3 = vertices[indices[i].z];
-				collision_model->addTriangle(v1.v, v2.v, v3.v);
-			}
+		assert(0 && "mesh without vertices, cannot create collision model");
+		return false;
 	}
-	else if (interleaved.size()) //is interleaved
+
+	//positions can be interleaved or not
+	const char* positions = s.interleaved ? (const char*)&s.interleaved[0].vertex : (const char*)s.vertices;
+	size_t stride = s.interleaved ? sizeof(tInterleaved) : sizeof(Vector3);
+
+	//quantized ones must be decoded
+	std::vector<Vector3> decoded;
+	if (s.quantized)
 	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i+=3)
-		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i+1];
-			auto v3 = interleaved[i+2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-		}
+		getPositions(decoded);
+		positions = (const char*)&decoded[0];
+		stride = sizeof(Vector3);
 	}
-	else if (vertices.size()) //non interleaved
+
+	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
+	collision_model->setTriangleNumber(s.num_triangles);
+
+	for (unsigned int i = 0; i < s.num_triangles; ++i)
 	{
-		collision_model->setTriangleNumber(vertices.size() / 3);
-		for (unsigned int i = 0; i < vertices.size(); i+=3)
+		unsigned int a = i * 3, b = i * 3 + 1, c = i * 3 + 2;
+		if (s.indices) //indexed
 		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
+			a = getIndex(s, a);
+			b = getIndex(s, b);
+			c = getIndex(s, c);
 		}
+		collision_model->addTriangle((float*)(positions + stride * a), (float*)(positions + stride * b), (float*)(positions + stride * c));
 	}
-	else
-	{
-		assert(0 && "mesh without vertices, cannot create collision model");
-		return false;
-	}
+
 	collision_model->finalize();
 	this->collision_model = collision_model;
 	return true;
@@ -637,128 +1134,785 @@ bool Mesh::interleaveBuffers()
 		interleaved[i].uv = uvs[i];
 	}
 
-	vertices.resize(0);
-	normals.resize(0);
-	uvs.resize(0);
+	vertices.resize(0);
+	normals.resize(0);
+	uvs.resize(0);
+
+	return true;
+}
+
+//raw view of a per vertex stream, used to hash and compare vertices regardless of their layout
+struct sVertexStream {
+	const char* data;
+	size_t stride;
+};
+
+template<typename T> static void addStream(std::vector<sVertexStream>& streams, std::vector<T>& v)
+{
+	if (v.size())
+		streams.push_back({ (const char*)&v[0], sizeof(T) });
+}
+
+template<typename T> static void compactStream(std::vector<T>& v, const std::vector<unsigned int>& source)
+{
+	if (v.empty())
+		return;
+	std::vector<T> result(source.size());
+	for (size_t i = 0; i < source.size(); ++i)
+		result[i] = v[source[i]];
+	v.swap(result);
+}
+
+bool Mesh::weldVertices()
+{
+	unsigned int num = getNumVertices();
+	if (mapped_file || quantized.size() || indices.size() || num == 0 || (num % 3) != 0)
+		return false;
+
+	std::vector<sVertexStream> streams;
+	if (interleaved.size())
+		addStream(streams, interleaved);
+	else
+	{
+		addStream(streams, vertices);
+		addStream(streams, normals);
+		addStream(streams, uvs);
+	}
+	addStream(streams, colors);
+	addStream(streams, bones);
+	addStream(streams, weights);
+
+	//every stream must have one element per vertex
+	if ((normals.size() && normals.size() != num) || (uvs.size() && uvs.size() != num) || (colors.size() && colors.size() != num) ||
+		(bones.size() && bones.size() != num) || (weights.size() && weights.size() != num))
+		return false;
+
+	//open addressing hash table with the index of the first vertex of every unique tuple
+	size_t table_size = 1;
+	while (table_size < num * 2)
+		table_size <<= 1;
+	std::vector<int> table(table_size, -1);
+	std::vector<unsigned int> remap(num); //old vertex -> new vertex
+	std::vector<unsigned int> source; //new vertex -> old vertex
+	source.reserve(num / 2);
+
+	for (unsigned int i = 0; i < num; ++i)
+	{
+		//FNV-1a of all the attributes
+		unsigned int hash = 2166136261u;
+		for (size_t s = 0; s < streams.size(); ++s)
+		{
+			const unsigned char* bytes = (const unsigned char*)(streams[s].data + streams[s].stride * i);
+			for (size_t k = 0; k < streams[s].stride; ++k)
+				hash = (hash ^ bytes[k]) * 16777619u;
+		}
+
+		size_t slot = hash & (table_size - 1);
+		while (true)
+		{
+			int j = table[slot];
+			if (j == -1)
+			{
+				table[slot] = i;
+				remap[i] = (unsigned int)source.size();
+				source.push_back(i);
+				break;
+			}
+
+			bool equal = true;
+			for (size_t s = 0; s < streams.size() && equal; ++s)
+				equal = memcmp(streams[s].data + streams[s].stride * i, streams[s].data + streams[s].stride * j, streams[s].stride) == 0;
+			if (equal)
+			{
+				remap[i] = remap[j];
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+	}
+
+	indices.resize(num / 3);
+	for (unsigned int i = 0; i < indices.size(); ++i)
+		indices[i].set(remap[i * 3], remap[i * 3 + 1], remap[i * 3 + 2]);
+
+	compactStream(interleaved, source);
+	compactStream(vertices, source);
+	compactStream(normals, source);
+	compactStream(uvs, source);
+	compactStream(colors, source);
+	compactStream(bones, source);
+	compactStream(weights, source);
+
+	return true;
+}
+
+static inline unsigned short toUnorm16(float v)
+{
+	v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	return (unsigned short)(v * 65535.0f + 0.5f);
+}
+
+static inline short toSnorm16(float v)
+{
+	v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+	return (short)(v * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+//projects the unit sphere on an octahedron and unfolds it in a square
+static void encodeOctahedral(const Vector3& n, short* output)
+{
+	float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	if (l1 == 0.0f)
+	{
+		output[0] = output[1] = 0;
+		return;
+	}
+	float x = n.x / l1;
+	float y = n.y / l1;
+	if (n.z < 0.0f)
+	{
+		float ox = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float oy = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = ox;
+		y = oy;
+	}
+	output[0] = toSnorm16(x);
+	output[1] = toSnorm16(y);
+}
+
+bool Mesh::computeQuantized(std::vector<tQuantized>& output, sQuantization& params)
+{
+	sStreams s = getStreams();
+	if (!s.num_vertices || s.quantized || (!s.interleaved && !s.vertices))
+		return false;
+
+	//ranges
+	Vector3 min(1e10f, 1e10f, 1e10f), max(-1e10f, -1e10f, -1e10f);
+	Vector2 uv_min(1e10f, 1e10f), uv_max(-1e10f, -1e10f);
+	for (unsigned int i = 0; i < s.num_vertices; ++i)
+	{
+		min.setMin(s.interleaved ? s.interleaved[i].vertex : s.vertices[i]);
+		max.setMax(s.interleaved ? s.interleaved[i].vertex : s.vertices[i]);
+		if (s.interleaved || s.uvs)
+		{
+			const Vector2& uv = s.interleaved ? s.interleaved[i].uv : s.uvs[i];
+			uv_min.set(std::min(uv_min.x, uv.x), std::min(uv_min.y, uv.y));
+			uv_max.set(std::max(uv_max.x, uv.x), std::max(uv_max.y, uv.y));
+		}
+	}
+	if (uv_min.x > uv_max.x)
+		uv_min = uv_max = Vector2(0, 0);
+
+	params.vertex_offset = min;
+	params.vertex_scale = max - min;
+	params.uv_offset = uv_min;
+	params.uv_scale = uv_max - uv_min;
+
+	Vector3 inv_scale(params.vertex_scale.x ? 1.0f / params.vertex_scale.x : 0.0f, params.vertex_scale.y ? 1.0f / params.vertex_scale.y : 0.0f, params.vertex_scale.z ? 1.0f / params.vertex_scale.z : 0.0f);
+	Vector2 inv_uv_scale(params.uv_scale.x ? 1.0f / params.uv_scale.x : 0.0f, params.uv_scale.y ? 1.0f / params.uv_scale.y : 0.0f);
+
+	output.resize(s.num_vertices);
+	for (unsigned int i = 0; i < s.num_vertices; ++i)
+	{
+		tQuantized& q = output[i];
+		Vector3 v = s.interleaved ? s.interleaved[i].vertex : s.vertices[i];
+		q.vertex[0] = toUnorm16((v.x - min.x) * inv_scale.x);
+		q.vertex[1] = toUnorm16((v.y - min.y) * inv_scale.y);
+		q.vertex[2] = toUnorm16((v.z - min.z) * inv_scale.z);
+		q.vertex[3] = 0;
+
+		if (s.interleaved || s.normals)
+			encodeOctahedral(s.interleaved ? s.interleaved[i].normal : s.normals[i], q.normal);
+		else
+			q.normal[0] = q.normal[1] = 0;
+
+		if (s.interleaved || s.uvs)
+		{
+			Vector2 uv = s.interleaved ? s.interleaved[i].uv : s.uvs[i];
+			q.uv[0] = toUnorm16((uv.x - uv_min.x) * inv_uv_scale.x);
+			q.uv[1] = toUnorm16((uv.y - uv_min.y) * inv_uv_scale.y);
+		}
+		else
+			q.uv[0] = q.uv[1] = 0;
+	}
+
+	return true;
+}
+
+bool Mesh::quantize()
+{
+	unmap();
+	if (!computeQuantized(quantized, quantization))
+		return false;
+
+	interleaved.clear();
+	vertices.clear();
+	normals.clear();
+	uvs.clear();
+	return true;
+}
+
+void Mesh::getPositions(std::vector<Vector3>& positions)
+{
+	sStreams s = getStreams();
+	positions.resize(s.num_vertices);
+	for (unsigned int i = 0; i < s.num_vertices; ++i)
+	{
+		if (s.interleaved)
+			positions[i] = s.interleaved[i].vertex;
+		else if (s.vertices)
+			positions[i] = s.vertices[i];
+		else if (s.quantized)
+		{
+			const unsigned short* v = s.quantized[i].vertex;
+			const Vector3& offset = quantization.vertex_offset;
+			const Vector3& scale = quantization.vertex_scale;
+			positions[i].set(offset.x + v[0] * scale.x / 65535.0f, offset.y + v[1] * scale.y / 65535.0f, offset.z + v[2] * scale.z / 65535.0f);
+		}
+	}
+}
+
+bool Mesh::optimize(sVertexCacheStats* before, sVertexCacheStats* after)
+{
+	unmap();
+	if (indices.empty())
+		return false;
+
+	unsigned int* data = &indices[0].x;
+	size_t num_indices = indices.size() * 3;
+	unsigned int num_vertices = getNumVertices();
+	if (before)
+		*before = analyzeVertexCache(data, num_indices, num_vertices);
+
+	std::vector<Vector3> positions;
+	getPositions(positions);
+
+	//every submesh on its own so the material ranges stay valid
+	unsigned int start = 0;
+	for (size_t i = 0; i <= material_range.size() && start < indices.size(); ++i)
+	{
+		unsigned int end = i < material_range.size() ? std::min((unsigned int)indices.size(), material_range[i]) : (unsigned int)indices.size();
+		if (end <= start)
+			continue;
+		unsigned int* range = data + start * 3;
+		size_t range_indices = (end - start) * 3;
+		optimizeVertexCache(range, range_indices, num_vertices);
+		optimizeOverdraw(range, range_indices, &positions[0], num_vertices);
+		start = end;
+	}
+
+	//clusters change the order, the old ones are not valid anymore
+	clusters.clear();
+	if (cluster_meshes)
+		buildClusters();
+
+	std::vector<unsigned int> source;
+	optimizeVertexFetch(data, num_indices, num_vertices, source);
+
+	//the lods use the same vertices, rename them too
+	if (lod_indices.size())
+	{
+		std::vector<unsigned int> old_to_new(num_vertices, 0);
+		for (size_t i = 0; i < source.size(); ++i)
+			old_to_new[source[i]] = (unsigned int)i;
+		unsigned int* lod_data = &lod_indices[0].x;
+		for (size_t i = 0; i < lod_indices.size() * 3; ++i)
+			lod_data[i] = old_to_new[lod_data[i]];
+	}
+
+	compactStream(interleaved, source);
+	compactStream(quantized, source);
+	compactStream(vertices, source);
+	compactStream(normals, source);
+	compactStream(uvs, source);
+	compactStream(colors, source);
+	compactStream(bones, source);
+	compactStream(weights, source);
+
+	if (after)
+		*after = analyzeVertexCache(data, num_indices, getNumVertices());
+	is_optimized = true;
+	return true;
+}
+
+bool Mesh::generateLODs()
+{
+	unmap();
+	lods.clear();
+	lod_indices.clear();
+	if (indices.empty())
+		return false;
+	lods_generated = true;
+
+	const unsigned int* data = &indices[0].x;
+	std::vector<Vector3> positions;
+	getPositions(positions);
+	float size = (float)box.halfsize.length();
+	bool lock_borders = material_range.size() > 1; //no cracks between submeshes
+	std::vector<unsigned int> result;
+	std::vector<unsigned int> range_result(indices.size() * 3);
+	unsigned int previous = (unsigned int)indices.size();
+	float error = 0.0f;
+	float ratio = 1.0f;
+
+	for (int i = 0; i < MESH_MAX_LODS; ++i)
+	{
+		ratio *= 0.5f;
+		result.clear();
+
+		//every submesh on its own, from the original triangles so the errors do not add up
+		unsigned int start = 0;
+		for (size_t j = 0; j <= material_range.size() && start < indices.size(); ++j)
+		{
+			unsigned int end = j < material_range.size() ? std::min((unsigned int)indices.size(), material_range[j]) : (unsigned int)indices.size();
+			if (end <= start)
+				continue;
+			size_t target = size_t((end - start) * ratio) * 3;
+			float range_error = 0.0f;
+			size_t num = simplifyMesh(&range_result[0], data + start * 3, (end - start) * 3, &positions[0], positions.size(), target, lock_borders, &range_error);
+			optimizeVertexCache(&range_result[0], num, positions.size());
+			result.insert(result.end(), range_result.begin(), range_result.begin() + num);
+			error = std::max(error, range_error);
+			start = end;
+		}
+
+		//stop when the simplification gets stuck
+		unsigned int num_triangles = (unsigned int)(result.size() / 3);
+		if (!num_triangles || num_triangles > previous * 0.85f)
+			break;
+
+		sLOD lod;
+		lod.start = (unsigned int)lod_indices.size();
+		lod.count = num_triangles;
+		lod.error = size > 0.0f ? error / size : 0.0f;
+		lods.push_back(lod);
+		lod_indices.resize(lod.start + num_triangles);
+		memcpy((void*)&lod_indices[lod.start], &result[0], sizeof(Vector3u) * num_triangles);
+		previous = num_triangles;
+	}
+
+	return lods.size() != 0;
+}
+
+int Mesh::selectLOD(float projected_size, int current_lod)
+{
+	//the coarsest one with a small error on screen, leaving the current one has to cross the hysteresis band
+	for (int i = (int)lods.size(); i > 0; --i)
+	{
+		float threshold = lod_error_pixels * (i <= current_lod ? 1.0f + lod_hysteresis : 1.0f - lod_hysteresis);
+		if (lods[i - 1].error * projected_size <= threshold)
+			return i;
+	}
+	return 0;
+}
+
+bool Mesh::buildClusters(unsigned int max_triangles)
+{
+	unmap();
+	clusters.clear();
+	if (indices.empty())
+		return false;
+
+	unsigned int* data = &indices[0].x;
+	std::vector<Vector3> positions;
+	getPositions(positions);
+
+	//clusters never cross a submesh
+	unsigned int start = 0;
+	for (size_t i = 0; i <= material_range.size() && start < indices.size(); ++i)
+	{
+		unsigned int end = i < material_range.size() ? std::min((unsigned int)indices.size(), material_range[i]) : (unsigned int)indices.size();
+		if (end <= start)
+			continue;
+		size_t first = clusters.size();
+		::buildClusters(data + start * 3, (end - start) * 3, &positions[0], positions.size(), clusters, max_triangles);
+		for (size_t j = first; j < clusters.size(); ++j)
+			clusters[j].start += start;
+		start = end;
+	}
+
+	return true;
+}
+
+typedef struct 
+{
+	int version;
+	int header_bytes;
+	int size;
+	int num_indices;
+	Vector3 aabb_min;
+	Vector3	aabb_max;
+	Vector3	center;
+	Vector3	halfsize;
+	float radius;
+	int num_bones;
+	int material_range[4]; //first submeshes for older readers, v8 stores all of them in the SUBM section
+	Matrix44 bind_matrix;
+	char streams[8]; //Normal|Uvs|Color|Indices|Bones|Weights|Extra
+	int num_sections; //v8, zero in older versions
+	int flags; //v8, see MESH_BIN_FLAG_*
+	char extra[24]; //unused
+} sMeshInfo;
+
+//v8: after the info there is a table of sections, every section starts in a 16 bytes aligned offset so it can be used from the mapping
+typedef struct
+{
+	char type[4]; //INTL, QVTX, QPRM, VERT, NORM, UVS_, COLR, IDX2, IDX4, BONE, WGHT, BINF, CLST, LODS, LID2, LID4, SUBM
+	unsigned int num; //number of elements
+	unsigned int offset; //from the beginning of the file
+	unsigned int bytes;
+} sMeshSection;
+
+//SUBM section, one per submesh
+typedef struct
+{
+	unsigned int end; //last triangle + 1, like material_range
+	int material; //see submesh_material
+} sMeshSubmesh;
+
+#define MESH_BIN_ALIGNMENT 16
+#define MESH_BIN_FLAG_OPTIMIZED 1
+#define MESH_BIN_FLAG_LODS 2
+
+Mesh::sStreams Mesh::getStreams()
+{
+	if (mapped_file)
+		return mapped_streams;
+
+	sStreams s;
+	s.interleaved = interleaved.size() ? &interleaved[0] : NULL;
+	s.quantized = quantized.size() ? &quantized[0] : NULL;
+	s.vertices = vertices.size() ? &vertices[0] : NULL;
+	s.normals = normals.size() ? &normals[0] : NULL;
+	s.uvs = uvs.size() ? &uvs[0] : NULL;
+	s.colors = colors.size() ? &colors[0] : NULL;
+	s.bones = bones.size() ? &bones[0] : NULL;
+	s.weights = weights.size() ? &weights[0] : NULL;
+	s.indices = indices.size() ? &indices[0] : NULL;
+	s.lod_indices = lod_indices.size() ? &lod_indices[0] : NULL;
+	s.index_type = GL_UNSIGNED_INT;
+	s.num_vertices = getNumVertices();
+	s.num_triangles = getNumTriangles();
+	s.num_lod_triangles = lod_indices.size();
+	return s;
+}
+
+//v7 streams are stored one after another, they are copied to the vectors
+static bool readBinStreamsV7(Mesh* mesh, const sMeshInfo& info, const char* pos)
+{
+	if (info.streams[0] == 'I')
+	{
+		mesh->interleaved.resize(info.size);
+		memcpy((void*)&mesh->interleaved[0], pos, sizeof(Mesh::tInterleaved) * info.size);
+		pos += sizeof(Mesh::tInterleaved) * info.size;
+	}
+
+	if (info.streams[0] == 'V')
+	{
+		mesh->vertices.resize(info.size);
+		memcpy((void*)&mesh->vertices[0], pos, sizeof(Vector3) * info.size);
+		pos += sizeof(Vector3) * info.size;
+	}
+
+	if (info.streams[1] == 'N')
+	{
+		mesh->normals.resize(info.size);
+		memcpy((void*)&mesh->normals[0],pos,sizeof(Vector3) * info.size);
+		pos += sizeof(Vector3) * info.size;
+	}
+
+	if (info.streams[2] == 'U')
+	{
+		mesh->uvs.resize(info.size);
+		memcpy((void*)&mesh->uvs[0],pos,sizeof(Vector2) * info.size);
+		pos += sizeof(Vector2) * info.size;
+	}
+
+	if (info.streams[3] == 'C')
+	{
+		mesh->colors.resize(info.size);
+		memcpy((void*)&mesh->colors[0],pos,sizeof(Vector4) * info.size);
+		pos += sizeof(Vector4) * info.size;
+	}
+
+	if (info.streams[4] == 'I')
+	{
+		mesh->indices.resize(info.num_indices);
+		memcpy((void*)&mesh->indices[0], pos, sizeof(Vector3u) * info.num_indices);
+		pos += sizeof(Vector3u) * info.num_indices;
+	}
+	else if (info.streams[4] == 'S') //16 bits indices
+	{
+		mesh->indices.resize(info.num_indices);
+		const unsigned short* indices16 = (const unsigned short*)pos;
+		for (int i = 0; i < info.num_indices; ++i)
+			mesh->indices[i].set(indices16[i * 3], indices16[i * 3 + 1], indices16[i * 3 + 2]);
+		pos += sizeof(unsigned short) * 3 * info.num_indices;
+	}
+
+	if (info.streams[5] == 'B')
+	{
+		mesh->bones.resize(info.size);
+		memcpy((void*)&mesh->bones[0], pos, sizeof(Vector4ub) * info.size);
+		pos += sizeof(Vector4ub) * info.size;
+	}
+
+	if (info.streams[6] == 'W')
+	{
+		mesh->weights.resize(info.size);
+		memcpy((void*)&mesh->weights[0], pos, sizeof(Vector4) * info.size);
+		pos += sizeof(Vector4) * info.size;
+	}
+
+	if (info.num_bones)
+	{
+		mesh->bones_info.resize(info.num_bones);
+		memcpy((void*)&mesh->bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
+		pos += sizeof(BoneInfo) * info.num_bones;
+	}
+
+	return true;
+}
+
+//the streams are used straight from the mapping, a section with other size would read outside it
+static bool isStreamSection(const sMeshSection& section, unsigned int num, size_t element_size)
+{
+	return section.num == num && section.bytes == (size_t)num * element_size;
+}
+
+static bool isCopiedSection(const sMeshSection& section, size_t element_size)
+{
+	return section.bytes == (size_t)section.num * element_size;
+}
+
+//a corrupted index would make the GPU read outside the vertex buffers
+static bool areIndicesValid(const void* indices, unsigned int index_type, size_t num, unsigned int num_vertices)
+{
+	if (index_type == GL_UNSIGNED_SHORT)
+	{
+		const unsigned short* indices16 = (const unsigned short*)indices;
+		for (size_t i = 0; i < num; ++i)
+			if (indices16[i] >= num_vertices)
+				return false;
+		return true;
+	}
+	const unsigned int* indices32 = (const unsigned int*)indices;
+	for (size_t i = 0; i < num; ++i)
+		if (indices32[i] >= num_vertices)
+			return false;
+	return true;
+}
+
+//v8 streams are not copied, they point to the sections inside the mapped file
+static bool readBinSections(Mesh* mesh, const sMeshInfo& info, const MappedFile* file)
+{
+	if (info.size < 0 || info.num_indices < 0 || info.num_sections < 0)
+		return false;
+	unsigned int num_vertices = (unsigned int)info.size;
+	unsigned int num_indices = (unsigned int)info.num_indices * 3;
+
+	Mesh::sStreams& s = mesh->mapped_streams;
+	memset(&s, 0, sizeof(s));
+	s.index_type = GL_UNSIGNED_INT;
+	s.num_vertices = info.size;
+	s.num_triangles = info.num_indices ? info.num_indices : info.size / 3;
+
+	size_t table_offset = 4 + sizeof(sMeshInfo);
+	if (table_offset + info.num_sections * sizeof(sMeshSection) > file->size)
+		return false;
+	const sMeshSection* sections = (const sMeshSection*)(file->data + table_offset);
+	unsigned int lod_index_type = 0;
+
+	for (int i = 0; i < info.num_sections; ++i)
+	{
+		const sMeshSection& section = sections[i];
+		if ((size_t)section.offset + section.bytes > file->size || section.offset % MESH_BIN_ALIGNMENT)
+			return false;
+
+		const char* data = file->data + section.offset;
+		const char* type = section.type;
+		unsigned int num = section.num;
+		size_t index_size = type[3] == '2' ? sizeof(unsigned short) : sizeof(unsigned int);
+		bool valid = true;
+		if (memcmp(type, "INTL", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Mesh::tInterleaved));
+			s.interleaved = (const Mesh::tInterleaved*)data;
+		}
+		else if (memcmp(type, "QVTX", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Mesh::tQuantized));
+			s.quantized = (const Mesh::tQuantized*)data;
+		}
+		else if (memcmp(type, "QPRM", 4) == 0)
+		{
+			valid = section.bytes == sizeof(Mesh::sQuantization);
+			if (valid)
+				memcpy(&mesh->quantization, data, sizeof(Mesh::sQuantization));
+		}
+		else if (memcmp(type, "VERT", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Vector3));
+			s.vertices = (const Vector3*)data;
+		}
+		else if (memcmp(type, "NORM", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Vector3));
+			s.normals = (const Vector3*)data;
+		}
+		else if (memcmp(type, "UVS_", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Vector2));
+			s.uvs = (const Vector2*)data;
+		}
+		else if (memcmp(type, "COLR", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Vector4));
+			s.colors = (const Vector4*)data;
+		}
+		else if (memcmp(type, "BONE", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Vector4ub));
+			s.bones = (const Vector4ub*)data;
+		}
+		else if (memcmp(type, "WGHT", 4) == 0)
+		{
+			valid = isStreamSection(section, num_vertices, sizeof(Vector4));
+			s.weights = (const Vector4*)data;
+		}
+		else if (memcmp(type, "IDX2", 4) == 0 || memcmp(type, "IDX4", 4) == 0)
+		{
+			valid = isStreamSection(section, num_indices, index_size);
+			s.indices = data;
+			s.index_type = type[3] == '2' ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		}
+		else if (memcmp(type, "BINF", 4) == 0) //small, copied
+		{
+			valid = isCopiedSection(section, sizeof(BoneInfo));
+			if (valid)
+				mesh->bones_info.assign((const BoneInfo*)data, (const BoneInfo*)data + num);
+		}
+		else if (memcmp(type, "CLST", 4) == 0) //small, copied
+		{
+			valid = isCopiedSection(section, sizeof(sMeshCluster));
+			if (valid)
+				mesh->clusters.assign((const sMeshCluster*)data, (const sMeshCluster*)data + num);
+		}
+		else if (memcmp(type, "LODS", 4) == 0) //small, copied
+		{
+			valid = isCopiedSection(section, sizeof(Mesh::sLOD));
+			if (valid)
+				mesh->lods.assign((const Mesh::sLOD*)data, (const Mesh::sLOD*)data + num);
+		}
+		else if (memcmp(type, "LID2", 4) == 0 || memcmp(type, "LID4", 4) == 0)
+		{
+			valid = num % 3 == 0 && isCopiedSection(section, index_size);
+			s.lod_indices = data;
+			s.num_lod_triangles = num / 3;
+			lod_index_type = type[3] == '2' ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		}
+		else if (memcmp(type, "SUBM", 4) == 0) //small, copied
+		{
+			valid = isCopiedSection(section, sizeof(sMeshSubmesh));
+			const sMeshSubmesh* submeshes = (const sMeshSubmesh*)data;
+			if (valid)
+			{
+				mesh->material_range.resize(num);
+				mesh->submesh_material.resize(num);
+				for (unsigned int j = 0; j < num; ++j)
+				{
+					mesh->material_range[j] = submeshes[j].end;
+					mesh->submesh_material[j] = submeshes[j].material;
+				}
+			}
+		}
+		//unknown sections are skipped
+
+		if (!valid)
+			return false;
+	}
+
+	if (s.indices && !areIndicesValid(s.indices, s.index_type, num_indices, num_vertices))
+		return false;
+	if (s.lod_indices && !areIndicesValid(s.lod_indices, lod_index_type, s.num_lod_triangles * 3, num_vertices))
+		return false;
+
+	//clusters out of range are ignored, they will be built again
+	if (mesh->clusters.size() && mesh->clusters.back().start + mesh->clusters.back().count > s.num_triangles)
+		mesh->clusters.clear();
+
+	//submeshes must be sorted and inside the mesh, otherwise the ones in the info are used
+	for (size_t i = 0; i < mesh->material_range.size(); ++i)
+		if (mesh->material_range[i] > s.num_triangles || (i && mesh->material_range[i] < mesh->material_range[i - 1]))
+		{
+			mesh->material_range.clear();
+			mesh->submesh_material.clear();
+			break;
+		}
+
+	//same with lods, they must use the same index type than the mesh
+	if (mesh->lods.size() && (!s.lod_indices || lod_index_type != s.index_type || mesh->lods.back().start + mesh->lods.back().count > s.num_lod_triangles))
+	{
+		mesh->lods.clear();
+		mesh->lods_generated = false;
+		s.lod_indices = NULL;
+		s.num_lod_triangles = 0;
+	}
 
-	return true;
+	return s.interleaved || s.quantized || s.vertices;
 }
 
-typedef struct 
-{
-	int version;
-	int header_bytes;
-	int size;
-	int num_indices;
-	Vector3 aabb_min;
-	Vector3	aabb_max;
-	Vector3	center;
-	Vector3	halfsize;
-	float radius;
-	int num_bones;
-	int material_range[4];
-	Matrix44 bind_matrix;
-	char streams[8]; //Normal|Uvs|Color|Indices|Bones|Weights|Extra
-	char extra[32]; //unused
-} sMeshInfo;
-
 bool Mesh::readBin(const char* filename)
 {
-	FILE *f;
 	assert(filename);
 
-	struct stat stbuffer;
-
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		delete file;
 		return false;
-
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	}
 
 	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if ( file->size < 4 + sizeof(sMeshInfo) || memcmp(file->data,"MBIN",4) != 0 )
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	char* pos = data + 4;
 	sMeshInfo info;
-	memcpy(&info,pos,sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
+	memcpy(&info, file->data + 4, sizeof(sMeshInfo));
 
-	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
+	if(info.version < MESH_BIN_MIN_VERSION || info.version > MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	if (info.streams[0] == 'I')
-	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
-	}
-
-	if (info.streams[0] == 'V')
-	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[1] == 'N')
-	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
-	}
-
-	if (info.streams[3] == 'C')
-	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
-
-	if (info.streams[4] == 'I')
-	{
-		indices.resize(info.num_indices);
-		memcpy((void*)&indices[0], pos, sizeof(Vector3u) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
-	}
-
-	if (info.streams[5] == 'B')
-	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
-	}
-
-	if (info.streams[6] == 'W')
+	lods_generated = (info.flags & MESH_BIN_FLAG_LODS) != 0;
+	if (info.version == 7)
 	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
+		readBinStreamsV7(this, info, file->data + 4 + sizeof(sMeshInfo));
+		delete file;
 	}
-
-	if (info.num_bones)
+	else
 	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
+		if (!readBinSections(this, info, file))
+		{
+			std::cout << "[ERROR] loading BIN: corrupted sections: " << filename << std::endl;
+			material_range.clear();
+			submesh_material.clear();
+			delete file;
+			return false;
+		}
+		mapped_file = file;
+		if (!map_binary_meshes)
+			unmap();
 	}
+	bin_version = info.version;
+	is_optimized = (info.flags & MESH_BIN_FLAG_OPTIMIZED) != 0;
 
 	aabb_max = info.aabb_max;
 	aabb_min = info.aabb_min;
@@ -767,40 +1921,96 @@ bool Mesh::readBin(const char* filename)
 	radius = info.radius;
 	bind_matrix = info.bind_matrix;
 
-	for (int i = 0; i < 4; i++)
-		if (info.material_range[i] != -1)
+	if (material_range.empty()) //v7 or without SUBM section
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			if (info.material_range[i] == -1)
+				break;
 			material_range.push_back( info.material_range[i] );
-		else
-			break;
-
-	delete[] data;
+		}
+	}
 
 	createCollisionModel();
 	return true;
 }
 
+static void copyIndices(std::vector<Vector3u>& output, const void* indices, unsigned int index_type, unsigned int num_triangles)
+{
+	output.resize(num_triangles);
+	if (index_type == GL_UNSIGNED_SHORT)
+	{
+		const unsigned short* indices16 = (const unsigned short*)indices;
+		for (unsigned int i = 0; i < num_triangles; ++i)
+			output[i].set(indices16[i * 3], indices16[i * 3 + 1], indices16[i * 3 + 2]);
+	}
+	else
+		memcpy((void*)&output[0], indices, sizeof(Vector3u) * num_triangles);
+}
+
+bool Mesh::unmap()
+{
+	if (!mapped_file)
+		return false;
+
+	const sStreams& s = mapped_streams;
+	if (s.interleaved)
+		interleaved.assign(s.interleaved, s.interleaved + s.num_vertices);
+	if (s.quantized)
+		quantized.assign(s.quantized, s.quantized + s.num_vertices);
+	if (s.vertices)
+		vertices.assign(s.vertices, s.vertices + s.num_vertices);
+	if (s.normals)
+		normals.assign(s.normals, s.normals + s.num_vertices);
+	if (s.uvs)
+		uvs.assign(s.uvs, s.uvs + s.num_vertices);
+	if (s.colors)
+		colors.assign(s.colors, s.colors + s.num_vertices);
+	if (s.bones)
+		bones.assign(s.bones, s.bones + s.num_vertices);
+	if (s.weights)
+		weights.assign(s.weights, s.weights + s.num_vertices);
+	if (s.indices)
+		copyIndices(indices, s.indices, s.index_type, s.num_triangles);
+	if (s.lod_indices)
+		copyIndices(lod_indices, s.lod_indices, s.index_type, s.num_lod_triangles);
+
+	delete mapped_file;
+	mapped_file = NULL;
+	return true;
+}
+
+static void addSection(std::vector<sMeshSection>& sections, std::vector<const void*>& data, const char* type, const void* ptr, unsigned int num, size_t element_size)
+{
+	if (!ptr || !num)
+		return;
+	sMeshSection section;
+	memcpy(section.type, type, 4);
+	section.num = num;
+	section.offset = 0;
+	section.bytes = (unsigned int)(num * element_size);
+	sections.push_back(section);
+	data.push_back(ptr);
+}
+
 bool Mesh::writeBin(const char* filename)
 {
-	assert( vertices.size() || interleaved.size() );
+	assert( getNumVertices() );
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
-	FILE* f = fopen(s_filename.c_str(),"wb");
-	if (f == NULL)
-	{
-		std::cout << "[ERROR] cannot write mesh BIN: " << s_filename.c_str() << std::endl;
-		return false;
-	}
+	//cannot overwrite the file while it is mapped
+	if (mapped_file)
+		unmap();
 
-	//watermark
-	fwrite("MBIN",sizeof(char),4,f);
+	sStreams s = getStreams();
 
 	sMeshInfo info;
 	memset(&info, 0, sizeof(info));
 	info.version = MESH_BIN_VERSION;
 	info.header_bytes = sizeof(sMeshInfo);
-	info.size = interleaved.size() ? interleaved.size() : vertices.size();
-	info.num_indices = indices.size();
+	info.size = s.num_vertices;
+	info.num_indices = s.indices ? s.num_triangles : 0;
 	info.aabb_max = aabb_max;
 	info.aabb_min = aabb_min;
 	info.center = box.center;
@@ -808,45 +2018,112 @@ bool Mesh::writeBin(const char* filename)
 	info.radius = radius;
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
-
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
-	info.streams[1] = normals.size() ? 'N' : ' ';
-	info.streams[2] = uvs.size() ? 'U' : ' ';
-	info.streams[3] = colors.size() ? 'C' : ' ';
-	info.streams[4] = indices.size() ? 'I' : ' ';
-	info.streams[5] = bones.size() ? 'B' : ' ';
-	info.streams[6] = weights.size() ? 'W' : ' ';
+	info.flags = (is_optimized ? MESH_BIN_FLAG_OPTIMIZED : 0) | (lods_generated ? MESH_BIN_FLAG_LODS : 0);
+
+	//compact vertices, they lose precision so they are only generated when baking
+	std::vector<tQuantized> quantized_vertices;
+	sQuantization quantization_params = quantization;
+	const tQuantized* quantized_stream = s.quantized;
+	if (!quantized_stream && quantize_meshes && computeQuantized(quantized_vertices, quantization_params))
+		quantized_stream = &quantized_vertices[0];
+
+	info.streams[0] = quantized_stream ? 'Q' : (s.interleaved ? 'I' : 'V');
+	info.streams[1] = s.normals && !quantized_stream ? 'N' : ' ';
+	info.streams[2] = s.uvs && !quantized_stream ? 'U' : ' ';
+	info.streams[3] = s.colors ? 'C' : ' ';
+	info.streams[4] = s.indices ? (canUse16BitIndices() ? 'S' : 'I') : ' ';
+	info.streams[5] = s.bones ? 'B' : ' ';
+	info.streams[6] = s.weights ? 'W' : ' ';
 
 	for (unsigned int i = 0; i < 4; i++)
 		info.material_range[i] = material_range.size() > i ? material_range[i] : -1;
 
-	//write info
-	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
+	//indices are stored in 16 bits when possible
+	std::vector<unsigned short> indices16;
+	std::vector<unsigned short> lod_indices16;
+	if (info.streams[4] == 'S')
+	{
+		indices16.resize(s.num_triangles * 3);
+		for (size_t i = 0; i < indices16.size(); ++i)
+			indices16[i] = (unsigned short)indices[i / 3].v[i % 3];
+		lod_indices16.resize(lod_indices.size() * 3);
+		for (size_t i = 0; i < lod_indices16.size(); ++i)
+			lod_indices16[i] = (unsigned short)lod_indices[i / 3].v[i % 3];
+	}
 
-	//write streams
-	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
+	std::vector<sMeshSection> sections;
+	std::vector<const void*> sections_data;
+	if (quantized_stream)
+	{
+		addSection(sections, sections_data, "QVTX", quantized_stream, s.num_vertices, sizeof(tQuantized));
+		addSection(sections, sections_data, "QPRM", &quantization_params, 1, sizeof(sQuantization));
+	}
+	else
+	{
+		addSection(sections, sections_data, "INTL", s.interleaved, s.num_vertices, sizeof(tInterleaved));
+		addSection(sections, sections_data, "VERT", s.vertices, s.num_vertices, sizeof(Vector3));
+		addSection(sections, sections_data, "NORM", s.normals, s.num_vertices, sizeof(Vector3));
+		addSection(sections, sections_data, "UVS_", s.uvs, s.num_vertices, sizeof(Vector2));
+	}
+	addSection(sections, sections_data, "COLR", s.colors, s.num_vertices, sizeof(Vector4));
+	if (indices16.size())
+		addSection(sections, sections_data, "IDX2", &indices16[0], indices16.size(), sizeof(unsigned short));
 	else
+		addSection(sections, sections_data, "IDX4", s.indices, s.num_triangles * 3, sizeof(unsigned int));
+	addSection(sections, sections_data, "BONE", s.bones, s.num_vertices, sizeof(Vector4ub));
+	addSection(sections, sections_data, "WGHT", s.weights, s.num_vertices, sizeof(Vector4));
+	addSection(sections, sections_data, "BINF", bones_info.size() ? &bones_info[0] : NULL, bones_info.size(), sizeof(BoneInfo));
+	std::vector<sMeshSubmesh> submeshes(material_range.size());
+	for (size_t i = 0; i < submeshes.size(); ++i)
+	{
+		submeshes[i].end = material_range[i];
+		submeshes[i].material = i < submesh_material.size() ? submesh_material[i] : (int)i;
+	}
+	addSection(sections, sections_data, "SUBM", submeshes.size() ? &submeshes[0] : NULL, submeshes.size(), sizeof(sMeshSubmesh));
+	addSection(sections, sections_data, "CLST", clusters.size() && s.indices ? &clusters[0] : NULL, clusters.size(), sizeof(sMeshCluster));
+	if (lods.size() && s.indices)
+	{
+		addSection(sections, sections_data, "LODS", &lods[0], lods.size(), sizeof(sLOD));
+		if (lod_indices16.size())
+			addSection(sections, sections_data, "LID2", &lod_indices16[0], lod_indices16.size(), sizeof(unsigned short));
+		else
+			addSection(sections, sections_data, "LID4", &lod_indices[0], lod_indices.size() * 3, sizeof(unsigned int));
+	}
+	info.num_sections = sections.size();
+
+	//compute the aligned offsets
+	unsigned int offset = 4 + sizeof(sMeshInfo) + sizeof(sMeshSection) * sections.size();
+	for (size_t i = 0; i < sections.size(); ++i)
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(Vector3), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2), 1, f);
+		offset = (offset + MESH_BIN_ALIGNMENT - 1) & ~(MESH_BIN_ALIGNMENT - 1);
+		sections[i].offset = offset;
+		offset += sections[i].bytes;
 	}
 
-	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4), 1, f);
+	FILE* f = fopen(s_filename.c_str(),"wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write mesh BIN: " << s_filename.c_str() << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("MBIN",sizeof(char),4,f);
 
-	if (indices.size())
-		fwrite((void*)&indices[0], indices.size() * sizeof(Vector3u), 1, f);
+	//write info and table
+	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
+	if (sections.size())
+		fwrite((void*)&sections[0], sizeof(sMeshSection), sections.size(), f);
 
-	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
-	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
+	//write sections with padding
+	const char padding[MESH_BIN_ALIGNMENT] = { 0 };
+	long pos = ftell(f);
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		fwrite(padding, 1, sections[i].offset - pos, f);
+		fwrite(sections_data[i], sections[i].bytes, 1, f);
+		pos = sections[i].offset + sections[i].bytes;
+	}
 
 	fclose(f);
 	return true;
@@ -918,11 +2195,13 @@ bool Mesh::loadASE(const char* filename)
 		if (current_mat != prev_mat)
 		{
 			material_range.push_back( count );
+			submesh_material.push_back( prev_mat );
 			prev_mat = current_mat;
 		}
 	}
 
 	material_range.push_back(nFcs);
+	submesh_material.push_back(prev_mat);
 
 	t.seek("*MESH_NUMTVERTEX");
 	nVtx = t.getint();
@@ -994,104 +2273,18 @@ bool Mesh::loadOBJ(const char* filename)
 	fclose(f);
 	data[size] = 0;
 
-	char* pos = data;
-	char line[255];
-	int i = 0;
-
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
-
-	unsigned int vertex_i = 0;
-
-	//parse file
-	while(*pos != 0)
-	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() == 4)
-		{
-			Vector2 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh
-			if (uvs.size() == 0 && indexed_uvs.size() )
-				uvs.resize(1);
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
-				}
-			}
-		}
-	}
+	//parsed in parallel, see extra/objparser.h
+	bool loaded = parseOBJ(data, size, vertices, normals, uvs, aabb_min, aabb_max);
+	delete[] data;
+	if (!loaded)
+		return false;
 
 	box.center = (aabb_max + aabb_min) * 0.5;
 	box.halfsize = (aabb_max - box.center);
 	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
 
 	material_range.push_back( (unsigned int)(vertices.size() / 3.0) );
+	submesh_material.push_back(0);
 	return true;
 }
 
@@ -1154,7 +2347,8 @@ bool Mesh::loadMESH(const char* filename)
 				for (int j = 0; j < bones_info.size(); ++j)
 				{
 					pos = fetchWord(pos, word);
-					strcpy_s(bones_info[j].name, 32, word);
+					strncpy(bones_info[j].name, word, 31);
+					bones_info[j].name[31] = 0;
 					pos = fetchMatrix44(pos, bones_info[j].bind_pose);
 				}
 			}
@@ -1314,6 +2508,7 @@ void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered )
 void Mesh::displace(Image* heightmap, float altitude)
 {
 	assert(heightmap && heightmap->data && "image without data");
+	unmap(); //mapped streams are read only
 	assert(uvs.size() && "cannot displace without uvs");
 
 	bool is_interleaved = interleaved.size() != 0;
@@ -1394,6 +2589,14 @@ void Mesh::renderBounding( const Matrix44& model, bool world_bounding )
 
 
 
+void Mesh::endFrame()
+{
+	num_meshes_rendered_last_frame = num_meshes_rendered;
+	num_triangles_rendered_last_frame = num_triangles_rendered;
+	num_clusters_culled_last_frame = num_clusters_culled;
+	num_meshes_rendered = num_triangles_rendered = num_clusters_culled = 0;
+}
+
 Mesh* Mesh::getQuad()
 {
 	static Mesh* quad = NULL;
@@ -1409,11 +2612,53 @@ Mesh* Mesh::getQuad()
 Mesh* Mesh::Get(const char* filename)
 {
 	assert(filename);
-	std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
-	if (it != sMeshesLoaded.end())
-		return it->second;
+	Mesh* cached = sMeshesLoaded.find(filename);
+	if (cached)
+		return cached;
+
+	//background loading, a cube is shown till the mesh is ready. If it fails the cube stays
+	if (ResourceLoader::async)
+	{
+		Mesh* m = new Mesh();
+		m->createCube();
+		if (auto_upload_to_vram)
+			m->uploadToVRAM();
+		m->registerMesh(filename);
+
+		Mesh* loaded = new Mesh();
+		std::string name = filename;
+		ResourceLoader::enqueue(m, filename,
+			[loaded, name]() { return loaded->load(name.c_str()); },
+			[m, loaded](bool result) {
+				if (result)
+				{
+					m->moveFrom(loaded);
+					if (auto_upload_to_vram)
+						m->uploadToVRAM();
+				}
+				delete loaded;
+			});
+		return m;
+	}
 
 	Mesh* m = new Mesh();
+	if (!m->load(filename))
+	{
+		delete m;
+		return NULL;
+	}
+
+	if (auto_upload_to_vram)
+		m->uploadToVRAM();
+
+	m->registerMesh(filename);
+	return m;
+}
+
+//no GL calls here so it can run in a worker thread
+bool Mesh::load(const char* filename)
+{
+	Mesh* m = this;
 	std::string name = filename;
 
 	//detect format
@@ -1430,7 +2675,7 @@ Mesh* Mesh::Get(const char* filename)
 	else
 	{
 		std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
 	//stats
@@ -1442,23 +2687,57 @@ Mesh* Mesh::Get(const char* filename)
 		binfilename = binfilename + ".mbin";
 
 	//try loading the binary version
-	if ( m->readBin(binfilename.c_str()) && use_binary )
+	if ( use_binary && m->readBin(binfilename.c_str()) )
 	{
-		if(interleave_meshes && m->interleaved.size() == 0)
+		//old binaries stored triangle soups, weld them
+		bool outdated = m->bin_version < MESH_BIN_VERSION;
+		if (weld_meshes && !m->isIndexed() && !m->mapped_file)
 		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
+			std::cout << "[WELD] " << m->getNumVertices() << " -> ";
+			if (m->weldVertices())
+				outdated = true;
+			std::cout << m->getNumVertices() << " ";
 		}
 
-		if (auto_upload_to_vram)
+		if (optimize_meshes && m->isIndexed() && !m->is_optimized)
 		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
+			std::cout << "[OPT] ";
+			m->optimize();
+			outdated = true;
 		}
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		if (cluster_meshes && m->isIndexed() && m->clusters.empty())
+		{
+			std::cout << "[CLUSTERS] ";
+			m->buildClusters();
+			outdated = true;
+		}
+
+		if (generate_lods && m->isIndexed() && !m->lods_generated)
+		{
+			std::cout << "[LODS] ";
+			m->generateLODs();
+			outdated = true;
+		}
+
+		if (quantize_meshes && !m->getStreams().quantized)
+			outdated = true;
+
+		//update the file to the current version
+		if (outdated)
+		{
+			std::cout << "[UPDATE BIN] ";
+			m->writeBin(file_format == FORMAT_MBIN ? name.substr(0, name.find_last_of(".")).c_str() : filename);
+		}
+
+		if(interleave_meshes && !m->mapped_file && m->interleaved.size() == 0)
+		{
+			std::cout << "[INTERL] ";
+			m->interleaveBuffers();
+		}
+
+		std::cout << (m->mapped_file ? "[OK BIN MAPPED]  Faces: " : "[OK BIN]  Faces: ") << m->getNumTriangles() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 
 	//load the ascii version
@@ -1472,9 +2751,39 @@ Mesh* Mesh::Get(const char* filename)
 
 	if (!loaded)
 	{
-		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		return false;
+	}
+
+	//remove duplicated vertices, loaders output one vertex per face corner
+	if (weld_meshes)
+	{
+		std::cout << "[WELD] " << m->getNumVertices() << " -> ";
+		m->weldVertices();
+		std::cout << m->getNumVertices() << " ";
+	}
+
+	//sort for the vertex cache, overdraw and vertex fetch
+	if (optimize_meshes && m->isIndexed())
+	{
+		sVertexCacheStats before, after;
+		m->optimize(&before, &after);
+		std::cout << "[OPT] ACMR " << before.acmr << " -> " << after.acmr << " ATVR " << before.atvr << " -> " << after.atvr << " ";
+	}
+
+	//split in clusters for culling (done by optimize when enabled)
+	if (cluster_meshes && m->isIndexed())
+	{
+		if (m->clusters.empty())
+			m->buildClusters();
+		std::cout << "[CLUSTERS] " << m->clusters.size() << " ";
+	}
+
+	//simplified versions to use in the distance
+	if (generate_lods && m->isIndexed())
+	{
+		m->generateLODs();
+		std::cout << "[LODS] " << m->lods.size() << " ";
 	}
 
 	//to optimize, interleave the meshes
@@ -1484,14 +2793,7 @@ Mesh* Mesh::Get(const char* filename)
 		m->interleaveBuffers();
 	}
 
-	//and upload them to VRAM
-	if (auto_upload_to_vram)
-	{
-		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
-	}
-
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	std::cout << "[OK]  Faces: " << m->getNumTriangles() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	if (use_binary)
 	{
 		std::cout << "\t\t Writing .BIN ... ";
@@ -1499,12 +2801,99 @@ Mesh* Mesh::Get(const char* filename)
 		std::cout << "[OK]" << std::endl;
 	}
 
-	m->registerMesh(name);
-	return m;
+	return true;
+}
+
+size_t Mesh::getCPUBytes()
+{
+	size_t bytes = sizeof(Mesh) + (mapped_file ? mapped_file->size : 0);
+	bytes += vertices.capacity() * sizeof(Vector3) + normals.capacity() * sizeof(Vector3) + uvs.capacity() * sizeof(Vector2) + colors.capacity() * sizeof(Vector4);
+	bytes += interleaved.capacity() * sizeof(tInterleaved) + quantized.capacity() * sizeof(tQuantized);
+	bytes += (indices.capacity() + lod_indices.capacity()) * sizeof(Vector3u) + clusters.capacity() * sizeof(sMeshCluster) + lods.capacity() * sizeof(sLOD);
+	bytes += bones.capacity() * sizeof(Vector4ub) + weights.capacity() * sizeof(Vector4) + bones_info.capacity() * sizeof(BoneInfo);
+	return bytes;
+}
+
+size_t Mesh::getVRAMBytes()
+{
+	size_t num = getNumVertices();
+	size_t bytes = 0;
+	if (interleaved_vbo_id)
+		bytes += num * (getStreams().quantized ? sizeof(tQuantized) : sizeof(tInterleaved));
+	if (vertices_vbo_id)
+		bytes += num * sizeof(Vector3);
+	if (normals_vbo_id)
+		bytes += num * sizeof(Vector3);
+	if (uvs_vbo_id)
+		bytes += num * sizeof(Vector2);
+	if (colors_vbo_id)
+		bytes += num * sizeof(Vector4);
+	if (bones_vbo_id)
+		bytes += num * sizeof(Vector4ub);
+	if (weights_vbo_id)
+		bytes += num * sizeof(Vector4);
+	if (indices_vbo_id)
+		bytes += (getNumTriangles() + getStreams().num_lod_triangles) * 3 * (indices_vbo_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int));
+	return bytes;
+}
+
+void Mesh::moveFrom(Mesh* mesh)
+{
+	assert(mesh && mesh != this);
+	clear();
+
+	material_name.swap(mesh->material_name);
+	material_range.swap(mesh->material_range);
+	submesh_material.swap(mesh->submesh_material);
+	vertices.swap(mesh->vertices);
+	normals.swap(mesh->normals);
+	uvs.swap(mesh->uvs);
+	colors.swap(mesh->colors);
+	interleaved.swap(mesh->interleaved);
+	quantized.swap(mesh->quantized);
+	quantization = mesh->quantization;
+	indices.swap(mesh->indices);
+	clusters.swap(mesh->clusters);
+	lods.swap(mesh->lods);
+	lod_indices.swap(mesh->lod_indices);
+	bones.swap(mesh->bones);
+	weights.swap(mesh->weights);
+	bones_info.swap(mesh->bones_info);
+	bind_matrix = mesh->bind_matrix;
+
+	mapped_file = mesh->mapped_file;
+	mapped_streams = mesh->mapped_streams;
+	mesh->mapped_file = NULL;
+	bin_version = mesh->bin_version;
+	is_optimized = mesh->is_optimized;
+	lods_generated = mesh->lods_generated;
+
+	aabb_min = mesh->aabb_min;
+	aabb_max = mesh->aabb_max;
+	box = mesh->box;
+	radius = mesh->radius;
+
+	//buffers in VRAM, if any
+	vertices_vbo_id = mesh->vertices_vbo_id;
+	uvs_vbo_id = mesh->uvs_vbo_id;
+	normals_vbo_id = mesh->normals_vbo_id;
+	colors_vbo_id = mesh->colors_vbo_id;
+	indices_vbo_id = mesh->indices_vbo_id;
+	indices_vbo_type = mesh->indices_vbo_type;
+	interleaved_vbo_id = mesh->interleaved_vbo_id;
+	bones_vbo_id = mesh->bones_vbo_id;
+	weights_vbo_id = mesh->weights_vbo_id;
+	mesh->vertices_vbo_id = mesh->uvs_vbo_id = mesh->normals_vbo_id = mesh->colors_vbo_id = mesh->interleaved_vbo_id = mesh->indices_vbo_id = mesh->bones_vbo_id = mesh->weights_vbo_id = 0;
+
+	collision_model = mesh->collision_model;
+	mesh->collision_model = NULL;
+
+	//they are created again on demand
+	mesh->releaseVAOs();
 }
 
 void Mesh::registerMesh( std::string name )
 {
 	this->name = name;
-	sMeshesLoaded[name] = this;
+	sMeshesLoaded.add(name, this);
 }
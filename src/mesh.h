@@ -3,6 +3,8 @@
 
 #include <vector>
 #include "framework.h"
+#include "extra/meshopt.h"
+#include "resourcecache.h"
 
 #include <map>
 #include <string>
@@ -10,8 +12,12 @@
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class MappedFile; //for binary meshes
+class Camera; //for culling
 
-#define MESH_BIN_VERSION 7 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 8 //this is used to regenerate bins if the format changes
+#define MESH_BIN_MIN_VERSION 7 //older bins that can still be read
+#define MESH_MAX_LODS 4 //simplified versions besides the mesh itself
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
@@ -21,17 +27,33 @@ struct BoneInfo {
 class Mesh
 {
 public:
-	static std::map<std::string, Mesh*> sMeshesLoaded;
+	static ResourceCache<Mesh> sMeshesLoaded;
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
-	static long num_meshes_rendered;
+	static bool weld_meshes; //loaded meshes will be indexed removing duplicated vertices
+	static bool map_binary_meshes; //streams of .mbin files are used from the file mapping instead of copied
+	static bool quantize_meshes; //binaries are baked with compact vertices (see tQuantized)
+	static bool optimize_meshes; //triangles and vertices are sorted for the GPU caches when baking
+	static bool cluster_meshes; //triangles are grouped in clusters with bounds when baking, see cullClusters
+	static bool generate_lods; //simplified index buffers are generated when baking, see selectLOD
+	static float lod_error_pixels; //a lod can be used while its error on screen is below this
+	static float lod_hysteresis; //fraction of lod_error_pixels the current lod is kept for, to avoid popping
+	static long num_meshes_rendered; //this frame
 	static long num_triangles_rendered;
+	static long num_clusters_culled;
+	static long num_meshes_rendered_last_frame;
+	static long num_triangles_rendered_last_frame;
+	static long num_clusters_culled_last_frame;
+	static bool use_vaos; //render binds a vertex array object per shader instead of setting the attributes every draw (only in VRAM)
+	static int max_vaos; //per mesh, the least recently used is deleted
+	static bool use_indirect_draw; //drawRanges uses glMultiDrawElementsIndirect when the context supports it (and the mesh is in VRAM)
 
 	std::string name;
 
 	std::vector<std::string> material_name; 
-	std::vector<unsigned int> material_range; 
+	std::vector<unsigned int> material_range; //end triangle of every submesh
+	std::vector<int> submesh_material; //material id of every submesh (the MTLID in ASE), submeshes with the same id can be drawn in one call
 
 	std::vector< Vector3 > vertices; //here we store the vertices
 	std::vector< Vector3 > normals;	 //here we store the normals
@@ -46,7 +68,42 @@ public:
 
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
+	//compact vertex, 16 bytes instead of 32, decoded in the vertex shader
+	struct tQuantized {
+		unsigned short vertex[4]; //normalized inside the AABB, w is padding
+		short normal[2]; //octahedral encoding
+		unsigned short uv[2]; //normalized inside the uvs range
+	};
+
+	//to decode: value = offset + normalized * scale
+	struct sQuantization {
+		Vector3 vertex_offset;
+		Vector3 vertex_scale;
+		Vector2 uv_offset;
+		Vector2 uv_scale;
+	};
+
+	std::vector< tQuantized > quantized; //replaces interleaved when quantized
+	sQuantization quantization;
+
 	std::vector< Vector3u > indices; //for indexed meshes
+	std::vector< sMeshCluster > clusters; //consecutive ranges of triangles (inside a submesh) with bounding sphere and normal cone
+
+	struct sLOD {
+		unsigned int start; //first triangle in lod_indices
+		unsigned int count; //number of triangles
+		float error; //geometric error relative to the size of the bounding box
+	};
+
+	std::vector< sLOD > lods; //lod 1 to n, lod 0 is the mesh itself
+	std::vector< Vector3u > lod_indices; //triangles of all the lods, they use the same vertices than the mesh
+
+	//list of index ranges ready for glMultiDrawElements
+	struct sDrawRanges {
+		std::vector<int> counts; //in indices
+		std::vector<const void*> offsets; //in bytes
+		unsigned int num_triangles;
+	};
 
 	//for animated meshes
 	std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
@@ -54,6 +111,30 @@ public:
 	std::vector< BoneInfo > bones_info; //tells 
 	Matrix44 bind_matrix;
 
+	//read only view of the streams, they point to the vectors or to the mapped .mbin
+	struct sStreams {
+		const tInterleaved* interleaved;
+		const tQuantized* quantized;
+		const Vector3* vertices;
+		const Vector3* normals;
+		const Vector2* uvs;
+		const Vector4* colors;
+		const Vector4ub* bones;
+		const Vector4* weights;
+		const void* indices; //three per triangle
+		const void* lod_indices; //same type than indices
+		unsigned int index_type; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		unsigned int num_vertices;
+		unsigned int num_triangles;
+		unsigned int num_lod_triangles;
+	};
+
+	MappedFile* mapped_file; //when mapped the vectors are empty and the streams live in the file
+	sStreams mapped_streams;
+	int bin_version; //version of the .mbin it was read from, 0 if not read from a bin
+	bool is_optimized; //optimize was applied (also stored in the .mbin)
+	bool lods_generated; //generateLODs was applied, even if the mesh was too simple to get any (also stored in the .mbin)
+
 	Vector3 aabb_min;
 	Vector3	aabb_max;
 	BoundingBox box;
@@ -66,31 +147,66 @@ public:
 	unsigned int colors_vbo_id;
 
 	unsigned int indices_vbo_id;
+	unsigned int indices_vbo_type; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, depends on the number of vertices
 	unsigned int interleaved_vbo_id;
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 
+	//vertex array objects with the attributes of the buffers for a shader, most recently used first
+	struct sVAO {
+		unsigned int shader_uid; //see Shader::uid, a recompiled shader does not match
+		unsigned int id;
+	};
+	std::vector< sVAO > vaos;
+
 	Mesh();
 	~Mesh();
 
 	void clear();
 
-	void render( unsigned int primitive, int submesh_id = 0, int num_instances = 0 );
+	void render( unsigned int primitive, int submesh_id = 0, int num_instances = 0, int lod = 0 );
 	void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+	//matrices (and optionally colors for a_instance_color) already in a buffer, like RingBuffer::getDefault
+	void renderInstanced(unsigned int primitive, unsigned int instances_buffer_id, size_t models_offset, int number, size_t colors_offset = (size_t)-1, int lod = 0);
 	void renderBounding( const Matrix44& model, bool world_bounding = true );
 	void renderFixedPipeline(int primitive); //sloooooooow
 	void renderAnimated(unsigned int primitive, Skeleton *sk);
+	void renderClusters(unsigned int primitive, const Matrix44& model, Camera* camera, bool backface_culling = true); //only the visible clusters, the whole mesh if it has none
+	void renderSubmeshes(unsigned int primitive, const std::vector<int>& submeshes, int num_instances = 0); //all in one multi draw, ids start in 0 (unlike render)
+	void renderSubmeshes(unsigned int primitive, int material_id, int num_instances = 0); //the submeshes with that material
 
 	void enableBuffers(Shader* shader);
-	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
+	void drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod = 0);
+	void drawRanges(unsigned int primitive, const sDrawRanges& ranges, int num_instances = 0);
 	void disableBuffers(Shader* shader);
+	void setQuantizationUniforms(Shader* shader);
+	bool bindVAO(Shader* shader); //creates it the first time, false if the mesh is not in VRAM
+	void unbindVAO();
+	void releaseVAOs(); //when the buffers change
 
 	bool readBin(const char* filename);
 	bool writeBin(const char* filename);
+	bool unmap(); //copies the mapped streams to the vectors so they can be modified
+
+	sStreams getStreams();
 
 	unsigned int getNumSubmaterials() { return material_name.size(); }
 	unsigned int getNumSubmeshes() { return material_range.size(); }
-	unsigned int getNumVertices() { return interleaved.size() ? interleaved.size() : vertices.size(); }
+	void getSubmeshRange(int submesh, unsigned int& start, unsigned int& count); //in triangles
+	void getSubmeshesOfMaterial(int material_id, std::vector<int>& submeshes);
+	unsigned int getNumVertices() { return mapped_file ? mapped_streams.num_vertices : (interleaved.size() ? interleaved.size() : (quantized.size() ? quantized.size() : vertices.size())); }
+	unsigned int getNumTriangles() { return mapped_file ? mapped_streams.num_triangles : (indices.size() ? indices.size() : getNumVertices() / 3); }
+	unsigned int getNumLODs() { return lods.size() + 1; }
+	bool isIndexed() { return mapped_file ? mapped_streams.indices != NULL : indices.size() != 0; }
+	bool canUse16BitIndices() { return getNumVertices() <= 0x10000; }
+	size_t getCPUBytes(); //vectors and mapped file
+	size_t getVRAMBytes(); //buffers uploaded
+
+	//fills ranges with the clusters inside the frustum and facing the camera, consecutive ones are merged. Returns false if the mesh has no clusters
+	bool cullClusters(const Matrix44& model, Camera* camera, sDrawRanges& ranges, bool backface_culling = true);
+
+	//lod to use for a given size on screen (see Camera::getProjectedScale), current_lod is the one used the last time
+	int selectLOD(float projected_size, int current_lod = 0);
 
 	//collision testing
 	void* collision_model;
@@ -100,7 +216,9 @@ public:
 	bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
 
 	//loader
-	static Mesh* Get(const char* filename);
+	static Mesh* Get(const char* filename); //with ResourceLoader::async it returns a cube that gets the mesh once loaded
+	bool load(const char* filename); //reads the .mbin (or the ascii and bakes the .mbin), without uploading to VRAM
+	void moveFrom(Mesh* mesh); //takes all the data and buffers of mesh, leaving it empty
 	void registerMesh(std::string name);
 
 	//create help meshes
@@ -112,11 +230,19 @@ public:
 	void createGrid(float dist);
 	void displace(Image* heightmap, float altitude);
 	static Mesh* getQuad(); //get global quad
+	static void endFrame(); //keeps the stats of the frame in the _last_frame ones and resets them
 
 
 	//optimize meshes
 	void uploadToVRAM();
 	bool interleaveBuffers();
+	bool weldVertices(); //converts a triangle soup in an indexed mesh
+	bool computeQuantized(std::vector<tQuantized>& output, sQuantization& params); //from the float streams, the mesh is not modified
+	bool quantize(); //replaces the float vertices, normals and uvs by the quantized version
+	bool optimize(sVertexCacheStats* before = NULL, sVertexCacheStats* after = NULL); //vertex cache, overdraw and vertex fetch order
+	bool buildClusters(unsigned int max_triangles = MESHOPT_CLUSTER_TRIANGLES); //reorders the triangles of every submesh in clusters
+	bool generateLODs(); //simplifies to 50, 25, 12 and 6% of the triangles while it makes progress
+	void getPositions(std::vector<Vector3>& positions); //from any stream, decoded if quantized
 
 private:
 	bool loadASE(const char* filename);
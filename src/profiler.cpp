@@ -0,0 +1,368 @@
+#include "profiler.h"
+#include "includes.h"
+#include "utils.h"
+#include "extra/imgui/imgui.h"
+
+#include <iostream>
+#include <cstdio>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+bool Profiler::enabled = true;
+bool Profiler::paused = false;
+float Profiler::spike_ms = 0.0f;
+int Profiler::max_spike_exports = 5;
+
+//the events of one thread, the open ones are only touched by the thread so they do not need the lock
+struct sThreadBuffer {
+	int id;
+	std::string name;
+	std::vector<Profiler::sEvent> open;
+	std::mutex mutex;
+	std::vector<Profiler::sEvent> done;
+};
+
+static std::mutex threads_mutex;
+static std::vector<sThreadBuffer*> threads; //never deleted, the events can outlive the thread
+static thread_local sThreadBuffer* thread_buffer = NULL;
+
+static Profiler::sFrame frames[Profiler::MAX_FRAMES];
+static long frame_counter = 0; //the frame being recorded
+static int num_frames_recorded = 0;
+static uint64_t frame_start = 0;
+static long spike_frame = -1; //exported some frames later, when its GPU ranges are available
+static int num_spike_exports = 0;
+
+struct sGPUQuery {
+	GLuint query;
+	const char* name;
+	long frame;
+	uint64_t start;
+};
+
+static int timer_queries = -1; //unknown till the first use
+static bool gpu_range_open = false;
+static sGPUQuery open_query;
+static std::vector<sGPUQuery> pending_queries; //in the order they were issued
+static std::vector<GLuint> free_queries;
+
+static const std::chrono::steady_clock::time_point profiler_start = std::chrono::steady_clock::now();
+
+uint64_t Profiler::getTime()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profiler_start).count();
+}
+
+static sThreadBuffer* getThreadBuffer()
+{
+	if (thread_buffer)
+		return thread_buffer;
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	thread_buffer = new sThreadBuffer();
+	thread_buffer->id = (int)threads.size();
+	thread_buffer->name = "Thread " + std::to_string(thread_buffer->id);
+	threads.push_back(thread_buffer);
+	return thread_buffer;
+}
+
+void Profiler::setThreadName(const char* name)
+{
+	sThreadBuffer* buffer = getThreadBuffer();
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	buffer->name = name;
+}
+
+void Profiler::begin(const char* name)
+{
+	sThreadBuffer* buffer = getThreadBuffer();
+	sEvent event;
+	event.name = name;
+	event.start = getTime();
+	event.end = 0;
+	event.depth = (int)buffer->open.size();
+	event.thread = buffer->id;
+	buffer->open.push_back(event);
+}
+
+void Profiler::end()
+{
+	sThreadBuffer* buffer = getThreadBuffer();
+	if (buffer->open.empty()) //enabled in the middle of a scope
+		return;
+	sEvent event = buffer->open.back();
+	buffer->open.pop_back();
+	event.end = getTime();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	buffer->done.push_back(event);
+}
+
+bool Profiler::beginGPU(const char* name)
+{
+	if (timer_queries == -1)
+		timer_queries = isGLExtensionSupported("GL_ARB_timer_query") ? 1 : 0;
+	if (!timer_queries || gpu_range_open || paused)
+		return false;
+
+	if (free_queries.empty())
+	{
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		free_queries.push_back(query);
+	}
+	open_query.query = free_queries.back();
+	free_queries.pop_back();
+	open_query.name = name;
+	open_query.frame = frame_counter;
+	open_query.start = getTime();
+	glBeginQuery(GL_TIME_ELAPSED, open_query.query);
+	gpu_range_open = true;
+	return true;
+}
+
+void Profiler::endGPU()
+{
+	assert(gpu_range_open);
+	glEndQuery(GL_TIME_ELAPSED);
+	pending_queries.push_back(open_query);
+	gpu_range_open = false;
+}
+
+//the queries finish in order, it stops at the first one not available
+static void readGPUQueries()
+{
+	size_t num_read = 0;
+	for (; num_read < pending_queries.size(); ++num_read)
+	{
+		sGPUQuery& query = pending_queries[num_read];
+		if (frame_counter - query.frame < Profiler::MAX_FRAMES)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query.query, GL_QUERY_RESULT, &elapsed);
+
+			Profiler::sFrame& frame = frames[query.frame % Profiler::MAX_FRAMES];
+			if (frame.frame == query.frame)
+			{
+				Profiler::sEvent event;
+				event.name = query.name;
+				event.start = query.start;
+				event.end = query.start + elapsed;
+				event.depth = 0;
+				event.thread = Profiler::GPU_THREAD;
+				frame.events.push_back(event);
+			}
+		}
+		free_queries.push_back(query.query); //too old, its frame is not in the ring anymore
+	}
+	pending_queries.erase(pending_queries.begin(), pending_queries.begin() + num_read);
+}
+
+void Profiler::endFrame()
+{
+	uint64_t now = getTime();
+
+	std::vector<sThreadBuffer*> buffers;
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		buffers = threads;
+	}
+
+	if (paused)
+	{
+		for (size_t i = 0; i < buffers.size(); ++i)
+		{
+			std::lock_guard<std::mutex> lock(buffers[i]->mutex);
+			buffers[i]->done.clear();
+		}
+		frame_start = now;
+		return;
+	}
+
+	sFrame& frame = frames[frame_counter % MAX_FRAMES];
+	frame.frame = frame_counter;
+	frame.start = frame_start;
+	frame.end = now;
+	frame.events.clear();
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		std::lock_guard<std::mutex> lock(buffers[i]->mutex);
+		frame.events.insert(frame.events.end(), buffers[i]->done.begin(), buffers[i]->done.end());
+		buffers[i]->done.clear();
+	}
+	num_frames_recorded = std::min(num_frames_recorded + 1, (int)MAX_FRAMES);
+
+	if (spike_ms > 0.0f && spike_frame == -1 && num_spike_exports < max_spike_exports && (now - frame_start) * 1e-6 > spike_ms)
+		spike_frame = frame_counter;
+
+	frame_counter++;
+	frame_start = now;
+	readGPUQueries();
+
+	//a few frames later so the GPU ranges of the spike are there
+	if (spike_frame != -1 && frame_counter - spike_frame > 4)
+	{
+		std::string filename = "profile_spike_" + std::to_string(spike_frame) + ".json";
+		if (exportChromeTrace(filename.c_str()))
+			std::cout << " * Frame spike exported: " << filename << std::endl;
+		num_spike_exports++;
+		spike_frame = -1;
+	}
+}
+
+const Profiler::sFrame* Profiler::getFrame(int age)
+{
+	if (age < 0 || age >= num_frames_recorded)
+		return NULL;
+	return &frames[(frame_counter - 1 - age) % MAX_FRAMES];
+}
+
+bool Profiler::exportChromeTrace(const char* filename, int num_frames)
+{
+	FILE* f = fopen(filename, "wb");
+	if (!f)
+	{
+		std::cout << "[ERROR] cannot write the trace: " << filename << std::endl;
+		return false;
+	}
+
+	const int frames_tid = 10000;
+	const int gpu_tid = 10001;
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Frames\"}},\n", frames_tid);
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", gpu_tid);
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (size_t i = 0; i < threads.size(); ++i)
+			fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", threads[i]->id, escapeJSON(threads[i]->name.c_str()).c_str());
+	}
+
+	//the oldest first, times in microseconds
+	for (int age = std::min(num_frames, num_frames_recorded) - 1; age >= 0; --age)
+	{
+		const sFrame* frame = getFrame(age);
+		fprintf(f, ",\n{\"name\":\"Frame %ld\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", frame->frame, frames_tid, frame->start * 0.001, (frame->end - frame->start) * 0.001);
+		for (size_t i = 0; i < frame->events.size(); ++i)
+		{
+			const sEvent& event = frame->events[i];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", escapeJSON(event.name).c_str(),
+				event.thread == GPU_THREAD ? gpu_tid : event.thread, event.start * 0.001, (event.end - event.start) * 0.001);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
+
+static float getFrameMs(void* data, int index)
+{
+	const Profiler::sFrame* frame = Profiler::getFrame(*(int*)data - 1 - index);
+	return frame ? (frame->end - frame->start) * 1e-6f : 0.0f;
+}
+
+void Profiler::renderInMenu()
+{
+	static int selected_age = 0;
+	static std::string export_result;
+
+	ImGui::Checkbox("Enabled", &enabled);
+	ImGui::SameLine();
+	ImGui::Checkbox("Pause", &paused);
+
+	int num = num_frames_recorded;
+	if (!num)
+		return;
+
+	//frame times, the oldest on the left, click to select one
+	ImGui::PlotHistogram("##frames", getFrameMs, &num, num, 0, "frame ms", 0.0f, FLT_MAX, ImVec2(ImGui::GetContentRegionAvail().x, 60));
+	if (ImGui::IsItemHovered() && ImGui::IsMouseClicked(0))
+	{
+		ImVec2 min = ImGui::GetItemRectMin();
+		ImVec2 max = ImGui::GetItemRectMax();
+		int index = (int)((ImGui::GetIO().MousePos.x - min.x) / (max.x - min.x) * num);
+		selected_age = num - 1 - std::max(0, std::min(num - 1, index));
+		paused = true;
+	}
+	ImGui::SliderInt("Age", &selected_age, 0, num - 1);
+	ImGui::SameLine();
+	if (ImGui::Button("Slowest"))
+	{
+		float slowest = 0.0f;
+		for (int i = 0; i < num; ++i)
+			if (getFrameMs(&num, num - 1 - i) > slowest)
+			{
+				slowest = getFrameMs(&num, num - 1 - i);
+				selected_age = i;
+			}
+		paused = true;
+	}
+	selected_age = std::max(0, std::min(num - 1, selected_age));
+
+	const sFrame* frame = getFrame(selected_age);
+	double frame_ns = (double)std::max<uint64_t>(frame->end - frame->start, 1);
+	ImGui::Text("Frame %ld: %.3fms", frame->frame, frame_ns * 1e-6);
+
+	//one row per depth of every thread, the GPU at the end
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (size_t i = 0; i < threads.size(); ++i)
+			names.push_back(threads[i]->name);
+	}
+	names.push_back("GPU");
+	std::vector<int> depths(names.size(), 0);
+	for (size_t i = 0; i < frame->events.size(); ++i)
+	{
+		const sEvent& event = frame->events[i];
+		int thread = event.thread == GPU_THREAD ? (int)names.size() - 1 : event.thread;
+		depths[thread] = std::max(depths[thread], event.depth + 1);
+	}
+	std::vector<int> first_row(names.size(), 0);
+	int num_rows = 0;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		first_row[i] = num_rows;
+		num_rows += depths[i];
+	}
+
+	const float label_width = 80.0f;
+	const float row_height = ImGui::GetTextLineHeight() + 4.0f;
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	float width = std::max(ImGui::GetContentRegionAvail().x - label_width, 100.0f);
+	ImDrawList* draw_list = ImGui::GetWindowDrawList();
+	for (size_t i = 0; i < names.size(); ++i)
+		if (depths[i])
+			draw_list->AddText(ImVec2(origin.x, origin.y + first_row[i] * row_height + 2.0f), IM_COL32(200, 200, 200, 255), names[i].c_str());
+
+	for (size_t i = 0; i < frame->events.size(); ++i)
+	{
+		const sEvent& event = frame->events[i];
+		int thread = event.thread == GPU_THREAD ? (int)names.size() - 1 : event.thread;
+		double start = std::max(0.0, (double)event.start - (double)frame->start);
+		double end = std::min(frame_ns, (double)event.end - (double)frame->start);
+		if (end <= start)
+			continue;
+		ImVec2 min(origin.x + label_width + float(start / frame_ns) * width, origin.y + (first_row[thread] + event.depth) * row_height);
+		ImVec2 max(origin.x + label_width + float(end / frame_ns) * width, min.y + row_height - 1.0f);
+		max.x = std::max(max.x, min.x + 1.0f);
+
+		unsigned int hash = 0;
+		for (const char* c = event.name; *c; ++c)
+			hash = hash * 31 + *c;
+		draw_list->AddRectFilled(min, max, ImColor::HSV((hash % 360) / 360.0f, 0.5f, 0.7f));
+		if (ImGui::CalcTextSize(event.name).x < max.x - min.x - 4.0f)
+			draw_list->AddText(ImVec2(min.x + 2.0f, min.y + 2.0f), IM_COL32(255, 255, 255, 255), event.name);
+		if (ImGui::IsMouseHoveringRect(min, max))
+			ImGui::SetTooltip("%s: %.3fms", event.name, (event.end - event.start) * 1e-6);
+	}
+	ImGui::Dummy(ImVec2(label_width + width, num_rows * row_height));
+
+	if (ImGui::Button("Export trace"))
+		export_result = exportChromeTrace("profile.json") ? "Saved profile.json, open it in chrome://tracing" : "Cannot write profile.json";
+	if (!export_result.empty())
+		ImGui::Text("%s", export_result.c_str());
+	ImGui::DragFloat("Export spikes over (ms)", &spike_ms, 0.1f, 0.0f, 1000.0f);
+}
@@ -0,0 +1,95 @@
+/*  Frame profiler. PROFILE_SCOPE("name") measures the scope in nanoseconds in any thread, every thread writes in
+	its own buffer and the main thread collects them once per frame (endFrame) in a ring of the last frames.
+	PROFILE_GPU_SCOPE also measures the GPU time of the GL calls in the scope with a GL_TIME_ELAPSED query, read
+	some frames later when it is available so it never stalls. These queries cannot be nested, the GPU scopes inside
+	another one are only measured in the CPU. They are placed in the timeline where the CPU started them.
+	renderInMenu shows a timeline of the frames and the slow frames can be exported to chrome://tracing.
+	The names must be literals, only the pointer is kept.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class Profiler
+{
+public:
+	enum { MAX_FRAMES = 120 };
+
+	struct sEvent {
+		const char* name;
+		uint64_t start; //ns since the profiler started
+		uint64_t end;
+		int depth;
+		int thread; //GPU_THREAD for the GPU ranges
+	};
+
+	struct sFrame {
+		long frame;
+		uint64_t start;
+		uint64_t end;
+		std::vector<sEvent> events;
+	};
+
+	static const int GPU_THREAD = -1;
+
+	static bool enabled;
+	static bool paused; //the frames are not recorded, to look at them
+	static float spike_ms; //frames longer than this are exported to profile_spike_N.json, 0 disables it
+	static int max_spike_exports;
+
+	static uint64_t getTime(); //ns
+	static void setThreadName(const char* name); //for the timeline, from the thread
+
+	static void begin(const char* name);
+	static void end();
+	static bool beginGPU(const char* name); //false if another GPU range is open
+	static void endGPU();
+
+	static void endFrame(); //main thread, after the swap
+	static const sFrame* getFrame(int age); //0 is the last finished frame, NULL if not recorded
+	static bool exportChromeTrace(const char* filename, int num_frames = MAX_FRAMES);
+	static void renderInMenu();
+};
+
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name, bool gpu = false)
+	{
+		active = Profiler::enabled;
+		gpu_range = false;
+		if (!active)
+			return;
+		Profiler::begin(name);
+		if (gpu)
+			gpu_range = Profiler::beginGPU(name);
+	}
+	~ProfileScope()
+	{
+		if (gpu_range)
+			Profiler::endGPU();
+		if (active)
+			Profiler::end();
+	}
+
+private:
+	bool active;
+	bool gpu_range;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#ifndef NO_PROFILER
+	#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+	#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name, true)
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_GPU_SCOPE(name)
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+#include "renderqueue.h"
+#include "scenenode.h"
+#include "material.h"
+#include "camera.h"
+#include "shader.h"
+#include "glstate.h"
+#include "profiler.h"
+
+#include <cassert>
+
+int RenderQueue::num_packets = 0;
+int RenderQueue::num_program_switches = 0;
+int RenderQueue::num_texture_switches = 0;
+int RenderQueue::saved_program_switches = 0;
+int RenderQueue::saved_texture_switches = 0;
+
+//bits of the key, from the most significant
+#define KEY_PASS_SHIFT 60 //4 bits
+#define KEY_LAYER_SHIFT 58 //2 bits
+#define KEY_SHADER_BITS 14
+#define KEY_MATERIAL_BITS 16
+#define KEY_DEPTH_BITS 24
+
+uint64_t RenderQueue::computeKey(int pass, eLayer layer, Shader* shader, Material* material, float depth)
+{
+	uint64_t shader_id = shader ? shader->uid & ((1 << KEY_SHADER_BITS) - 1) : 0;
+	uint64_t material_id = material ? material->id & ((1 << KEY_MATERIAL_BITS) - 1) : 0;
+	depth = clamp(depth, 0.0f, 1.0f);
+	uint64_t depth_bucket = (uint64_t)(depth * ((1 << KEY_DEPTH_BITS) - 1));
+
+	uint64_t key = ((uint64_t)(pass & 0xF) << KEY_PASS_SHIFT) | ((uint64_t)(layer & 0x3) << KEY_LAYER_SHIFT);
+	if (layer == LAYER_TRANSLUCENT) //back to front first
+	{
+		depth_bucket = ((1 << KEY_DEPTH_BITS) - 1) - depth_bucket;
+		key |= depth_bucket << (KEY_LAYER_SHIFT - KEY_DEPTH_BITS);
+		key |= shader_id << (KEY_LAYER_SHIFT - KEY_DEPTH_BITS - KEY_SHADER_BITS);
+		key |= material_id << (KEY_LAYER_SHIFT - KEY_DEPTH_BITS - KEY_SHADER_BITS - KEY_MATERIAL_BITS);
+	}
+	else
+	{
+		key |= shader_id << (KEY_LAYER_SHIFT - KEY_SHADER_BITS);
+		key |= material_id << (KEY_LAYER_SHIFT - KEY_SHADER_BITS - KEY_MATERIAL_BITS);
+		key |= depth_bucket << (KEY_LAYER_SHIFT - KEY_SHADER_BITS - KEY_MATERIAL_BITS - KEY_DEPTH_BITS);
+	}
+	return key;
+}
+
+//distance to the camera relative to the far plane
+static float computeDepth(const Vector3& center, Camera* camera)
+{
+	return camera->far_plane > 0.0f ? (float)(center - camera->eye).length() / camera->far_plane : 0.0f;
+}
+
+void RenderQueue::clear()
+{
+	packets.clear();
+}
+
+void RenderQueue::add(SceneNode* node, Camera* camera, int pass)
+{
+	add(node->material, node->mesh, node->model, node->lod, camera, pass);
+}
+
+void RenderQueue::add(Material* material, Mesh* mesh, const Matrix44& model, int lod, Camera* camera, int pass)
+{
+	if (!material || !mesh)
+		return;
+
+	sDrawPacket packet;
+	packet.material = material;
+	packet.shader = material->getShader();
+	packet.mesh = mesh;
+	packet.model = model;
+	packet.lod = lod;
+	packet.num_instances = 0;
+	packet.instances_buffer_id = 0;
+	packet.models_offset = packet.colors_offset = 0;
+	eLayer layer = material->transparent ? LAYER_TRANSLUCENT : LAYER_OPAQUE;
+	packet.key = computeKey(pass, layer, packet.shader, material, computeDepth(model * mesh->box.center, camera));
+	packets.push_back(packet);
+}
+
+void RenderQueue::addInstanced(Material* material, Mesh* mesh, int lod, const Vector3& center, unsigned int instances_buffer_id, size_t models_offset, size_t colors_offset, int num_instances, Camera* camera, int pass)
+{
+	sDrawPacket packet;
+	packet.material = material;
+	packet.shader = material->getInstancedShader();
+	packet.mesh = mesh;
+	packet.lod = lod;
+	packet.num_instances = num_instances;
+	packet.instances_buffer_id = instances_buffer_id;
+	packet.models_offset = models_offset;
+	packet.colors_offset = colors_offset;
+	eLayer layer = material->transparent ? LAYER_TRANSLUCENT : LAYER_OPAQUE;
+	packet.key = computeKey(pass, layer, packet.shader, material, computeDepth(center, camera));
+	packets.push_back(packet);
+}
+
+void RenderQueue::addCallback(std::function<void(Camera*)> callback, eLayer layer, float depth, int pass)
+{
+	sDrawPacket packet;
+	packet.material = NULL;
+	packet.shader = NULL;
+	packet.mesh = NULL;
+	packet.lod = 0;
+	packet.num_instances = 0;
+	packet.instances_buffer_id = 0;
+	packet.models_offset = packet.colors_offset = 0;
+	packet.callback = callback;
+	packet.key = computeKey(pass, layer, NULL, NULL, depth);
+	packets.push_back(packet);
+}
+
+//LSD radix sort, 8 bits per pass, the passes where all the keys have the same byte are skipped
+void RenderQueue::sort()
+{
+	items.resize(packets.size());
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		items[i].key = packets[i].key;
+		items[i].index = (unsigned int)i;
+	}
+	temp.resize(items.size());
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t counts[256] = { 0 };
+		for (size_t i = 0; i < items.size(); ++i)
+			counts[(items[i].key >> shift) & 0xFF]++;
+		if (counts[(items[0].key >> shift) & 0xFF] == items.size())
+			continue;
+
+		size_t offsets[256];
+		size_t total = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			offsets[i] = total;
+			total += counts[i];
+		}
+		for (size_t i = 0; i < items.size(); ++i)
+			temp[offsets[(items[i].key >> shift) & 0xFF]++] = items[i];
+		items.swap(temp);
+	}
+}
+
+//program and texture changes in the sorted order against the order they were added
+void RenderQueue::countSwitches()
+{
+	int unsorted_programs = 0, unsorted_textures = 0;
+	num_program_switches = num_texture_switches = 0;
+	Shader* last_shader = NULL, *last_sorted_shader = NULL;
+	Texture* last_texture = NULL, *last_sorted_texture = NULL;
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		Material* material = packets[i].material;
+		Material* sorted_material = packets[items[i].index].material;
+		Shader* shader = packets[i].shader;
+		Shader* sorted_shader = packets[items[i].index].shader;
+		Texture* texture = material ? material->texture.get() : NULL;
+		Texture* sorted_texture = sorted_material ? sorted_material->texture.get() : NULL;
+
+		if (shader != last_shader)
+			unsorted_programs++;
+		if (texture != last_texture)
+			unsorted_textures++;
+		if (sorted_shader != last_sorted_shader)
+			num_program_switches++;
+		if (sorted_texture != last_sorted_texture)
+			num_texture_switches++;
+		last_shader = shader;
+		last_texture = texture;
+		last_sorted_shader = sorted_shader;
+		last_sorted_texture = sorted_texture;
+	}
+	saved_program_switches = unsorted_programs - num_program_switches;
+	saved_texture_switches = unsorted_textures - num_texture_switches;
+}
+
+void RenderQueue::setLayerState(int layer)
+{
+	if (layer == LAYER_TRANSLUCENT)
+	{
+		GLState::enable(GL_BLEND);
+		GLState::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		GLState::depthMask(false);
+		GLState::depthFunc(GL_LESS);
+	}
+	else if (layer == LAYER_SKY)
+	{
+		GLState::disable(GL_BLEND);
+		GLState::depthMask(false);
+		GLState::depthFunc(GL_LEQUAL);
+	}
+	else
+	{
+		GLState::disable(GL_BLEND);
+		GLState::depthMask(true);
+		GLState::depthFunc(GL_LESS);
+	}
+}
+
+void RenderQueue::submit(Camera* camera)
+{
+	PROFILE_SCOPE("submit");
+	num_packets = (int)packets.size();
+	if (packets.empty())
+	{
+		num_program_switches = num_texture_switches = saved_program_switches = saved_texture_switches = 0;
+		return;
+	}
+
+	sort();
+	countSwitches();
+
+	int layer = -1;
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		sDrawPacket& packet = packets[items[i].index];
+		int packet_layer = (int)((packet.key >> KEY_LAYER_SHIFT) & 0x3);
+		if (packet_layer != layer)
+		{
+			setLayerState(packet_layer);
+			layer = packet_layer;
+		}
+
+		if (packet.callback)
+			packet.callback(camera);
+		else if (packet.num_instances)
+			packet.material->renderInstanced(packet.mesh, camera, packet.instances_buffer_id, packet.models_offset, packet.colors_offset, packet.num_instances, packet.lod);
+		else
+			packet.material->render(packet.mesh, packet.model, camera, packet.lod);
+	}
+
+	//back to the default state
+	setLayerState(LAYER_OPAQUE);
+	if (Shader::current)
+		Shader::current->disable();
+}
@@ -0,0 +1,76 @@
+/*  Draws collected during the frame and submitted sorted by a 64 bits key: first the pass, then the layer (opaque,
+	sky, translucent), then for the opaque ones shader, material and depth (front to back, for early-Z), and for the
+	translucent ones depth (back to front), shader and material. So the program and texture changes are grouped.
+	The keys are radix sorted every frame, equal keys keep the order they were added.
+*/
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "framework.h"
+
+class SceneNode;
+class Material;
+class Mesh;
+class Shader;
+class Camera;
+
+class RenderQueue
+{
+public:
+	enum eLayer {
+		LAYER_OPAQUE = 0,
+		LAYER_SKY = 1, //after the opaque ones, only where nothing was drawn (the sky shader must put it in the far plane)
+		LAYER_TRANSLUCENT = 2
+	};
+
+	struct sDrawPacket {
+		uint64_t key;
+		Material* material;
+		Shader* shader; //the permutation the material binds, for the key and the stats
+		Mesh* mesh;
+		Matrix44 model; //copied, the node can be updated while the queue is submitted
+		int lod;
+		int num_instances; //0 if not instanced
+		unsigned int instances_buffer_id;
+		size_t models_offset;
+		size_t colors_offset;
+		std::function<void(Camera*)> callback; //for draws that are not a material and a mesh
+	};
+
+	//stats of the last submit
+	static int num_packets;
+	static int num_program_switches;
+	static int num_texture_switches;
+	static int saved_program_switches; //compared to the order they were added
+	static int saved_texture_switches;
+
+	void clear(); //every frame before adding
+	void add(SceneNode* node, Camera* camera, int pass = 0); //the lod of the node must be updated
+	void add(Material* material, Mesh* mesh, const Matrix44& model, int lod, Camera* camera, int pass = 0);
+	void addInstanced(Material* material, Mesh* mesh, int lod, const Vector3& center, unsigned int instances_buffer_id, size_t models_offset, size_t colors_offset, int num_instances, Camera* camera, int pass = 0);
+	void addCallback(std::function<void(Camera*)> callback, eLayer layer, float depth = 0, int pass = 0);
+	void submit(Camera* camera); //sorts and draws, the shader is disabled at the end
+
+	static uint64_t computeKey(int pass, eLayer layer, Shader* shader, Material* material, float depth); //depth from 0 (near) to 1 (far)
+
+private:
+	struct sSortItem {
+		uint64_t key;
+		unsigned int index;
+	};
+
+	std::vector<sDrawPacket> packets;
+	std::vector<sSortItem> items; //reused every frame to avoid allocations
+	std::vector<sSortItem> temp;
+
+	void sort();
+	void countSwitches();
+	void setLayerState(int layer);
+};
+
+#endif
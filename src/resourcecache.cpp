@@ -0,0 +1,40 @@
+#include "resourcecache.h"
+
+ResourceCacheBase::ResourceCacheBase(const char* type_name, size_t cpu_budget, size_t vram_budget)
+{
+	this->type_name = type_name;
+	this->cpu_budget = cpu_budget;
+	this->vram_budget = vram_budget;
+	cpu_bytes = vram_bytes = 0;
+	num_evicted = 0;
+	getCaches().push_back(this);
+}
+
+//function static so it exists before the caches of other translation units are constructed
+std::vector<ResourceCacheBase*>& ResourceCacheBase::getCaches()
+{
+	static std::vector<ResourceCacheBase*> caches;
+	return caches;
+}
+
+void ResourceCacheBase::UpdateAll()
+{
+	std::vector<ResourceCacheBase*>& caches = getCaches();
+	for (size_t i = 0; i < caches.size(); ++i)
+		caches[i]->update();
+}
+
+std::string ResourceCacheBase::getStats()
+{
+	std::string str;
+	std::vector<ResourceCacheBase*>& caches = getCaches();
+	for (size_t i = 0; i < caches.size(); ++i)
+	{
+		ResourceCacheBase* cache = caches[i];
+		str += std::string(cache->type_name) + ": " + std::to_string(cache->getNumEntries()) + " RAM: " + std::to_string(int(cache->cpu_bytes / (1024 * 1024))) + "MBs VRAM: " + std::to_string(int(cache->vram_bytes / (1024 * 1024))) + "MBs";
+		if (cache->num_evicted)
+			str += " Evicted: " + std::to_string(cache->num_evicted);
+		str += "\n";
+	}
+	return str;
+}
@@ -0,0 +1,243 @@
+/*  Caches of named resources (meshes, textures, shaders...) with memory accounting and LRU eviction.
+	Every type has one ResourceCache. Get functions return raw pointers as always, those entries are kept forever.
+	Once an entry has been held by a ResourceHandle it is managed: when no handle holds it anymore it can be
+	deleted (least recently used first) if the cache goes over its CPU or VRAM budget.
+	The entries can be looked up and added from any thread, but update (which deletes) must run in the main thread.
+*/
+
+#ifndef RESOURCECACHE_H
+#define RESOURCECACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <cassert>
+
+#include "resourceloader.h"
+
+class ResourceCacheBase
+{
+public:
+	const char* type_name;
+	size_t cpu_budget; //in bytes, 0 means no limit
+	size_t vram_budget;
+	size_t cpu_bytes; //of all the entries, updated by update
+	size_t vram_bytes;
+	int num_evicted;
+
+	ResourceCacheBase(const char* type_name, size_t cpu_budget, size_t vram_budget);
+	virtual ~ResourceCacheBase() {}
+
+	virtual int getNumEntries() = 0;
+	virtual void update() = 0; //recomputes the bytes and evicts while over budget
+
+	static std::vector<ResourceCacheBase*>& getCaches();
+	static void UpdateAll(); //once per frame from the main thread
+	static std::string getStats();
+};
+
+template<class T> class ResourceCache : public ResourceCacheBase
+{
+public:
+	static ResourceCache<T>* instance; //used by ResourceHandle
+
+	ResourceCache(const char* type_name, size_t cpu_budget = 0, size_t vram_budget = 0) : ResourceCacheBase(type_name, cpu_budget, vram_budget)
+	{
+		assert(!instance && "only one cache per type");
+		instance = this;
+		clock = 0;
+	}
+
+	//NULL if not found
+	T* find(const std::string& name)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		auto it = by_name.find(name);
+		if (it == by_name.end())
+			return NULL;
+		it->second->last_used = ++clock;
+		return it->second->resource;
+	}
+
+	//the same resource can be added with several names
+	void add(const std::string& name, T* resource)
+	{
+		assert(resource);
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		auto it = by_name.find(name);
+		if (it != by_name.end())
+		{
+			if (it->second->resource == resource)
+				return;
+			forgetName(it->second, name);
+		}
+
+		sEntry* entry = NULL;
+		auto it2 = by_resource.find(resource);
+		if (it2 != by_resource.end())
+			entry = it2->second;
+		else
+		{
+			entry = new sEntry();
+			entry->resource = resource;
+			entry->refs = 0;
+			entry->managed = false;
+			entry->cpu_bytes = entry->vram_bytes = 0;
+			by_resource[resource] = entry;
+		}
+		entry->names.push_back(name);
+		entry->last_used = ++clock;
+		by_name[name] = entry;
+	}
+
+	//the resource is forgotten, but not deleted
+	void remove(const T* resource)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		auto it = by_resource.find(resource);
+		if (it == by_resource.end())
+			return;
+		sEntry* entry = it->second;
+		for (size_t i = 0; i < entry->names.size(); ++i)
+			by_name.erase(entry->names[i]);
+		by_resource.erase(it);
+		delete entry;
+	}
+
+	//resources not in the cache are ignored
+	void addRef(const T* resource)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		auto it = by_resource.find(resource);
+		if (it == by_resource.end())
+			return;
+		it->second->refs++;
+		it->second->managed = true;
+		it->second->last_used = ++clock;
+	}
+
+	void release(const T* resource)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		auto it = by_resource.find(resource);
+		if (it == by_resource.end())
+			return;
+		assert(it->second->refs > 0);
+		it->second->refs--;
+	}
+
+	void forEach(std::function<void(T*)> callback)
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		for (auto it = by_resource.begin(); it != by_resource.end(); ++it)
+			callback(it->second->resource);
+	}
+
+	int getNumEntries()
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		return (int)by_resource.size();
+	}
+
+	//the types provide getCPUBytes and getVRAMBytes
+	void update()
+	{
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		cpu_bytes = vram_bytes = 0;
+		std::vector<sEntry*> candidates;
+		for (auto it = by_resource.begin(); it != by_resource.end(); ++it)
+		{
+			sEntry* entry = it->second;
+			entry->cpu_bytes = entry->resource->getCPUBytes();
+			entry->vram_bytes = entry->resource->getVRAMBytes();
+			cpu_bytes += entry->cpu_bytes;
+			vram_bytes += entry->vram_bytes;
+			if (entry->managed && entry->refs == 0 && !ResourceLoader::isLoading(entry->resource))
+				candidates.push_back(entry);
+		}
+
+		if (!isOverBudget() || candidates.empty())
+			return;
+
+		//least recently used first
+		std::sort(candidates.begin(), candidates.end(), [](const sEntry* a, const sEntry* b) { return a->last_used < b->last_used; });
+		for (size_t i = 0; i < candidates.size() && isOverBudget(); ++i)
+		{
+			sEntry* entry = candidates[i];
+			T* resource = entry->resource;
+			cpu_bytes -= entry->cpu_bytes;
+			vram_bytes -= entry->vram_bytes;
+			remove(resource);
+			delete resource;
+			num_evicted++;
+		}
+	}
+
+private:
+	struct sEntry {
+		T* resource;
+		std::vector<std::string> names;
+		int refs; //handles holding it
+		bool managed; //it has been held by a handle, so it can be evicted
+		size_t cpu_bytes;
+		size_t vram_bytes;
+		unsigned long last_used;
+	};
+
+	std::recursive_mutex mutex;
+	std::map<std::string, sEntry*> by_name;
+	std::unordered_map<const T*, sEntry*> by_resource;
+	unsigned long clock;
+
+	bool isOverBudget() { return (cpu_budget && cpu_bytes > cpu_budget) || (vram_budget && vram_bytes > vram_budget); }
+
+	void forgetName(sEntry* entry, const std::string& name)
+	{
+		by_name.erase(name);
+		entry->names.erase(std::remove(entry->names.begin(), entry->names.end(), name), entry->names.end());
+		if (entry->names.empty())
+		{
+			by_resource.erase(entry->resource);
+			delete entry;
+		}
+	}
+};
+
+template<class T> ResourceCache<T>* ResourceCache<T>::instance = NULL;
+
+//reference to a resource of a cache, while it exists the resource cannot be evicted
+//it converts to and from T* so it can replace the raw pointers
+template<class T> class ResourceHandle
+{
+public:
+	ResourceHandle(T* resource = NULL) { this->resource = NULL; set(resource); }
+	ResourceHandle(const ResourceHandle<T>& handle) { resource = NULL; set(handle.resource); }
+	~ResourceHandle() { set(NULL); }
+
+	ResourceHandle<T>& operator = (T* resource) { set(resource); return *this; }
+	ResourceHandle<T>& operator = (const ResourceHandle<T>& handle) { set(handle.resource); return *this; }
+
+	operator T*() const { return resource; }
+	T* operator -> () const { return resource; }
+	T* get() const { return resource; }
+
+private:
+	T* resource;
+
+	void set(T* new_resource)
+	{
+		if (new_resource == resource)
+			return;
+		if (new_resource && ResourceCache<T>::instance)
+			ResourceCache<T>::instance->addRef(new_resource);
+		if (resource && ResourceCache<T>::instance)
+			ResourceCache<T>::instance->release(resource);
+		resource = new_resource;
+	}
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "resourceloader.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+
+bool ResourceLoader::async = false;
+int ResourceLoader::num_threads = 0;
+float ResourceLoader::upload_budget_ms = 2.0f;
+int ResourceLoader::num_requested = 0;
+int ResourceLoader::num_completed = 0;
+int ResourceLoader::num_failed = 0;
+
+struct sLoadJob {
+	const void* resource;
+	std::string name;
+	ResourceLoader::tLoadFunc load;
+	ResourceLoader::tFinishFunc finish;
+	bool result;
+	std::promise<bool> promise;
+	std::shared_future<bool> future;
+	std::vector< std::function<void(bool)> > callbacks;
+};
+
+//only the queues are shared with the workers, the rest is used from the main thread
+static std::vector<std::thread> workers;
+static std::mutex queues_mutex;
+static std::condition_variable pending_cond; //workers wait for jobs
+static std::condition_variable done_cond; //finish waits for results
+static std::deque<sLoadJob*> pending_jobs;
+static std::deque<sLoadJob*> done_jobs;
+static bool stop_workers = false;
+static std::map<const void*, sLoadJob*> jobs; //by resource
+
+static void workerLoop()
+{
+	Profiler::setThreadName("Loader");
+	while (true)
+	{
+		sLoadJob* job = NULL;
+		{
+			std::unique_lock<std::mutex> lock(queues_mutex);
+			pending_cond.wait(lock, [] { return stop_workers || !pending_jobs.empty(); });
+			if (stop_workers)
+				return;
+			job = pending_jobs.front();
+			pending_jobs.pop_front();
+		}
+
+		{
+			PROFILE_SCOPE("load");
+			job->result = job->load();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(queues_mutex);
+			done_jobs.push_back(job);
+		}
+		done_cond.notify_all();
+	}
+}
+
+void ResourceLoader::init()
+{
+	if (workers.size())
+		return;
+
+	//file reading is a big part of the work, more threads than cores do not help
+	int num = num_threads;
+	if (num <= 0)
+		num = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	stop_workers = false;
+	for (int i = 0; i < num; ++i)
+		workers.push_back(std::thread(workerLoop));
+	std::cout << " + Resource loader: " << num << " threads" << std::endl;
+}
+
+static void finishJob(sLoadJob* job, bool result)
+{
+	if (!result && !stop_workers) //not an error if it was cancelled by shutdown
+	{
+		std::cout << "[ERROR] loading in background: " << job->name << std::endl;
+		ResourceLoader::num_failed++;
+	}
+	job->finish(result);
+	job->promise.set_value(result);
+	for (size_t i = 0; i < job->callbacks.size(); ++i)
+		job->callbacks[i](result);
+	ResourceLoader::num_completed++;
+	jobs.erase(job->resource);
+	delete job;
+}
+
+void ResourceLoader::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(queues_mutex);
+		stop_workers = true;
+	}
+	pending_cond.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+
+	//whatever was not uploaded is freed
+	pending_jobs.clear();
+	done_jobs.clear();
+	while (jobs.size())
+		finishJob(jobs.begin()->second, false);
+}
+
+void ResourceLoader::enqueue(const void* resource, const char* name, tLoadFunc load, tFinishFunc finish)
+{
+	assert(resource && jobs.find(resource) == jobs.end() && "resource already loading");
+	init();
+
+	sLoadJob* job = new sLoadJob();
+	job->resource = resource;
+	job->name = name;
+	job->load = load;
+	job->finish = finish;
+	job->result = false;
+	job->future = job->promise.get_future().share();
+	jobs[resource] = job;
+	num_requested++;
+
+	{
+		std::lock_guard<std::mutex> lock(queues_mutex);
+		pending_jobs.push_back(job);
+	}
+	pending_cond.notify_one();
+}
+
+void ResourceLoader::update(float budget_ms)
+{
+	PROFILE_SCOPE("uploads");
+	if (budget_ms < 0.0f)
+		budget_ms = upload_budget_ms;
+
+	//at least one per frame so big uploads do not stall the queue
+	auto start = std::chrono::high_resolution_clock::now();
+	while (true)
+	{
+		sLoadJob* job = NULL;
+		{
+			std::lock_guard<std::mutex> lock(queues_mutex);
+			if (done_jobs.empty())
+				return;
+			job = done_jobs.front();
+			done_jobs.pop_front();
+		}
+
+		finishJob(job, job->result);
+
+		std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		if (elapsed.count() >= budget_ms)
+			return;
+	}
+}
+
+void ResourceLoader::finish()
+{
+	while (jobs.size())
+	{
+		{
+			std::unique_lock<std::mutex> lock(queues_mutex);
+			done_cond.wait(lock, [] { return !done_jobs.empty(); });
+		}
+		update(1e10f);
+	}
+}
+
+bool ResourceLoader::isLoading(const void* resource)
+{
+	return jobs.find(resource) != jobs.end();
+}
+
+void ResourceLoader::onLoaded(const void* resource, std::function<void(bool)> callback)
+{
+	auto it = jobs.find(resource);
+	if (it == jobs.end())
+		callback(true);
+	else
+		it->second->callbacks.push_back(callback);
+}
+
+std::shared_future<bool> ResourceLoader::getFuture(const void* resource)
+{
+	auto it = jobs.find(resource);
+	if (it != jobs.end())
+		return it->second->future;
+
+	std::promise<bool> ready;
+	ready.set_value(true);
+	return ready.get_future().share();
+}
@@ -0,0 +1,47 @@
+/*  Background loading of resources (meshes, textures, animations).
+	The file reading, parsing and decoding runs in worker threads, the GL uploads run in the main thread
+	inside ResourceLoader::update with a time budget per frame. Meanwhile the Get functions return a placeholder
+	(a cube, a 1x1 texture...) that is filled when the upload is done, so the pointers stay valid.
+	All the functions must be called from the main thread.
+*/
+
+#ifndef RESOURCELOADER_H
+#define RESOURCELOADER_H
+
+#include <string>
+#include <functional>
+#include <future>
+
+class ResourceLoader
+{
+public:
+	typedef std::function<bool()> tLoadFunc; //runs in a worker, returns false if it failed
+	typedef std::function<void(bool)> tFinishFunc; //runs in the main thread with the result of the load, it must free what the load allocated
+
+	static bool async; //Get functions return a placeholder and load in the background
+	static int num_threads; //workers, 0 to use one less than the cores
+	static float upload_budget_ms; //max time per frame spent in the main thread uploading
+
+	//progress
+	static int num_requested;
+	static int num_completed;
+	static int num_failed;
+
+	static void init(); //starts the workers, called by the first enqueue if not done before
+	static void shutdown(); //stops the workers, the pending loads are finished as failed
+
+	//resource is the handle given to the user (the placeholder), it identifies the load
+	static void enqueue(const void* resource, const char* name, tLoadFunc load, tFinishFunc finish);
+
+	static void update(float budget_ms = -1); //once per frame, finishes loads till the budget is spent (upload_budget_ms if negative)
+	static void finish(); //blocks till every pending load is finished
+
+	static bool isLoading(const void* resource);
+	static void onLoaded(const void* resource, std::function<void(bool)> callback); //in the main thread once finished, right away if it is not loading
+	static std::shared_future<bool> getFuture(const void* resource); //it becomes ready inside update, do not wait for it in the main thread without calling update
+
+	static int getNumPending() { return num_requested - num_completed; }
+	static float getProgress() { return num_requested ? num_completed / (float)num_requested : 1.0f; }
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "ringbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+
+bool RingBuffer::use_persistent_mapping = true;
+size_t RingBuffer::default_size = 4 * 1024 * 1024;
+int RingBuffer::num_grows = 0;
+
+RingBuffer::RingBuffer(size_t region_size, GLenum target)
+{
+	this->region_size = region_size;
+	this->target = target;
+	buffer_id = 0;
+	persistent = false;
+	mapped = NULL;
+	bytes_frame = bytes_last_frame = 0;
+	frame = 0;
+	used = 0;
+	waited = false;
+	for (int i = 0; i < num_frames; ++i)
+		fences[i] = 0;
+	getBuffers().push_back(this);
+}
+
+RingBuffer::~RingBuffer()
+{
+	release();
+	freeRetired(true);
+	std::vector<RingBuffer*>& buffers = getBuffers();
+	buffers.erase(std::remove(buffers.begin(), buffers.end(), this), buffers.end());
+}
+
+//the GL buffer is created on the first map, when there is a context for sure
+void RingBuffer::create()
+{
+	assert(!buffer_id);
+	persistent = use_persistent_mapping && isGLExtensionSupported("GL_ARB_buffer_storage");
+	size_t total = region_size * num_frames;
+
+	glGenBuffers(1, &buffer_id);
+	GLState::bindBuffer(target, buffer_id);
+	if (persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, total, NULL, flags);
+		mapped = (char*)glMapBufferRange(target, 0, total, flags);
+		assert(mapped && "persistent mapping failed");
+	}
+	else
+		glBufferData(target, total, NULL, GL_STREAM_DRAW);
+	GLState::bindBuffer(target, 0);
+	GL_CHECK();
+
+	frame = 0;
+	used = 0;
+	waited = false;
+}
+
+//GL keeps the buffer alive till the GPU is done with it
+void RingBuffer::release()
+{
+	for (int i = 0; i < num_frames; ++i)
+	{
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+	if (!buffer_id)
+		return;
+	if (mapped)
+	{
+		GLState::bindBuffer(target, buffer_id);
+		glUnmapBuffer(target);
+		GLState::bindBuffer(target, 0);
+		mapped = NULL;
+	}
+	GLState::forgetBuffer(buffer_id);
+	glDeleteBuffers(1, &buffer_id);
+	buffer_id = 0;
+}
+
+void RingBuffer::retire()
+{
+	for (int i = 0; i < num_frames; ++i)
+	{
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+	if (!buffer_id)
+		return;
+	sRetired old;
+	old.buffer_id = buffer_id;
+	old.mapped = mapped != NULL;
+	old.fence = 0;
+	retired.push_back(old);
+	buffer_id = 0;
+	mapped = NULL;
+}
+
+void RingBuffer::freeRetired(bool wait)
+{
+	for (size_t i = 0; i < retired.size();)
+	{
+		sRetired& old = retired[i];
+		if (!old.fence && !wait)
+		{
+			++i;
+			continue;
+		}
+		if (old.fence)
+		{
+			GLenum result = glClientWaitSync(old.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+			if (result == GL_TIMEOUT_EXPIRED)
+			{
+				++i;
+				continue;
+			}
+			glDeleteSync(old.fence);
+		}
+		if (old.mapped)
+		{
+			GLState::bindBuffer(target, old.buffer_id);
+			glUnmapBuffer(target);
+			GLState::bindBuffer(target, 0);
+		}
+		GLState::forgetBuffer(old.buffer_id);
+		glDeleteBuffers(1, &old.buffer_id);
+		retired.erase(retired.begin() + i);
+	}
+}
+
+void RingBuffer::waitFrame()
+{
+	if (fences[frame])
+	{
+		//usually signaled long ago, otherwise the CPU is num_frames ahead and has to wait
+		GLenum result = glClientWaitSync(fences[frame], 0, 0);
+		while (result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+		glDeleteSync(fences[frame]);
+		fences[frame] = 0;
+	}
+	waited = true;
+}
+
+void* RingBuffer::map(size_t bytes, size_t& offset, size_t alignment)
+{
+	assert(bytes);
+	if (!buffer_id)
+		create();
+
+	size_t start = (used + alignment - 1) / alignment * alignment;
+	if (start + bytes > region_size)
+	{
+		//does not fit in this frame, the rest goes to a bigger buffer. The draws already queued keep the id
+		//and offsets of the old one, so it lives till the GPU has done this frame
+		size_t new_size = region_size * 2;
+		while (new_size < bytes)
+			new_size *= 2;
+		retire();
+		num_grows++;
+		region_size = new_size;
+		create();
+		start = 0;
+	}
+
+	if (!waited)
+		waitFrame();
+
+	offset = frame * region_size + start;
+	used = start + bytes;
+	bytes_frame += bytes;
+
+	GLState::bindBuffer(target, buffer_id);
+	if (persistent)
+		return mapped + offset;
+
+	void* ptr = glMapBufferRange(target, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	assert(ptr && "glMapBufferRange failed");
+	return ptr;
+}
+
+void RingBuffer::unmap()
+{
+	if (persistent)
+		return;
+	GLState::bindBuffer(target, buffer_id);
+	glUnmapBuffer(target);
+}
+
+void RingBuffer::endFrame()
+{
+	bytes_last_frame = bytes_frame;
+	bytes_frame = 0;
+
+	//the buffers retired this frame are used by its draws, issued by now
+	for (size_t i = 0; i < retired.size(); ++i)
+		if (!retired[i].fence)
+			retired[i].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	freeRetired();
+
+	if (!buffer_id)
+		return;
+
+	//if nothing was written the old fence of the region (if any) is still there
+	if (used)
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame = (frame + 1) % num_frames;
+	used = 0;
+	waited = false;
+}
+
+RingBuffer* RingBuffer::getDefault()
+{
+	static RingBuffer* buffer = NULL;
+	if (!buffer)
+		buffer = new RingBuffer(default_size);
+	return buffer;
+}
+
+//function static so it exists before any buffer is constructed
+std::vector<RingBuffer*>& RingBuffer::getBuffers()
+{
+	static std::vector<RingBuffer*> buffers;
+	return buffers;
+}
+
+void RingBuffer::EndFrameAll()
+{
+	std::vector<RingBuffer*>& buffers = getBuffers();
+	for (size_t i = 0; i < buffers.size(); ++i)
+		buffers[i]->endFrame();
+}
+
+size_t RingBuffer::getStreamedBytes()
+{
+	size_t bytes = 0;
+	std::vector<RingBuffer*>& buffers = getBuffers();
+	for (size_t i = 0; i < buffers.size(); ++i)
+		bytes += buffers[i]->bytes_last_frame;
+	return bytes;
+}
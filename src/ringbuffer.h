@@ -0,0 +1,68 @@
+/*  Ring buffer in VRAM for the data that changes every frame (instance matrices, transient vertices...).
+	It is split in num_frames regions, every frame writes in its own one and a fence tells when the GPU is done
+	with it, so the CPU only waits if it gets num_frames ahead of the GPU.
+	With ARB_buffer_storage the buffer is mapped once (persistent and coherent), otherwise every map uses
+	glMapBufferRange unsynchronized. In both cases the caller writes straight into the returned pointer.
+	If a frame does not fit the buffer grows, the old one is kept till the GPU is done with the draws that use it.
+	All the functions must be called from the main thread.
+*/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "includes.h"
+#include <vector>
+
+class RingBuffer
+{
+public:
+	static const int num_frames = 3;
+	static bool use_persistent_mapping; //when ARB_buffer_storage is supported
+	static size_t default_size; //bytes per frame of the default buffer
+	static int num_grows; //all the buffers, since the start
+
+	GLenum target;
+	GLuint buffer_id;
+	size_t region_size; //bytes of every frame, it grows if a frame needs more
+	bool persistent;
+
+	//stats
+	size_t bytes_frame; //written in the current frame
+	size_t bytes_last_frame;
+
+	RingBuffer(size_t region_size, GLenum target = GL_ARRAY_BUFFER);
+	~RingBuffer();
+
+	//space in the region of this frame, offset is where it starts inside the buffer. The buffer is left bound to target, call unmap after writing
+	void* map(size_t bytes, size_t& offset, size_t alignment = 16);
+	void unmap(); //nothing to do when persistent
+	void endFrame(); //once the draws using the data of this frame were issued
+
+	static RingBuffer* getDefault(); //shared by the instanced draws and any other per frame data, created on first use
+	static std::vector<RingBuffer*>& getBuffers();
+	static void EndFrameAll(); //once per frame after the swap
+	static size_t getStreamedBytes(); //last frame, all the buffers
+
+private:
+	char* mapped; //the whole buffer when persistent
+	GLsync fences[num_frames];
+	int frame; //current region
+	size_t used; //bytes of the current region
+	bool waited; //the fence of the current region was already waited
+
+	//buffers replaced by a bigger one, the draws of the frame they were replaced in still read them
+	struct sRetired {
+		GLuint buffer_id;
+		bool mapped;
+		GLsync fence; //after the last frame using it, 0 till that frame ends
+	};
+	std::vector<sRetired> retired;
+
+	void create();
+	void release();
+	void retire(); //like release but the buffer is deleted once the GPU is done with it
+	void freeRetired(bool wait = false);
+	void waitFrame();
+};
+
+#endif
@@ -22,10 +22,14 @@ public:
 	Material * material = NULL;
 	std::string name;
 
-	Mesh* mesh = NULL;
+	ResourceHandle<Mesh> mesh;
 	Matrix44 model;
+	Matrix44 previous_model; //before the last simulation tick, the render interpolates from it
+	int lod = 0; //last lod used, to apply the hysteresis
 
 	virtual void render(Camera* camera);
+	void updateLOD(Camera* camera); //chooses the lod from the size on screen
+	bool isInFrustum(Camera* camera); //bounding sphere test
 	virtual void renderWireframe(Camera* camera);
 	virtual void renderInMenu();
 };
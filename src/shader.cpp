@@ -8,6 +8,10 @@
 #include <locale>
 
 #include "texture.h"
+#include "uniformbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+#include <chrono>
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
@@ -53,8 +57,33 @@ std::map<std::string, std::string> Shader::s_shaders_atlas;
 
 #endif
 
-std::map<std::string,Shader*> Shader::s_Shaders;
+ResourceCache<Shader> Shader::s_Shaders("Shaders");
 bool Shader::s_ready = false;
+unsigned int Shader::s_last_uid = 0;
+bool Shader::use_binary_cache = true;
+std::string Shader::binary_cache_path = "data/shader_cache/";
+int Shader::num_binary_hits = 0;
+int Shader::num_binary_misses = 0;
+float Shader::binary_time_saved = 0;
+
+//header of the files of the binary cache
+struct sProgramBinaryHeader {
+	char magic[4]; //SBIN
+	unsigned int version;
+	GLenum format;
+	unsigned int length; //bytes after the header
+	float compile_time; //ms it took to compile it from source
+};
+const unsigned int PROGRAM_BINARY_VERSION = 1;
+
+#ifndef GL_COMPLETION_STATUS_KHR
+	#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+bool Shader::use_parallel_compile = true;
+std::vector<Shader*> Shader::s_compiling;
+
+static const char* code_prefix = "#define DESKTOP\n";
 Shader* Shader::current = NULL;
 
 Shader::Shader()
@@ -63,6 +92,13 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	uid = 0;
+	num_uniform_blocks = 0;
+	model_attrib_location = instance_color_attrib_location = -1;
+	compiling = false;
+	features = 0;
+	vs = fs = program = 0; //release is called even if the load failed before creating them
+	last_slot = 0;
 }
 
 Shader::~Shader()
@@ -76,10 +112,10 @@ void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 	ps_filename = psf;
 }
 
-bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
+bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros, bool wait)
 {
 	assert(	compiled == false );
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	vs_filename = vsf;
 	ps_filename = psf;
@@ -92,6 +128,12 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	if (!readFile(vsf,vsm) || !readFile(psf,psm))
 		return false;
 
+	//the features the code declares, the permutations ignore the rest
+	features = 0;
+	for (int i = 0; i < NUM_SHADER_FEATURES; ++i)
+		if (vsm.find(getFeatureMacro(i)) != std::string::npos || psm.find(getFeatureMacro(i)) != std::string::npos)
+			features |= 1 << i;
+
 	//printf("Vertex shader from memory:\n%s\n", vsm.c_str());
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
@@ -101,10 +143,13 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 		this->macros = macros;
 	}
 
+	if (!wait)
+		return startCompile(vsm, psm);
+
 	if (!compileFromMemory(vsm,psm))
 		return false;
 
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	return true;
 }
@@ -117,9 +162,9 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 		name = std::string(vsf) + "," + std::string(psf ? psf : "") + (macros ? macros : "");
 	else
 		name = vsf;
-	std::map<std::string,Shader*>::iterator it = s_Shaders.find(name);
-	if (it != s_Shaders.end())
-		return it->second;
+	Shader* cached = s_Shaders.find(name);
+	if (cached)
+		return cached;
 
 	if (!psf)
 		return NULL;
@@ -127,14 +172,13 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 	Shader* sh = new Shader();
 	if (!sh->load( vsf,psf, macros ))
 		return NULL;
-	s_Shaders[name] = sh;
+	s_Shaders.add(name, sh);
 	return sh;
 }
 
 void Shader::ReloadAll()
 {
-	for( std::map<std::string,Shader*>::iterator it = s_Shaders.begin(); it!=s_Shaders.end();it++)
-		it->second->recompile();
+	s_Shaders.forEach([](Shader* shader) { shader->recompile(); });
 	if(!s_shader_atlas_filename.empty())
 		LoadAtlas(s_shader_atlas_filename.c_str());
 	std::cout << "Shaders recompiled" << std::endl;
@@ -142,7 +186,7 @@ void Shader::ReloadAll()
 
 void Shader::Reload(const std::string& name)
 {
-	Shader* shader = s_Shaders[name];
+	Shader* shader = s_Shaders.find(name);
 	if (shader) {
 		shader->recompile();
 	}
@@ -161,6 +205,22 @@ static inline std::string trim(std::string str) {
 	return str;
 }
 
+Shader* Shader::getVariant(const char* macro)
+{
+	auto it = variants.find(macro);
+	if (it != variants.end())
+		return it->second;
+
+	Shader* variant = NULL;
+	if (!from_atlas && vs_filename.size() && ps_filename.size())
+	{
+		std::string variant_macros = macros + "#define " + macro + "\n";
+		variant = Get(vs_filename.c_str(), ps_filename.c_str(), variant_macros.c_str());
+	}
+	variants[macro] = variant;
+	return variant;
+}
+
 void Shader::setMacros(const char* macros)
 {
 	this->macros = macros;
@@ -219,6 +279,7 @@ bool Shader::LoadAtlas(const char* filename)
 
 	//compile shaders
 	std::string shaders = s_shaders_atlas[""];
+	std::vector< std::pair<std::string, Shader*> > pending;
 
 	lines = tokenize(shaders, "\n");
 	for (int i = 0; i < lines.size(); ++i)
@@ -249,27 +310,31 @@ bool Shader::LoadAtlas(const char* filename)
 		vs_code = macros + "\n" + vs_code;
 		fs_code = macros + "\n" + fs_code;
 
-		Shader* shader = NULL;
-		auto it = s_Shaders.find( name );
-		if(it == s_Shaders.end())
+		Shader* shader = s_Shaders.find( name );
+		if(!shader)
 		{
 			shader = new Shader();
-			s_Shaders[ name ] = shader;
+			s_Shaders.add( name, shader );
 		}
-		else
-			shader = it->second;
 	
-		if (!shader->compileFromMemory(vs_code,fs_code))
-		{
-			delete shader;
-			std::cout << " * Compilation error in shader at atlas: " << name << std::endl;
+		//all are sent to the driver before checking any, so they compile in parallel if it can
+		if (!shader->startCompile(vs_code,fs_code))
 			continue;
-		}
+		pending.push_back(std::make_pair(name, shader));
 
 		shader->vs_filename = vs_filename;
 		shader->ps_filename = fs_filename;
 		shader->from_atlas = true;
-		std::cout << " + Shader from atlas: " << name << std::endl;
+	}
+
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		if (!pending[i].second->finishCompile())
+		{
+			std::cout << " * Compilation error in shader at atlas: " << pending[i].first << std::endl;
+			continue;
+		}
+		std::cout << " + Shader from atlas: " << pending[i].first << std::endl;
 	}
 
 	return true;
@@ -286,6 +351,8 @@ bool Shader::recompile()
 	if (from_atlas || !vs_filename.size() || !ps_filename.size() ) //shaders compiled from memory cannot be recompiled
 		return false;
 	release(); //remove old shader
+	variants.clear(); //the failed ones are tried again
+	permutations.clear();
     return load( vs_filename,ps_filename, macros.size() ? macros.c_str() : NULL );
 }
 
@@ -302,6 +369,13 @@ bool Shader::hasInfoLog() const
 // ******************************************
 
 bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+{
+	if (!startCompile(vsm, psm))
+		return false;
+	return finishCompile();
+}
+
+bool Shader::startCompile(const std::string& vsm, const std::string& psm)
 {
 	if (glCreateProgram == 0)
 	{
@@ -310,31 +384,82 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	}
 
 	program = glCreateProgram();
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
-	if (!createVertexShaderObject(vsm))
+	std::string cache_filename;
+	if (use_binary_cache && isBinaryCacheSupported())
 	{
-		printf("Vertex shader compilation failed\n");
-		return false;
+		cache_filename = getBinaryCacheFilename(vsm, psm);
+		if (loadBinary(cache_filename))
+		{
+			onLinked();
+			return true;
+		}
+		num_binary_misses++;
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	}
+	isParallelCompileSupported(); //sets the threads of the driver before the first compile
+	compile_start = std::chrono::high_resolution_clock::now();
 
-	if (!createFragmentShaderObject(psm))
-	{
+	//the status is checked in finishCompile, asking for it now would wait for the driver
+	createVertexShaderObject(vsm);
+	createFragmentShaderObject(psm);
+	glLinkProgram(program);
+	GL_CHECK();
+
+	pending_vs = vsm;
+	pending_fs = psm;
+	pending_cache_filename = cache_filename;
+	compiling = true;
+	s_compiling.push_back(this);
+	return true;
+}
+
+bool Shader::isCompileDone()
+{
+	if (!compiling || !isParallelCompileSupported())
+		return true;
+	GLint done = 0;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+bool Shader::finishCompile()
+{
+	if (!compiling)
+		return compiled;
+	compiling = false;
+	s_compiling.erase(std::remove(s_compiling.begin(), s_compiling.end(), this), s_compiling.end());
+
+	bool ok = checkShaderObject(vs, pending_vs);
+	if (!ok)
+		printf("Vertex shader compilation failed\n");
+	else if (!(ok = checkShaderObject(fs, pending_fs)))
 		printf("Fragment shader compilation failed\n");
-		return false;
+
+	if (ok)
+	{
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		GL_CHECK();
+		if (!linked)
+			saveProgramInfoLog(program);
+		ok = linked != 0;
 	}
 
-	glLinkProgram(program);
-	assert (glGetError() == GL_NO_ERROR);
+	if (ok && pending_cache_filename.size())
+	{
+		//wall time, when compiled in parallel it counts the time waiting for the others too
+		std::chrono::duration<float, std::milli> compile_time = std::chrono::high_resolution_clock::now() - compile_start;
+		saveBinary(pending_cache_filename, compile_time.count());
+	}
 
-	GLint linked=0;
-    
-	glGetProgramiv(program,GL_LINK_STATUS,&linked);
-	assert(glGetError() == GL_NO_ERROR);
+	pending_vs.clear();
+	pending_fs.clear();
+	pending_cache_filename.clear();
 
-	if (!linked)
+	if (!ok)
 	{
-		saveProgramInfoLog(program);
 		release();
 		return false;
 	}
@@ -343,19 +468,262 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
+	onLinked();
+	return true;
+}
+
+void Shader::onLinked()
+{
+	reflectUniforms();
+	bindUniformBlocks(); //the bindings are not part of the binaries
+	model_attrib_location = glGetAttribLocation(program, "u_model");
+	instance_color_attrib_location = glGetAttribLocation(program, "a_instance_color");
 	compiled = true;
+	uid = ++s_last_uid;
+}
+
+//checked once because it needs a context, it also lets the driver use all the threads it wants
+bool Shader::isParallelCompileSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		supported = 0;
+		if (use_parallel_compile && isGLExtensionSupported("GL_KHR_parallel_shader_compile"))
+		{
+			typedef void (APIENTRY *tMaxShaderCompilerThreads)(GLuint count);
+			tMaxShaderCompilerThreads maxShaderCompilerThreads = (tMaxShaderCompilerThreads)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+			if (maxShaderCompilerThreads)
+			{
+				maxShaderCompilerThreads(0xFFFFFFFF); //as many as the driver wants
+				supported = 1;
+			}
+		}
+	}
+	return supported == 1;
+}
+
+void Shader::UpdateCompiles()
+{
+	//finishCompile removes it from the list
+	std::vector<Shader*> compiling = s_compiling;
+	for (size_t i = 0; i < compiling.size(); ++i)
+		if (compiling[i]->isCompileDone())
+			compiling[i]->finishCompile();
+}
+
+const char* Shader::getFeatureMacro(int index)
+{
+	static const char* macros[NUM_SHADER_FEATURES] = { "USE_TEXTURE", "USE_NORMALMAP", "USE_SKINNING", "USE_INSTANCING", "USE_UBOS" };
+	assert(index >= 0 && index < NUM_SHADER_FEATURES);
+	return macros[index];
+}
+
+Shader* Shader::requestPermutation(unsigned int requested)
+{
+	requested &= features;
+	if (!requested)
+		return this;
+
+	auto it = permutations.find(requested);
+	if (it != permutations.end())
+		return it->second;
+
+	Shader* permutation = NULL;
+	if (!from_atlas && vs_filename.size() && ps_filename.size())
+	{
+		std::string permutation_macros = macros;
+		for (int i = 0; i < NUM_SHADER_FEATURES; ++i)
+			if (requested & (1 << i))
+				permutation_macros += std::string("#define ") + getFeatureMacro(i) + "\n";
+		std::string name = vs_filename + "," + ps_filename + permutation_macros;
+		permutation = s_Shaders.find(name);
+		if (!permutation)
+		{
+			permutation = new Shader();
+			if (permutation->load(vs_filename, ps_filename, permutation_macros.c_str(), false))
+				s_Shaders.add(name, permutation);
+			else
+			{
+				delete permutation;
+				permutation = NULL;
+			}
+		}
+	}
+	permutations[requested] = permutation;
+	return permutation;
+}
+
+Shader* Shader::getPermutation(unsigned int requested, bool wait)
+{
+	Shader* permutation = requestPermutation(requested);
+	if (!permutation)
+		return NULL;
+	if (permutation->compiling)
+	{
+		if (!wait && !permutation->isCompileDone())
+			return NULL;
+		permutation->finishCompile();
+	}
+	return permutation->compiled ? permutation : NULL;
+}
+
+int Shader::getNumCompiling()
+{
+	return (int)s_compiling.size();
+}
+
+//checked once because it needs a context, some drivers expose the extension without any format
+bool Shader::isBinaryCacheSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint num_formats = 0;
+		if (isGLExtensionSupported("GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		supported = num_formats > 0 ? 1 : 0;
+		if (supported && !createFolder(binary_cache_path))
+		{
+			std::cout << "[WARN] Cannot create the shader cache folder " << binary_cache_path << std::endl;
+			supported = 0;
+		}
+	}
+	return supported == 1;
+}
 
+//64 bits FNV-1a, collisions in the file names are not a concern
+static unsigned long long hashString(const std::string& str, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < str.size(); ++i)
+		hash = (hash ^ (unsigned char)str[i]) * 1099511628211ULL;
+	return hash;
+}
+
+std::string Shader::getBinaryCacheFilename(const std::string& vsm, const std::string& psm)
+{
+	//a new driver cannot load the binaries of the old one
+	static std::string driver;
+	if (driver.empty())
+		driver = std::string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+
+	//the code with the macros, the prefix added by createShaderObject is always the same
+	unsigned long long hash = hashString(driver);
+	hash = hashString(vsm, hash);
+	hash = hashString("|", hash);
+	hash = hashString(psm, hash);
+	hash = hashString(std::to_string(PROGRAM_BINARY_VERSION) + (UniformBuffer::isSupported() ? "|ubo" : ""), hash);
+
+	char name[32];
+	sprintf(name, "%016llx.bin", hash);
+	return binary_cache_path + name;
+}
+
+bool Shader::loadBinary(const std::string& filename)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::string data;
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > (long)sizeof(sProgramBinaryHeader))
+	{
+		data.resize(size);
+		if (fread(&data[0], 1, size, f) != (size_t)size)
+			data.clear();
+	}
+	fclose(f);
+
+	sProgramBinaryHeader header;
+	if (data.size())
+		memcpy(&header, &data[0], sizeof(header));
+	if (data.empty() || memcmp(header.magic, "SBIN", 4) != 0 || header.version != PROGRAM_BINARY_VERSION || header.length != data.size() - sizeof(header))
+	{
+		std::cout << "[WARN] Corrupt shader binary, compiling it again: " << filename << std::endl;
+		remove(filename.c_str());
+		return false;
+	}
+
+	//a format the driver does not support anymore would be a GL error
+	GLint num_formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	std::vector<GLint> formats(num_formats);
+	if (num_formats)
+		glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+	GLint linked = 0;
+	if (std::find(formats.begin(), formats.end(), (GLint)header.format) != formats.end())
+	{
+		glProgramBinary(program, header.format, &data[sizeof(header)], header.length);
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	}
+	if (!linked)
+	{
+		//the driver changed in a way its version does not tell, compile it and the binary is saved again
+		std::cout << "[WARN] Shader binary rejected by the driver, compiling it again: " << filename << std::endl;
+		remove(filename.c_str());
+		GLState::forgetProgram(program);
+		glDeleteProgram(program);
+		program = glCreateProgram();
+		return false;
+	}
+
+	std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	num_binary_hits++;
+	binary_time_saved += header.compile_time - elapsed.count();
 	return true;
 }
 
+void Shader::saveBinary(const std::string& filename, float compile_time)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> data(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, &data[0]);
+	GL_CHECK();
+
+	sProgramBinaryHeader header;
+	memcpy(header.magic, "SBIN", 4);
+	header.version = PROGRAM_BINARY_VERSION;
+	header.format = format;
+	header.length = length;
+	header.compile_time = compile_time;
+
+	//to a temporary file first, so a crash does not leave half a binary
+	std::string tmp_filename = filename + ".tmp";
+	FILE* f = fopen(tmp_filename.c_str(), "wb");
+	if (!f)
+		return;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(&data[0], 1, length, f) == (size_t)length;
+	fclose(f);
+	remove(filename.c_str());
+	if (!ok || rename(tmp_filename.c_str(), filename.c_str()) != 0)
+		remove(tmp_filename.c_str());
+}
+
+std::string Shader::getBinaryCacheStats()
+{
+	int total = num_binary_hits + num_binary_misses;
+	if (!total)
+		return "";
+	return "Shader cache: " + std::to_string(num_binary_hits) + "/" + std::to_string(total) + " hits (" + std::to_string(num_binary_hits * 100 / total) + "%) saved " + std::to_string(int(binary_time_saved)) + "ms";
+}
+
 bool Shader::validate()
 {
 	glValidateProgram(program);
-	assert ( glGetError() == GL_NO_ERROR );
+	GL_CHECK();
 
 	GLint validated = 0;
 	glGetProgramiv(program,GL_LINK_STATUS,&validated);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	
 	if (!validated)
 	{
@@ -380,37 +748,40 @@ bool Shader::createFragmentShaderObject(const std::string& shader)
 bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::string& code)
 {
 	handle = glCreateShader(type);
-	assert( glGetError() == GL_NO_ERROR );
+	GL_CHECK();
     
-    std::string prefix = "#define DESKTOP\n";
-
-    std::string fullcode = prefix + code;
+    std::string fullcode = code_prefix + code;
 	const char* ptr = fullcode.c_str();
 	glShaderSource(handle, 1, &ptr, NULL);
-	assert( glGetError() == GL_NO_ERROR );
+	GL_CHECK();
 	
 	glCompileShader(handle);
-	assert( glGetError() == GL_NO_ERROR );
+	GL_CHECK();
 
+	glAttachShader(program,handle);
+	GL_CHECK();
+
+	return true;
+}
+
+bool Shader::checkShaderObject(GLuint handle, const std::string& code)
+{
 	GLint compile=0;
 	glGetShaderiv(handle,GL_COMPILE_STATUS,&compile);
-	assert( glGetError() == GL_NO_ERROR );
+	GL_CHECK();
 
 	//we want to see the compile log if we are in debug (to check warnings)
 	if (!compile)
 	{
 		saveShaderInfoLog(handle);
         std::cout << "Shader code:\n " << std::endl;
-		std::vector<std::string> lines = split( fullcode, '\n' );
+		std::vector<std::string> lines = split( code_prefix + code, '\n' );
 		for( size_t i = 0; i < lines.size(); ++i)
 			std::cout << i << "  " << lines[i] << std::endl;
 
 		return false;
 	}
 
-	glAttachShader(program,handle);
-	assert( glGetError() == GL_NO_ERROR );
-
 	return true;
 }
 
@@ -420,40 +791,44 @@ void Shader::release()
 	if (vs)
 	{
 		glDeleteShader(vs);
-		assert (glGetError() == GL_NO_ERROR);
+		GL_CHECK();
 		vs = 0;
 	}
 
 	if (fs)
 	{
 		glDeleteShader(fs);
-		assert (glGetError() == GL_NO_ERROR);
+		GL_CHECK();
 		fs = 0;
 	}
 
 	if (program)
 	{
+		GLState::forgetProgram(program);
 		glDeleteProgram(program);
-		assert (glGetError() == GL_NO_ERROR);
+		GL_CHECK();
 		program = 0;
 	}
 
-	locations.clear();
+	uniform_table.clear();
 
+	if (compiling)
+	{
+		compiling = false;
+		s_compiling.erase(std::remove(s_compiling.begin(), s_compiling.end(), this), s_compiling.end());
+	}
 	compiled = false;
 }
 
 
 void Shader::enable()
 {
-	if (current == this)
-		return;
-
 	current = this;
 
-	glUseProgram(program);
-	assert (glGetError() == GL_NO_ERROR);
+	GLState::useProgram(program); //nothing if it is in use already
+	GL_CHECK();
 
+	//the textures of every draw start in the same units, so the ones already bound are not bound again
 	last_slot = 0;
 }
 
@@ -462,23 +837,23 @@ void Shader::disable()
 {
 	current = NULL;
 
-	glUseProgram(0);
-	//glActiveTexture(GL_TEXTURE0);
-	assert (glGetError() == GL_NO_ERROR);
+	GLState::useProgram(0);
+	GL_CHECK();
 }
 
 void Shader::disableShaders()
 {
-	glUseProgram(0);
-	assert (glGetError() == GL_NO_ERROR);
+	current = NULL;
+	GLState::useProgram(0);
+	GL_CHECK();
 }
 
 void Shader::saveShaderInfoLog(GLuint obj)
 {
 	int len = 0;
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
     
 	if (len > 0)
 	{
@@ -486,7 +861,7 @@ void Shader::saveShaderInfoLog(GLuint obj)
 		GLsizei written=0;
 		glGetShaderInfoLog(obj, len, &written, ptr);
 		ptr[written-1]='\0';
-		assert(glGetError() == GL_NO_ERROR);
+		GL_CHECK();
 		log.append(ptr);
 		delete[] ptr;
         
@@ -498,9 +873,9 @@ void Shader::saveShaderInfoLog(GLuint obj)
 void Shader::saveProgramInfoLog(GLuint obj)
 {
 	int len = 0;
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	if (len > 0)
 	{
@@ -508,7 +883,7 @@ void Shader::saveProgramInfoLog(GLuint obj)
 		GLsizei written=0;
 		glGetProgramInfoLog(obj, len, &written, ptr);
 		ptr[written-1]='\0';
-		assert(glGetError() == GL_NO_ERROR);
+		GL_CHECK();
 		log.append(ptr);
 		delete[] ptr;
 
@@ -516,32 +891,100 @@ void Shader::saveProgramInfoLog(GLuint obj)
 	}
 }
 
-GLint Shader::getLocation(const char* varname,loctable* table)
+void Shader::reflectUniforms()
 {
-	if(varname == 0 || table == 0)
-		return 0;
+	uniform_table.clear();
 
-	GLint loc = 0;
-	loctable* locs = table;
+	GLint num_uniforms = 0;
+	GLint max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
 
-	loctable::iterator cur = locs->find(varname);
-	
-	if(cur == locs->end()) //not found in the locations table
+	std::vector< std::pair<std::string, GLint> > uniforms;
+	std::vector<char> buffer(max_length + 1);
+	for (GLint i = 0; i < num_uniforms; ++i)
+	{
+		GLint size = 0;
+		GLenum type = 0;
+		GLsizei length = 0;
+		glGetActiveUniform(program, i, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]);
+		std::string name(&buffer[0], length);
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) //arrays are listed as name[0]
+			name.resize(name.size() - 3);
+		GLint location = glGetUniformLocation(program, name.c_str());
+		if (location == -1) //inside a uniform block
+			continue;
+		uniforms.push_back(std::make_pair(name, location));
+		if (size > 1)
+			for (GLint j = 0; j < size; ++j)
+			{
+				std::string element = name + "[" + std::to_string(j) + "]";
+				uniforms.push_back(std::make_pair(element, glGetUniformLocation(program, element.c_str())));
+			}
+	}
+
+	size_t table_size = 8;
+	while (table_size < uniforms.size() * 2)
+		table_size *= 2;
+	sUniformSlot empty = { 0, -1 };
+	uniform_table.assign(table_size, empty);
+	size_t mask = table_size - 1;
+	for (size_t i = 0; i < uniforms.size(); ++i)
 	{
-		loc = glGetUniformLocation(program, varname);
-		if (loc == -1)
+		UniformId id = UniformId::fromName(uniforms[i].first.c_str());
+		size_t index = id.hash & mask;
+		while (uniform_table[index].hash && uniform_table[index].hash != id.hash)
+			index = (index + 1) & mask;
+		if (uniform_table[index].hash == id.hash)
 		{
-			return -1;
+			std::cout << "[WARN] Shader uniforms with the same hash: " << uniforms[i].first << " in " << vs_filename << "," << ps_filename << std::endl;
+			continue;
 		}
+		uniform_table[index].hash = id.hash;
+		uniform_table[index].location = uniforms[i].second;
+	}
+	GL_CHECK();
+}
+
+//the blocks are bound to the binding points of UniformBuffer, the same for every shader
+void Shader::bindUniformBlocks()
+{
+	num_uniform_blocks = 0;
+	if (!UniformBuffer::isSupported())
+		return;
 
-		//insert the new value
-		locs->insert(loctable::value_type(varname,loc));
+	GLint num_blocks = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &num_blocks);
+	for (GLint i = 0; i < num_blocks; ++i)
+	{
+		char name[256];
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(program, i, sizeof(name), &length, name);
+		int binding = UniformBuffer::getBinding(name);
+		if (binding == -1)
+		{
+			std::cout << "[WARN] Unknown uniform block " << name << " in " << vs_filename << "," << ps_filename << std::endl;
+			continue;
+		}
+		glUniformBlockBinding(program, i, binding);
+		num_uniform_blocks++;
 	}
-	else //found in the table
+	GL_CHECK();
+}
+
+GLint Shader::getLocation(UniformId id)
+{
+	if (uniform_table.empty())
+		return -1;
+	size_t mask = uniform_table.size() - 1;
+	for (size_t index = id.hash & mask; ; index = (index + 1) & mask)
 	{
-		loc = (*cur).second;
+		const sUniformSlot& slot = uniform_table[index];
+		if (slot.hash == id.hash)
+			return slot.location;
+		if (slot.hash == 0)
+			return -1;
 	}
-	return loc;
 }
 
 int Shader::getAttribLocation(const char* varname)
@@ -551,19 +994,19 @@ int Shader::getAttribLocation(const char* varname)
 	{
 		return loc;
 	}
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	return loc;
 }
 
 int Shader::getUniformLocation(const char* varname)
 {
-	int loc = getLocation(varname, &locations);
+	int loc = getLocation(varname);
 	if (loc == -1)
 	{
 		return loc;
 	}
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	return loc;
 }
 
@@ -575,171 +1018,230 @@ void Shader::setTexture(const char* varname, Texture* tex, int slot)
 		last_slot = (last_slot + 1) % 8;
 	}
 
-	glActiveTexture(GL_TEXTURE0 + slot);
-	glBindTexture(tex->texture_type, tex->texture_id);
+	GLState::bindTexture(slot, tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
-	glActiveTexture(GL_TEXTURE0 + slot);
 }
 
 void Shader::setTexture(const char* varname, unsigned int tex)
 {
-	glActiveTexture(GL_TEXTURE0 + last_slot);
-	glBindTexture(GL_TEXTURE_2D,tex);
+	GLState::bindTexture(last_slot, GL_TEXTURE_2D, tex);
 	setUniform1(varname,last_slot);
 	last_slot = (last_slot + 1) % 8;
-	glActiveTexture(GL_TEXTURE0 + last_slot);
+}
+
+void Shader::setUniform(UniformId id, int input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc != -1)
+		glUniform1i(loc, input);
+}
+
+void Shader::setUniform(UniformId id, float input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc != -1)
+		glUniform1f(loc, input);
+}
+
+void Shader::setUniform(UniformId id, const Vector2& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc != -1)
+		glUniform2f(loc, input.x, input.y);
+}
+
+void Shader::setUniform(UniformId id, const Vector3& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc != -1)
+		glUniform3f(loc, input.x, input.y, input.z);
+}
+
+void Shader::setUniform(UniformId id, const Vector4& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc != -1)
+		glUniform4f(loc, input.x, input.y, input.z, input.w);
+}
+
+void Shader::setUniform(UniformId id, const Matrix44& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc != -1)
+		glUniformMatrix4fv(loc, 1, GL_FALSE, input.m);
+}
+
+void Shader::setUniform(UniformId id, Texture* texture, int slot)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	if (loc == -1)
+		return;
+	if (slot == -1)
+	{
+		slot = last_slot;
+		last_slot = (last_slot + 1) % 8;
+	}
+	GLState::bindTexture(slot, texture->texture_type, texture->texture_id);
+	glUniform1i(loc, slot);
 }
 
 void Shader::setUniform1(const char* varname, int input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1i(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2i(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3i(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4i(loc, input1, input2, input3, input4);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform1Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform2Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform3Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform4Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4iv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform1(const char* varname, const float input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1f(loc, input1);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2f(loc, input1, input2);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3f(loc, input1, input2, input3);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4f(loc, input1, input2, input3, input4);
-	checkGLErrors();
+	GL_CHECK();
 }
 
 void Shader::setUniform1Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform2Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform3Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setUniform4Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4fv(loc,count,input);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setMatrix44(const char* varname, const float* m)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setMatrix44( const char* varname, const Matrix44 &m )
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m.m);
-	assert (glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::setMatrix44Array( const char* varname, Matrix44* m_array, int num )
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocation(varname);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 }
 
 void Shader::init()
@@ -789,9 +1291,9 @@ void Shader::init()
 
 Shader* Shader::getDefaultShader(std::string name)
 {
-	auto it = s_Shaders.find(name);
-	if (it != s_Shaders.end())
-		return it->second;
+	Shader* cached = s_Shaders.find(name);
+	if (cached)
+		return cached;
 
 	std::string vs = "";
 	std::string fs = "";
@@ -909,6 +1411,6 @@ Shader* Shader::getDefaultShader(std::string name)
 	sh->setUniform4("u_color", Vector4(1, 1, 1, 1));
 	sh->disable();
 
-	s_Shaders[name] = sh;
+	s_Shaders.add(name, sh);
 	return sh;
 }
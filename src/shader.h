@@ -9,7 +9,9 @@
 #include <string>
 #include <map>
 #include "framework.h"
+#include "resourcecache.h"
 #include <cassert>
+#include <chrono>
 
 #ifdef _DEBUG
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
@@ -20,11 +22,40 @@
 
 class Texture;
 
+//FNV-1a, usable at compile time
+constexpr unsigned int hashUniformName(const char* str, size_t len, unsigned int hash = 2166136261u)
+{
+	return len == 0 ? hash : hashUniformName(str + 1, len - 1, (hash ^ (unsigned char)str[0]) * 16777619u);
+}
+
+//hashed name of a uniform, "u_model"_u is computed at compile time and setUniform finds it with a probe in the table
+//of the shader (filled when linking), without comparing strings. Arrays are found by the name with and without [i]
+struct UniformId
+{
+	unsigned int hash; //never 0, it marks the empty slots of the table
+
+	constexpr explicit UniformId(unsigned int hash) : hash(hash ? hash : 1) {}
+	static UniformId fromName(const char* name) { return UniformId(hashUniformName(name, strlen(name))); }
+};
+
+constexpr UniformId operator "" _u(const char* str, size_t len) { return UniformId(hashUniformName(str, len)); }
+
+//optional parts of a shader, every one is a #define in the code (USE_TEXTURE...), see Shader::getPermutation
+enum eShaderFeature {
+	SHADER_TEXTURE = 1 << 0,
+	SHADER_NORMALMAP = 1 << 1,
+	SHADER_SKINNING = 1 << 2,
+	SHADER_INSTANCING = 1 << 3,
+	SHADER_UBOS = 1 << 4
+};
+const int NUM_SHADER_FEATURES = 5;
+
 class Shader
 {
 	int last_slot;
 
 	static bool s_ready; //used to initialize shader vars
+	static unsigned int s_last_uid;
 
 public:
 	static Shader* current;
@@ -36,10 +67,17 @@ public:
 	virtual bool compile();
 	virtual bool recompile();
 
-	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros);
+	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros, bool wait = true); //without waiting it compiles in the background, see startCompile
 
 	//internal functions
 	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
+
+	//compilation in two steps, startCompile sends the code to the driver and finishCompile checks the result (it waits if needed).
+	//With KHR_parallel_shader_compile the driver compiles in its threads and isCompileDone tells when finishCompile will not wait
+	bool startCompile(const std::string& vsm, const std::string& psm);
+	bool isCompileDone();
+	bool finishCompile(); //false if it did not compile or link
+	bool compiling; //between startCompile and finishCompile
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
@@ -60,6 +98,20 @@ public:
 	void setUniform(const char* varname, Texture* texture, int slot = -1) { assert(current == this); setTexture(varname, texture, slot); }
 	void setUniform(const char* varname, std::vector<Matrix44>& m_vector) { assert(current == this && m_vector.size()); setMatrix44Array(varname, &m_vector[0], m_vector.size()); }
 
+	//faster, with the name hashed at compile time ("u_model"_u)
+	void setUniform(UniformId id, int input);
+	void setUniform(UniformId id, float input);
+	void setUniform(UniformId id, const Vector2& input);
+	void setUniform(UniformId id, const Vector3& input);
+	void setUniform(UniformId id, const Vector4& input);
+	void setUniform(UniformId id, const Matrix44& input);
+	void setUniform(UniformId id, Texture* texture, int slot = -1);
+	GLint getLocation(UniformId id); //-1 if the shader does not have it
+
+	int num_uniform_blocks; //bound to the binding points of UniformBuffer when linking
+	int model_attrib_location; //the per instance mat4 u_model, -1 if it is not instanced
+	int instance_color_attrib_location; //a_instance_color, -1 if it does not have it
+
 	virtual void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
 	virtual void setVector3(const char* varname, const Vector3& input) { setUniform3(varname, input.x, input.y, input.z); }
 	virtual void setMatrix44(const char* varname, const float* m);
@@ -97,13 +149,14 @@ public:
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
 	bool compiled;
+	unsigned int uid; //unique for every compilation, caches of things tied to the program (like mesh VAOs) compare it to know they are outdated
 
 	void setMacros(const char * macros);
 
 	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
 	static void ReloadAll();
 	static void Reload(const std::string& name);
-	static std::map<std::string,Shader*> s_Shaders;
+	static ResourceCache<Shader> s_Shaders;
 
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
@@ -113,6 +166,34 @@ public:
 
 	static Shader* getDefaultShader(std::string name);
 
+	//linked programs are saved with glGetProgramBinary and loaded next time instead of compiling, the file name is a
+	//hash of the code, the macros and the driver, so any change compiles again. Needs GL_ARB_get_program_binary
+	static bool use_binary_cache;
+	static std::string binary_cache_path;
+	static int num_binary_hits;
+	static int num_binary_misses; //compiled from source, rejected binaries too
+	static float binary_time_saved; //ms, compile time of the hits minus what took to load them
+	static std::string getBinaryCacheStats();
+
+	//the same files compiled with a #define (like USE_INSTANCING), NULL if it was not loaded from files or it does not compile
+	Shader* getVariant(const char* macro);
+
+	//permutations: the same files with the macros of some eShaderFeature bits, the ones the code does not mention are ignored.
+	//requestPermutation starts compiling it in the background, getPermutation returns it once compiled, when not waiting
+	//it returns NULL while it compiles (or if it failed) so the caller can use another one meanwhile
+	unsigned int features; //the ones found in the code
+	Shader* requestPermutation(unsigned int features);
+	Shader* getPermutation(unsigned int features, bool wait = true);
+	static const char* getFeatureMacro(int index);
+
+	static bool use_parallel_compile; //KHR_parallel_shader_compile when supported
+	static bool isParallelCompileSupported();
+	static void UpdateCompiles(); //once per frame, finishes the background compiles that are done
+	static int getNumCompiling();
+
+	size_t getCPUBytes() { return sizeof(Shader) + info_log.size() + log.size(); } //the program binary is not known
+	size_t getVRAMBytes() { return 0; }
+
 protected:
 
 	std::string info_log;
@@ -120,10 +201,13 @@ protected:
 	std::string ps_filename;
 	std::string macros;
 	bool from_atlas;
+	std::map<std::string, Shader*> variants; //by macro, they live in s_Shaders, NULL if it failed
+	std::map<unsigned int, Shader*> permutations; //by features, the same
 
 	bool createVertexShaderObject(const std::string& shader);
 	bool createFragmentShaderObject(const std::string& shader);
 	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
+	bool checkShaderObject(GLuint handle, const std::string& shader); //prints the log and the code if it did not compile
 	void saveShaderInfoLog(GLuint obj);
 	void saveProgramInfoLog(GLuint obj);
 
@@ -134,21 +218,31 @@ protected:
 	GLuint program;
 	std::string log;
 
-//this is a hack to speed up shader usage (save info locally)
-private: 
-
-	struct ltstr
-	{
-		bool operator()(const char* s1, const char* s2) const
-		{
-			return strcmp(s1, s2) < 0;
-		}
-	};	
-	typedef std::map<const char*, int, ltstr> loctable;
+	//open addressing table of the active uniforms, filled when linking, the size is a power of two at least half empty
+	struct sUniformSlot {
+		unsigned int hash;
+		GLint location;
+	};
+	std::vector<sUniformSlot> uniform_table;
+
+	void reflectUniforms();
+	void bindUniformBlocks();
+	void onLinked();
+
+	//the code of the compile in progress, to print it if it fails
+	std::string pending_vs;
+	std::string pending_fs;
+	std::string pending_cache_filename;
+	std::chrono::high_resolution_clock::time_point compile_start;
+	static std::vector<Shader*> s_compiling;
+
+	static bool isBinaryCacheSupported();
+	std::string getBinaryCacheFilename(const std::string& vsm, const std::string& psm);
+	bool loadBinary(const std::string& filename);
+	void saveBinary(const std::string& filename, float compile_time);
 
 public:
-	GLint getLocation( const char* varname, loctable* table );
-	loctable locations;	
+	GLint getLocation(const char* varname) { return varname ? getLocation(UniformId::fromName(varname)) : -1; }
 };
 
 #endif
\ No newline at end of file
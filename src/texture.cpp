@@ -11,6 +11,9 @@
 #include "mesh.h"
 #include "shader.h"
 #include "extra/picopng.h"
+#include "resourceloader.h"
+#include "glstate.h"
+#include "gldebug.h"
 #include <cassert>
 
 //bilinear interpolation
@@ -43,7 +46,7 @@ Vector4 Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
 };
 
 
-std::map<std::string, Texture*> Texture::sTexturesLoaded;
+ResourceCache<Texture> Texture::sTexturesLoaded("Textures", 256 * 1024 * 1024, 1024 * 1024 * 1024);
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
@@ -79,8 +82,9 @@ Texture::~Texture()
 
 void Texture::clear()
 {
+	GLState::forgetTexture(texture_id);
 	glDeleteTextures(1, &texture_id);
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	texture_id = 0;
 }
 
@@ -115,10 +119,10 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	if(texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
-	assert(checkGLErrors() && "Error creating texture");
+	GL_CHECK();
 
-	if (data != NULL)
-		upload(format, type, mipmaps, data, internal_format);
+	//without data it only allocates the storage, so it can be attached to an FBO
+	upload(format, type, mipmaps, data, internal_format);
 }
 
 void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** data, unsigned int format, unsigned int type, bool mipmaps, unsigned int internal_format)
@@ -140,7 +144,7 @@ void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** dat
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	if (data != NULL)
 		uploadCubemap(format, type, mipmaps, data, internal_format);
@@ -165,32 +169,64 @@ bool Texture::cubemapFromHDRE(HDRE* hdre, unsigned int mipLevel)
 
 // skyboxes (TGA): https://utfiles.lagout.org/UEditor_Developing/skybox/
 
-bool Texture::cubemapFromImages(const char * folder)
+//reads the six faces, no GL calls so it can run in a worker thread
+static bool loadCubemapFaces(std::string folder, Image* images)
 {
-	uint8* faces[6];
-	std::string imgs[6] = {
-		std::string(folder) + "/rt.tga",
-		std::string(folder) + "/lf.tga",
-		std::string(folder) + "/dn.tga",
-		std::string(folder) + "/up.tga",
-		std::string(folder) + "/bk.tga",
-		std::string(folder) + "/ft.tga"
-	};
-
-	Image img;
+	const char* names[6] = { "/rt.tga", "/lf.tga", "/dn.tga", "/up.tga", "/bk.tga", "/ft.tga" };
 
 	for (int i = 0; i < 6; ++i)
 	{
-		if (!img.loadTGA(imgs[i].c_str()))
+		std::string filename = folder + names[i];
+		if (!images[i].loadTGA(filename.c_str()))
 		{
-			std::cout << imgs[i].c_str() << " not loaded" << std::endl;
+			std::cout << filename << " not loaded" << std::endl;
 			return false;
 		}
+		if (images[i].width != images[0].width || images[i].height != images[0].height || images[i].bytes_per_pixel != images[0].bytes_per_pixel)
+		{
+			std::cout << filename << " has a different size than the other faces" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+static void createCubemapFromFaces(Texture* texture, Image* images)
+{
+	uint8* faces[6];
+	for (int i = 0; i < 6; ++i)
+		faces[i] = images[i].data;
+	texture->createCubemap(images[0].width, images[0].height, faces, images[0].bytes_per_pixel == 3 ? GL_RGB : GL_RGBA);
+}
 
-		faces[i] = img.data;
+bool Texture::cubemapFromImages(const char * folder)
+{
+	//background loading, white faces till the images are ready
+	if (ResourceLoader::async)
+	{
+		Uint8 white[4] = { 255, 255, 255, 255 };
+		Uint8* faces[6] = { white, white, white, white, white, white };
+		createCubemap(1, 1, faces, GL_RGBA, GL_UNSIGNED_BYTE, false);
+		setName(folder);
+
+		Image* images = new Image[6];
+		std::string path = folder;
+		Texture* texture = this;
+		ResourceLoader::enqueue(this, folder,
+			[path, images]() { return loadCubemapFaces(path, images); },
+			[texture, images](bool result) {
+				if (result)
+					createCubemapFromFaces(texture, images);
+				delete[] images;
+			});
+		return true;
 	}
 
-	createCubemap(img.width, img.height, faces);
+	Image images[6];
+	if (!loadCubemapFaces(folder, images))
+		return false;
+
+	createCubemapFromFaces(this, images);
 	setName(folder);
 	return true;
 }
@@ -217,7 +253,7 @@ void Texture::create3D(unsigned int width, unsigned int height, unsigned int dep
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
-	assert(checkGLErrors() && "Error creating texture");
+	GL_CHECK();
 
 	if (data != NULL)
 		upload3D(format, type, mipmaps, data, internal_format);
@@ -233,9 +269,29 @@ Texture* Texture::Get(const char* filename, bool mipmaps, unsigned int wrap)
 	assert(filename);
 
 	//check if loaded
-	auto it = sTexturesLoaded.find(filename);
-	if (it != sTexturesLoaded.end())
-		return it->second;
+	Texture* cached = sTexturesLoaded.find(filename);
+	if (cached)
+		return cached;
+
+	//background loading, a white pixel till the image is ready. If it fails the pixel stays
+	if (ResourceLoader::async)
+	{
+		Uint8 white[4] = { 255, 255, 255, 255 };
+		Texture* texture = new Texture(1, 1, GL_RGBA, GL_UNSIGNED_BYTE, false, white);
+		texture->filename = filename;
+		texture->setName(filename);
+
+		Image* image = new Image();
+		std::string name = filename;
+		ResourceLoader::enqueue(texture, filename,
+			[image, name]() { return image->load(name.c_str()); },
+			[texture, image, mipmaps, wrap](bool result) {
+				if (result)
+					texture->create(image, mipmaps, wrap);
+				delete image;
+			});
+		return texture;
+	}
 
 	//load it
 	Texture* texture = new Texture();
@@ -250,27 +306,12 @@ Texture* Texture::Get(const char* filename, bool mipmaps, unsigned int wrap)
 
 bool Texture::load(const char* filename, bool mipmaps, unsigned int wrap, unsigned int type)
 {
-	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
 	long time = getTime();
 
 	std::cout << " + Texture loading: " << filename << " ... ";
 
-	image = new Image();
-	bool found = false;
-
-	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
-	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename, true);
-	else
-	{
-		std::cout << "[ERROR]: unsupported format" << std::endl;
-		return false; //unsupported file type
-	}
-
-	if (!found) //file not found
+	Image image;
+	if (!image.load(filename))
 	{
 		std::cout << " [ERROR]: Texture not found " << std::endl;
 		return false;
@@ -278,16 +319,8 @@ bool Texture::load(const char* filename, bool mipmaps, unsigned int wrap, unsign
 
 	this->filename = filename;
 
-	unsigned int internal_format = 0;
-
-	if (type == GL_FLOAT)
-		internal_format = (image->bytes_per_pixel == 3 ? GL_RGB32F : GL_RGBA32F);
-
 	//upload to VRAM
-	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0, wrap);
-
-	if (mipmaps)
-		generateMipmaps();
+	create(&image, mipmaps, wrap, type);
 
 	this->image.clear();
 	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
@@ -295,6 +328,14 @@ bool Texture::load(const char* filename, bool mipmaps, unsigned int wrap, unsign
 	return true;
 }
 
+void Texture::create(Image* image, bool mipmaps, unsigned int wrap, unsigned int type)
+{
+	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0, wrap);
+
+	if (this->mipmaps)
+		generateMipmaps();
+}
+
 void Texture::upload(Image* img)
 {
 	create(img->width, img->height, img->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
@@ -306,7 +347,7 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_2D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	glTexImage2D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
 
@@ -319,15 +360,15 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 	if (data && this->mipmaps)
 		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
 
-	glBindTexture(this->texture_type, 0);
-	assert(checkGLErrors() && "Error uploading texture");
+	GLState::bindTexture(this->texture_type, 0);
+	GL_CHECK();
 }
 
 void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format) {
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, data);
 
@@ -340,8 +381,8 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, Uin
 	if (data && this->mipmaps)
 		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
 
-	glBindTexture(this->texture_type, 0);
-	assert(checkGLErrors() && "Error uploading texture");
+	GLState::bindTexture(this->texture_type, 0);
+	GL_CHECK();
 }
 
 void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps, Uint8** data, unsigned int internal_format) {
@@ -349,7 +390,7 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_CUBE_MAP && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	assert(data && "cubemap must have faces data");
 
@@ -366,8 +407,8 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	if (data && this->mipmaps)
 		generateMipmaps();
 
-	glBindTexture(this->texture_type, 0);
-	assert(glGetError() == GL_NO_ERROR && "Error creating texture");
+	GLState::bindTexture(this->texture_type, 0);
+	GL_CHECK();
 }
 
 //special function to upload texture arrays, a special type of texture that has layers
@@ -420,22 +461,22 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 		data = image.data;
 
 	//How to store a texture in VRAM
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-	glBindTexture( this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture( this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	glTexImage3D( this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, data);
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR); //set the mag filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameterf(this->texture_type, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //better quality but takes more resources
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 	if (mipmaps)
 		generateMipmaps();
-	assert(glGetError() == GL_NO_ERROR);
+	GL_CHECK();
 
 	if (num_columns > 1)
 		delete[] data;
@@ -444,23 +485,23 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
-	glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
 }
 
 void Texture::unbind()
 {
 	//glDisable(this->texture_type); //disable the textures 
-	glBindTexture(this->texture_type, 0 );	//disable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, 0 );	//disable the id of the texture we are going to use
 }
 
 void Texture::UnbindAll()
 {
-	glDisable( GL_TEXTURE_CUBE_MAP );
-	glDisable( GL_TEXTURE_2D );
-	glDisable(GL_TEXTURE_3D);
-	glBindTexture( GL_TEXTURE_2D, 0 );
-	glBindTexture( GL_TEXTURE_CUBE_MAP, 0 );
-	glBindTexture(GL_TEXTURE_3D, 0);
+	GLState::disable(GL_TEXTURE_CUBE_MAP);
+	GLState::disable(GL_TEXTURE_2D);
+	GLState::disable(GL_TEXTURE_3D);
+	GLState::bindTexture( GL_TEXTURE_2D, 0 );
+	GLState::bindTexture( GL_TEXTURE_CUBE_MAP, 0 );
+	GLState::bindTexture(GL_TEXTURE_3D, 0);
 }
 
 void Texture::generateMipmaps()
@@ -468,7 +509,7 @@ void Texture::generateMipmaps()
 	if(!glGenerateMipmapEXT)
 		return;
 
-	glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter ); //set the mag filter
 	glGenerateMipmapEXT(this->texture_type);
 }
@@ -485,6 +526,38 @@ void Texture::toViewport(Shader* shader)
 	shader->disable();
 }
 
+size_t Texture::getCPUBytes()
+{
+	return sizeof(Texture) + (image.data ? image.width * image.height * image.bytes_per_pixel : 0);
+}
+
+size_t Texture::getVRAMBytes()
+{
+	if (!texture_id)
+		return 0;
+
+	size_t channels = 4;
+	if (format == GL_RED || format == GL_DEPTH_COMPONENT)
+		channels = 1;
+	else if (format == GL_RG)
+		channels = 2;
+	else if (format == GL_RGB)
+		channels = 3;
+
+	size_t channel_bytes = 1;
+	if (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT)
+		channel_bytes = 4;
+	else if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT)
+		channel_bytes = 2;
+
+	size_t bytes = (size_t)width * (size_t)height * (depth > 0 ? (size_t)depth : 1) * channels * channel_bytes;
+	if (texture_type == GL_TEXTURE_CUBE_MAP)
+		bytes *= 6;
+	if (mipmaps)
+		bytes += bytes / 3;
+	return bytes;
+}
+
 FBO* Texture::getGlobalFBO(Texture* texture)
 {
 	if (!global_fbo)
@@ -623,6 +696,20 @@ bool Image::loadTGA(const char* filename)
 #include <iostream>
 #include <fstream>
 
+bool Image::load(const char* filename)
+{
+	std::string str = filename;
+	std::string ext = str.size() > 4 ? str.substr(str.size() - 4, 4) : "";
+
+	if (ext == ".tga" || ext == ".TGA")
+		return loadTGA(filename);
+	else if (ext == ".png" || ext == ".PNG")
+		return loadPNG(filename, true);
+
+	std::cout << "[ERROR]: unsupported format " << filename << std::endl;
+	return false; //unsupported file type
+}
+
 bool Image::loadPNG(const char* filename, bool flip_y)
 {
 	std::ifstream file( filename, std::ios::in | std::ios::binary | std::ios::ate);
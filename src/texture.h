@@ -7,6 +7,7 @@
 #include "includes.h"
 #include "framework.h"
 #include "extra/hdre.h"
+#include "resourcecache.h"
 #include <map>
 #include <string>
 #include <cassert>
@@ -52,6 +53,7 @@ public:
 	void fromTexture(Texture* texture);
 	void fromScreen(int width, int height);
 
+	bool load(const char* filename); //by extension, no GL calls so it can run in a worker thread
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = true);
 	bool saveTGA(const char* filename, bool flip_y = true);
@@ -69,7 +71,7 @@ public:
 	//a general struct to store all the information about a TGA file
 
 	//textures manager
-	static std::map<std::string, Texture*> sTexturesLoaded;
+	static ResourceCache<Texture> sTexturesLoaded;
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
 	float width;
@@ -98,10 +100,11 @@ public:
 	void clear();
 
 	void create(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0, unsigned int wrap = GL_CLAMP_TO_EDGE);
+	void create(Image* image, bool mipmaps = true, unsigned int wrap = GL_REPEAT, unsigned int type = GL_UNSIGNED_BYTE);
 	
 	void createCubemap(unsigned int width, unsigned int height, Uint8** data = NULL, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, unsigned int internal_format = 0);
 	bool cubemapFromHDRE(HDRE* hdre, unsigned int mipLevel = 0);
-	bool cubemapFromImages(const char* folder);
+	bool cubemapFromImages(const char* folder); //with ResourceLoader::async it returns true and shows white faces till loaded
 
 	void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0, unsigned int wrap = GL_CLAMP_TO_EDGE);
 	void create3DFromVolume(Volume* volume, unsigned int wrap = GL_CLAMP_TO_EDGE);
@@ -125,8 +128,9 @@ public:
 	bool load(const char* filename, bool mipmaps = true, unsigned int wrap = GL_REPEAT, unsigned int type = GL_UNSIGNED_BYTE);
 
 	//load using the manager (caching loaded ones to avoid reloading them)
+	//with ResourceLoader::async it returns a 1x1 white texture that gets the image once loaded
 	static Texture* Get(const char* filename, bool mipmaps = true, unsigned int wrap = GL_REPEAT);
-	void setName(const char* name) { sTexturesLoaded[name] = this; }
+	void setName(const char* name) { sTexturesLoaded.add(name, this); }
 
 	void generateMipmaps();
 
@@ -134,6 +138,9 @@ public:
 	void toViewport( Shader* shader = NULL );
 	void blit(Texture* destination, Shader* shader = NULL);
 
+	size_t getCPUBytes(); //image kept in memory
+	size_t getVRAMBytes(); //estimated from the format, with mipmaps
+
 	static FBO* getGlobalFBO(Texture* texture);
 	static Texture* getBlackTexture();
 };
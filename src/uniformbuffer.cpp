@@ -0,0 +1,113 @@
+#include "uniformbuffer.h"
+#include "ringbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+#include "utils.h"
+#include "camera.h"
+#include "application.h"
+
+#include <cassert>
+#include <cstring>
+
+static_assert(sizeof(sFrameBlock) == 96, "sFrameBlock does not match the std140 layout of FrameBlock");
+static_assert(sizeof(sMaterialBlock) == 16, "sMaterialBlock does not match the std140 layout of MaterialBlock");
+
+bool UniformBuffer::use_ubos = true;
+int UniformBuffer::num_uploads = 0;
+int UniformBuffer::num_uploads_last_frame = 0;
+
+UniformBuffer::UniformBuffer()
+{
+	buffer_id = 0;
+	size = 0;
+}
+
+UniformBuffer::~UniformBuffer()
+{
+	if (!buffer_id)
+		return;
+	GLState::forgetBuffer(buffer_id);
+	glDeleteBuffers(1, &buffer_id);
+}
+
+void UniformBuffer::upload(const void* data, size_t size)
+{
+	if (!buffer_id)
+		glGenBuffers(1, &buffer_id);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+	if (size != this->size)
+		glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+	else
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, 0);
+	this->size = size;
+	num_uploads++;
+	GL_CHECK();
+}
+
+void UniformBuffer::bind(eBinding binding)
+{
+	assert(buffer_id && "upload before binding");
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_id); //nothing if it is bound already
+}
+
+//checked once because it needs a context
+bool UniformBuffer::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+		supported = isGLExtensionSupported("GL_ARB_uniform_buffer_object") ? 1 : 0;
+	return use_ubos && supported == 1;
+}
+
+int UniformBuffer::getBinding(const char* block_name)
+{
+	if (strcmp(block_name, "FrameBlock") == 0)
+		return FRAME_BINDING;
+	if (strcmp(block_name, "MaterialBlock") == 0)
+		return MATERIAL_BINDING;
+	return -1;
+}
+
+void UniformBuffer::setFrameUniforms(Camera* camera)
+{
+	static sFrameBlock last;
+	static bool uploaded = false;
+	static RingBuffer* ring = NULL;
+
+	sFrameBlock block = sFrameBlock(); //value initialized, the padding is zero for the memcmp
+	block.viewprojection = camera->viewprojection_matrix;
+	block.camera_position = camera->eye;
+	block.time = Application::instance->time;
+	block.exposure = Application::instance->scene_exposure;
+	block.output = (float)Application::instance->output;
+
+	//the region of the ring is only valid this frame
+	if (uploaded && ring && ring->bytes_frame && memcmp(&block, &last, sizeof(block)) == 0)
+		return;
+
+	if (!ring)
+		ring = new RingBuffer(64 * 1024, GL_UNIFORM_BUFFER);
+
+	static GLint alignment = 0;
+	if (!alignment)
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	size_t offset = 0;
+	void* ptr = ring->map(sizeof(block), offset, alignment);
+	memcpy(ptr, &block, sizeof(block));
+	ring->unmap();
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, 0);
+	GLState::bindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, ring->buffer_id, offset, sizeof(block));
+	GL_CHECK();
+
+	last = block;
+	uploaded = true;
+	num_uploads++;
+}
+
+void UniformBuffer::endFrame()
+{
+	num_uploads_last_frame = num_uploads;
+	num_uploads = 0;
+}
@@ -0,0 +1,60 @@
+/*  Uniform buffer objects (std140 uniform blocks) shared by the shaders.
+	The data of the frame and the camera (viewprojection, camera position, time...) is written once per camera
+	in a RingBuffer and bound to FRAME_BINDING, every material keeps its parameters in its own small buffer
+	bound to MATERIAL_BINDING that is only uploaded when they change, so the draws only upload the model.
+	The shaders use the blocks in their USE_UBOS variant (see Material::getShader), the blocks are declared in
+	the shaders with the same names and layout as the structs below.
+	All the functions must be called from the main thread.
+*/
+
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+#include "includes.h"
+#include "framework.h"
+
+class Camera;
+
+//std140, vec3 followed by a float share 16 bytes
+struct sFrameBlock {
+	Matrix44 viewprojection;
+	Vector3 camera_position;
+	float time;
+	float exposure;
+	float output;
+	float padding[2];
+};
+
+struct sMaterialBlock {
+	Vector4 color;
+};
+
+class UniformBuffer
+{
+public:
+	enum eBinding { FRAME_BINDING = 0, MATERIAL_BINDING = 1 };
+
+	static bool use_ubos; //when GL_ARB_uniform_buffer_object is supported
+
+	GLuint buffer_id;
+	size_t size;
+
+	UniformBuffer();
+	~UniformBuffer();
+	UniformBuffer(const UniformBuffer&) = delete; //a copy would delete the buffer twice
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	void upload(const void* data, size_t size); //the buffer is created on the first upload
+	void bind(eBinding binding);
+
+	static bool isSupported(); //use_ubos and the extension, needs a context
+	static int getBinding(const char* block_name); //-1 if it is not one of ours, used when linking the shaders
+	static void setFrameUniforms(Camera* camera); //uploads and binds the frame block, nothing if it did not change since last call
+
+	//stats
+	static int num_uploads; //this frame, frame and material blocks
+	static int num_uploads_last_frame;
+	static void endFrame();
+};
+
+#endif
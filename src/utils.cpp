@@ -4,14 +4,27 @@
 	#include <windows.h>
 #else
 	#include <sys/time.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
 
+#include <cerrno>
+#include <set>
 #include "includes.h"
 
 #include "application.h"
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
+#include "resourceloader.h"
+#include "resourcecache.h"
+#include "ringbuffer.h"
+#include "uniformbuffer.h"
+#include "glstate.h"
+#include "gldebug.h"
+#include "renderqueue.h"
 
 #include "extra/stb_easy_font.h"
 
@@ -128,6 +141,15 @@ std::string getPath()
     return fullpath;
 }
 
+bool createFolder(const std::string& path)
+{
+#ifdef WIN32
+	return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+	return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
 bool readFile(const std::string& filename, std::string& content)
 {
 	content.clear();
@@ -155,6 +177,90 @@ bool readFile(const std::string& filename, std::string& content)
 	return true;
 }
 
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+	file_handle = NULL;
+	mapping_handle = NULL;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* ptr = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!ptr)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file alive
+	if (ptr == MAP_FAILED)
+		return false;
+
+	size = st.st_size;
+#endif
+
+	data = (const char*)ptr;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+#else
+	munmap((void*)data, size);
+#endif
+
+	data = NULL;
+	size = 0;
+	file_handle = mapping_handle = NULL;
+}
+
 bool checkGLErrors()
 {
 	#ifdef _DEBUG
@@ -171,6 +277,41 @@ bool checkGLErrors()
 	return true;
 }
 
+std::string escapeJSON(const char* str)
+{
+	std::string result;
+	for (; str && *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			result += '\\';
+		result += *str;
+	}
+	return result;
+}
+
+bool isGLExtensionSupported(const char* name)
+{
+	//read once from the current context, SDL_GL_ExtensionSupported does not know the contexts SDL did not create (bench)
+	static std::set<std::string> extensions;
+	static bool loaded = false;
+	if (!loaded)
+	{
+		GLint num = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &num);
+		for (GLint i = 0; i < num; ++i)
+			extensions.insert((const char*)glGetStringi(GL_EXTENSIONS, i));
+		if (num == 0 && glGetString(GL_EXTENSIONS)) //older than 3.0
+		{
+			std::stringstream ss((const char*)glGetString(GL_EXTENSIONS));
+			std::string extension;
+			while (ss >> extension)
+				extensions.insert(extension);
+		}
+		loaded = true;
+	}
+	return extensions.count(name) != 0;
+}
+
 std::vector<std::string>& split(const std::string &s, char delim, std::vector<std::string> &elems) {
     std::stringstream ss(s);
     std::string item;
@@ -215,8 +356,8 @@ bool drawText(float x, float y, std::string text, Vector3 c, float scale )
 	Matrix44 projection_matrix;
 	projection_matrix.ortho(0, Application::instance->window_width / scale, Application::instance->window_height / scale, 0, -1, 1);
 
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
+	GLState::disable(GL_DEPTH_TEST);
+	GLState::disable(GL_CULL_FACE);
 
 	glMatrixMode(GL_MODELVIEW);
 	glPushMatrix();
@@ -235,8 +376,8 @@ bool drawText(float x, float y, std::string text, Vector3 c, float scale )
 	glMatrixMode(GL_MODELVIEW);
 	glPopMatrix();
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::enable(GL_CULL_FACE);
 
 	return true;
 }
@@ -298,19 +439,41 @@ std::vector<std::string> tokenize(const std::string& source, const char* delimit
 
 std::string getGPUStats()
 {
+	//asked to the driver once, an unsupported query would be reported as an error by the debug output
+	static int nvx_memory_info = -1;
+	if (nvx_memory_info == -1)
+		nvx_memory_info = isGLExtensionSupported("GL_NVX_gpu_memory_info") ? 1 : 0;
+
 	GLint nTotalMemoryInKB = 0;
-	glGetIntegerv(GL_GPU_MEM_INFO_TOTAL_AVAILABLE_MEM_NVX, &nTotalMemoryInKB);
 	GLint nCurAvailMemoryInKB = 0;
-	glGetIntegerv(GL_GPU_MEM_INFO_CURRENT_AVAILABLE_MEM_NVX, &nCurAvailMemoryInKB);
-	if (glGetError() != GL_NO_ERROR) //unsupported feature by driver
+	if (nvx_memory_info)
 	{
-		nTotalMemoryInKB = 0;
-		nCurAvailMemoryInKB = 0;
+		glGetIntegerv(GL_GPU_MEM_INFO_TOTAL_AVAILABLE_MEM_NVX, &nTotalMemoryInKB);
+		glGetIntegerv(GL_GPU_MEM_INFO_CURRENT_AVAILABLE_MEM_NVX, &nCurAvailMemoryInKB);
 	}
 
-	std::string str = "FPS: " + std::to_string(Application::instance->fps) + " DCS: " + std::to_string(Mesh::num_meshes_rendered) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB-nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
-	Mesh::num_meshes_rendered = 0;
-	Mesh::num_triangles_rendered = 0;
+	std::string str = "FPS: " + std::to_string(Application::instance->fps) + " DCS: " + std::to_string(Mesh::num_meshes_rendered_last_frame) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered_last_frame * 0.001)) + "Ks Culled clusters: " + std::to_string(Mesh::num_clusters_culled_last_frame) + "  VRAM: " + std::to_string(int((nTotalMemoryInKB-nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
+	if (Shader::getNumCompiling())
+		str += " Compiling shaders: " + std::to_string(Shader::getNumCompiling());
+	if (ResourceLoader::getNumPending())
+		str += " Loading: " + std::to_string(ResourceLoader::num_completed) + "/" + std::to_string(ResourceLoader::num_requested);
+	if (InstanceBatcher::num_batches)
+		str += " Instanced: " + std::to_string(InstanceBatcher::num_batched_nodes) + " nodes in " + std::to_string(InstanceBatcher::num_batches) + " DCS";
+	if (RenderQueue::num_packets)
+		str += " Switches: " + std::to_string(RenderQueue::num_program_switches) + " programs (" + std::to_string(RenderQueue::saved_program_switches) + " saved) " + std::to_string(RenderQueue::num_texture_switches) + " textures (" + std::to_string(RenderQueue::saved_texture_switches) + " saved)";
+	if (GLState::num_calls_last_frame)
+		str += " State changes: " + std::to_string(GLState::num_calls_last_frame) + " (" + std::to_string(GLState::num_filtered_last_frame) + " filtered)";
+	if (GLDebug::num_errors || GLDebug::num_warnings)
+		str += " GL errors: " + std::to_string(GLDebug::num_errors) + " warnings: " + std::to_string(GLDebug::num_warnings);
+	if (UniformBuffer::num_uploads_last_frame)
+		str += " UBO uploads: " + std::to_string(UniformBuffer::num_uploads_last_frame);
+	if (RingBuffer::getStreamedBytes())
+		str += " Streamed: " + std::to_string(int(RingBuffer::getStreamedBytes() / 1024)) + "KBs/frame";
+	if (RingBuffer::num_grows)
+		str += " Ring buffer grows: " + std::to_string(RingBuffer::num_grows);
+	str += "\n" + ResourceCacheBase::getStats();
+	if (Shader::num_binary_hits + Shader::num_binary_misses)
+		str += Shader::getBinaryCacheStats() + "\n";
 	return str;
 }
 
@@ -325,9 +488,9 @@ void drawGrid()
 	}
 
 	glLineWidth(1);
-	glEnable(GL_BLEND);
-	glDepthMask(false);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLState::enable(GL_BLEND);
+	GLState::depthMask(false);
+	GLState::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	Shader* grid_shader = Shader::getDefaultShader("grid");
 	grid_shader->enable();
 	Matrix44 m;
@@ -337,8 +500,8 @@ void drawGrid()
 	grid_shader->setUniform("u_camera_position", Camera::last_enabled->eye);
 	grid_shader->setUniform("u_viewprojection", Camera::last_enabled->viewprojection_matrix);
 	grid->render(GL_LINES); //background grid
-	glDisable(GL_BLEND);
-	glDepthMask(true);
+	GLState::disable(GL_BLEND);
+	GLState::depthMask(true);
 	grid_shader->disable();
 }
 
@@ -16,6 +16,25 @@ long getTime();
 float * snapshot();
 bool readFile(const std::string& filename, std::string& content);
 
+//read only memory mapping of a whole file, pages are loaded by the OS when accessed
+class MappedFile
+{
+public:
+	const char* data;
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete; //a copy would unmap it twice
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool open(const char* filename);
+	void close();
+
+private:
+	void* file_handle;
+	void* mapping_handle;
+};
+
 //generic purposes fuctions
 void drawGrid();
 bool drawText(float x, float y, std::string text, Vector3 c, float scale = 1);
@@ -23,14 +42,17 @@ Vector3 transformQuat(const Vector3& a, const Quaternion& q);
 
 //check opengl errors
 bool checkGLErrors();
+bool isGLExtensionSupported(const char* name); //of the current context, call it from the GL thread
 
 std::string getPath();
+bool createFolder(const std::string& path); //only the last folder of the path, true if it exists already
 
 Vector2 getDesktopSize( int display_index = 0 );
 
 std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings = false);
 std::vector<std::string>& split(const std::string &s, char delim, std::vector<std::string> &elems);
 std::vector<std::string> split(const std::string &s, char delim);
+std::string escapeJSON(const char* str); //to write it between quotes in a JSON file, NULL gives an empty string
 
 std::string getGPUStats();
 void drawGrid();
@@ -1,5 +1,9 @@
 #include "volume.h"
 #include "utils.h"
+#include "jobsystem.h"
+
+#include <vector>
+#include <algorithm>
 
 #include "extra/pvmparser.h"
 #include "extra/PerlinNoise.hpp"
@@ -159,22 +163,25 @@ unsigned int Volume::getTextureInternalFormat(){
 	return getTextureFormat();
 }
 
+//every job fills some slices of the volume
 void Volume::fillSphere() {
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			for (int k = 0; k < depth; k++) {
-				float f = 0;
-				float x = 2.0*(((float)i / width) - 0.5);
-				float y = 2.0*(((float)j / height) - 0.5);
-				float z = 2.0*(((float)k / depth) - 0.5);
-
-				f = (1.0 - (x*x + y * y + z * z) / 3.0);
-				f = f < 0.5 ? 0.0 : f;
-
-				data[i + width * j + width * height*k] = (Uint8)(f* 255.0);
+	JobSystem::parallelFor(depth, [&](int begin, int end) {
+		for (int k = begin; k < end; k++) {
+			for (int j = 0; j < height; j++) {
+				for (int i = 0; i < width; i++) {
+					float f = 0;
+					float x = 2.0*(((float)i / width) - 0.5);
+					float y = 2.0*(((float)j / height) - 0.5);
+					float z = 2.0*(((float)k / depth) - 0.5);
+
+					f = (1.0 - (x*x + y * y + z * z) / 3.0);
+					f = f < 0.5 ? 0.0 : f;
+
+					data[i + width * j + width * height*k] = (Uint8)(f* 255.0);
+				}
 			}
 		}
-	}
+	});
 }
 
 void Volume::fillNoise(float frequency, int octaves, unsigned int seed, unsigned int channel) {
@@ -187,15 +194,17 @@ void Volume::fillNoise(float frequency, int octaves, unsigned int seed, unsigned
 	const float fz = (float)depth / f;
 
 
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			for (int k = 0; k < depth; k++) {
-				float v = perlin.octaveNoise0_1(i / fx, j / fy, k / fz, o);
-				unsigned int index = i + j * width + k * width*height;
-				data[(index * voxelChannels) + (channel - 1)] = (Uint8)(255 * v);
+	JobSystem::parallelFor(depth, [&](int begin, int end) {
+		for (int k = begin; k < end; k++) {
+			for (int j = 0; j < height; j++) {
+				for (int i = 0; i < width; i++) {
+					float v = perlin.octaveNoise0_1(i / fx, j / fy, k / fz, o);
+					unsigned int index = i + j * width + k * width*height;
+					data[(index * voxelChannels) + (channel - 1)] = (Uint8)(255 * v);
+				}
 			}
 		}
-	}
+	});
 }
 
 void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel) {
@@ -229,35 +238,38 @@ void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel) {
 		}
 	}
 
-	//Compute min distance to point and store the max on for normalization
-	float maxdist = -1;
-	for (unsigned int i = 0; i < side; i++) {
-		for (unsigned int j = 0; j < side; j++) {
-			for (unsigned int k = 0; k < side; k++) {
-				vec3 point((float)i/subside, (float)j/subside, (float)k/subside);
-				vec3 basep2(std::floor(point.x), std::floor(point.y), std::floor(point.z));
-				float mindist = 10000;
-
-				for (unsigned int dx = 0; dx < 3; dx++) {
-					for (unsigned int dy = 0; dy < 3; dy++) {
-						for (unsigned int dz = 0; dz < 3; dz++) {
-							vec3 p2(basep2.x + dx - 1, basep2.y + dy - 1, basep2.z + dz - 1);
-							vec3 wrappedp2(p2.x == -1 ? cells - 1 : p2.x == cells ? 0 : p2.x,
-											p2.y == -1 ? cells - 1 : p2.y == cells ? 0 : p2.y,
-											p2.z == -1 ? cells - 1 : p2.z == cells ? 0 : p2.z);
-							unsigned int wrappedindex2 = wrappedp2.x + wrappedp2.y * cells + wrappedp2.z * cells * cells;
-							vec3 point2 = points[wrappedindex2] + p2;
-
-							float dist = point.distance(point2);
-							if (dist < mindist) mindist = dist;
+	//Compute min distance to point and store the max on for normalization (one max per slice, so the jobs do not share it)
+	std::vector<float> slice_maxdist(side, -1);
+	JobSystem::parallelFor(side, [&](int begin, int end) {
+		for (unsigned int k = begin; k < (unsigned int)end; k++) {
+			for (unsigned int j = 0; j < side; j++) {
+				for (unsigned int i = 0; i < side; i++) {
+					vec3 point((float)i/subside, (float)j/subside, (float)k/subside);
+					vec3 basep2(std::floor(point.x), std::floor(point.y), std::floor(point.z));
+					float mindist = 10000;
+
+					for (unsigned int dx = 0; dx < 3; dx++) {
+						for (unsigned int dy = 0; dy < 3; dy++) {
+							for (unsigned int dz = 0; dz < 3; dz++) {
+								vec3 p2(basep2.x + dx - 1, basep2.y + dy - 1, basep2.z + dz - 1);
+								vec3 wrappedp2(p2.x == -1 ? cells - 1 : p2.x == cells ? 0 : p2.x,
+												p2.y == -1 ? cells - 1 : p2.y == cells ? 0 : p2.y,
+												p2.z == -1 ? cells - 1 : p2.z == cells ? 0 : p2.z);
+								unsigned int wrappedindex2 = wrappedp2.x + wrappedp2.y * cells + wrappedp2.z * cells * cells;
+								vec3 point2 = points[wrappedindex2] + p2;
+
+								float dist = point.distance(point2);
+								if (dist < mindist) mindist = dist;
+							}
 						}
 					}
+					_distances[i + j*side + k*side*side] = mindist;
+					if (mindist > slice_maxdist[k]) slice_maxdist[k] = mindist;
 				}
-				_distances[i + j*side + k*side*side] = mindist;
-				if (mindist > maxdist) maxdist = mindist;
 			}
 		}
-	}
+	});
+	float maxdist = *std::max_element(slice_maxdist.begin(), slice_maxdist.end());
 
 	//Normalize and store
 	for (unsigned int i = 0; i < side; i++) {